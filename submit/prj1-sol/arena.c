@@ -0,0 +1,81 @@
+#include "arena.h"
+
+#include "epoch.h"
+#include "errnum.h"
+#include "storemem.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Old bytes of an arena awaiting reclamation
+typedef struct {
+  Retired retired;
+  StoreRef bytes;
+  size_t size;
+} RetiredBytes;
+
+static void free_retired_bytes(Retired *retired) {
+  RetiredBytes *old = (RetiredBytes *)retired;
+  store_free(old->bytes, old->size);
+  free(old);
+}
+
+// Move arena's bytes to a new block of newSize bytes.  If readers are
+// pinned the old block is retired rather than freed, since they may
+// still be reading it.
+static void move_arena(Arena *arena, size_t newSize, ErrNum *err) {
+  if (!is_epoch_pinned() || arena->bytes == 0) {
+    arena->bytes = store_realloc(arena->bytes, arena->size, newSize, err);
+    return;
+  }
+  StoreRef bytes = store_alloc(newSize, err);
+  RetiredBytes *old = *err == NO_ERR ? malloc(sizeof(RetiredBytes)) : NULL;
+  if (old == NULL) {
+    store_free(bytes, newSize);
+    *err = MEM_ERR;
+    return;
+  }
+  memcpy(store_at(bytes), store_at(arena->bytes), arena->len);
+  old->bytes = arena->bytes;
+  old->size = arena->size;
+  retire(&old->retired, free_retired_bytes);
+  arena->bytes = bytes;
+}
+
+void init_arena(Arena *arena) {
+  arena->bytes = 0;
+  arena->len = arena->size = 0;
+}
+
+size_t arena_alloc(Arena *arena, size_t n, ErrNum *err) {
+  enum { INIT_ARENA_SIZE = 4096 };
+  *err = NO_ERR;
+  if (arena->len + n > arena->size) {
+    size_t newSize = arena->size == 0 ? INIT_ARENA_SIZE : 2 * arena->size;
+    while (newSize < arena->len + n) newSize *= 2;
+    move_arena(arena, newSize, err);
+    if (*err != NO_ERR) return 0;
+    arena->size = newSize;
+  }
+  size_t offset = arena->len;
+  arena->len += n;
+  return offset;
+}
+
+void retire_arena(Arena *arena, ErrNum *err) {
+  *err = NO_ERR;
+  RetiredBytes *old = malloc(sizeof(RetiredBytes));
+  if (old == NULL) {
+    *err = MEM_ERR;
+    return;
+  }
+  old->bytes = arena->bytes;
+  old->size = arena->size;
+  retire(&old->retired, free_retired_bytes);
+  init_arena(arena);
+}
+
+void free_arena(Arena *arena) {
+  store_free(arena->bytes, arena->size);
+  init_arena(arena);
+}
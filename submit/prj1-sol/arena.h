@@ -0,0 +1,45 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include "errnum.h"
+#include "storemem.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** A growable byte arena in store memory (see storemem.h).
+ *  Allocations are addressed by their offset from the start of the
+ *  arena rather than by pointer, so they stay valid when the arena is
+ *  moved by growing.  Pointers obtained from arena_at() are only valid
+ *  until the next arena_alloc(), unless the reader holding them is
+ *  pinned (see epoch.h): the old bytes of a moved arena are then
+ *  retired rather than freed.
+ */
+typedef struct {
+  StoreRef bytes;
+  size_t len;           // # of bytes allocated
+  size_t size;          // # of bytes available
+} Arena;
+
+/** Initialize arena to empty. */
+void init_arena(Arena *arena);
+
+/** Allocate n bytes at the end of arena and return their offset.
+ *  Sets *err to MEM_ERR on failure.
+ */
+size_t arena_alloc(Arena *arena, size_t n, ErrNum *err);
+
+/** Return a pointer to the bytes at offset within arena. */
+static inline uint8_t *arena_at(const Arena *arena, size_t offset) {
+  return (uint8_t *)store_at(arena->bytes) + offset;
+}
+
+/** Retire arena's bytes (see epoch.h) and reinitialize it to empty.
+ *  Sets *err to MEM_ERR on failure, leaving arena unchanged.
+ */
+void retire_arena(Arena *arena, ErrNum *err);
+
+/** Free memory used by arena (but not arena itself). */
+void free_arena(Arena *arena);
+
+#endif //#ifndef ARENA_H_
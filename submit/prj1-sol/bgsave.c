@@ -0,0 +1,175 @@
+#include "bgsave.h"
+
+#include "chat.h"
+#include "errnum.h"
+#include "shmstore.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// What the child reports to the parent over the pipe
+typedef struct {
+  double elapsedNs;
+  uint64_t bytes;
+  uint64_t cowBytes;
+} BgsaveReport;
+
+static pid_t child = -1;
+static int reportFd = -1;       // read end of the child's pipe
+static BgsaveStats stats;
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Return the bytes of this process's pages which are not shared with
+// any other process; in a forked child these are the pages copied
+// since the fork (by either process) plus the few it allocated itself
+static size_t private_bytes(void) {
+  FILE *in = fopen("/proc/self/smaps_rollup", "r");
+  if (in == NULL) return 0;
+  size_t total = 0;
+  char line[128];
+  while (fgets(line, sizeof(line), in) != NULL) {
+    size_t kb;
+    if (sscanf(line, "Private_Clean: %zu kB", &kb) == 1 ||
+        sscanf(line, "Private_Dirty: %zu kB", &kb) == 1) {
+      total += kb * 1024;
+    }
+  }
+  fclose(in);
+  return total;
+}
+
+// Write the image to tmpPath and rename it to path, then report on fd
+// and exit without running the parent's exit handlers.  A store in
+// shared memory is first copied, telling the parent on copiedFd (if
+// not -1) once it may go on.
+static void run_child(const char *path, const char *tmpPath, int fd,
+                      int copiedFd, double t0) {
+  ErrNum err = IO_ERR;
+  if (copiedFd >= 0) {
+    char c = 0;
+    if (!privatize_shm_store() || write(copiedFd, &c, 1) != 1) {
+      _exit(EXIT_FAILURE);
+    }
+    close(copiedFd);
+  }
+  FILE *out = fopen(tmpPath, "w");
+  if (out != NULL) {
+    write_chat_image(out, &err);
+    long bytes = ftell(out);
+    if (fclose(out) != 0) err = IO_ERR;
+    if (err == NO_ERR && rename(tmpPath, path) != 0) err = IO_ERR;
+    if (err == NO_ERR) {
+      BgsaveReport report = {
+        .elapsedNs = now_ns() - t0,
+        .bytes = bytes,
+        .cowBytes = private_bytes(),
+      };
+      if (write(fd, &report, sizeof(report)) != sizeof(report)) err = IO_ERR;
+    }
+    else {
+      unlink(tmpPath);
+    }
+  }
+  _exit(err == NO_ERR ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+bool start_bgsave(ErrNum *err) {
+  *err = NO_ERR;
+  poll_bgsave();
+  if (child != -1) return false;
+  const char *path = getenv("CHAT_SNAPSHOT");
+  if (path == NULL || *path == '\0') path = BGSAVE_DEFAULT_PATH;
+  char tmpPath[strlen(path) + sizeof(".tmp")];
+  sprintf(tmpPath, "%s.tmp", path);
+  int fds[2];
+  int copiedFds[2] = { -1, -1 };
+  if (pipe(fds) != 0) {
+    *err = IO_ERR;
+    return true;
+  }
+  if (is_shm_writer() && pipe(copiedFds) != 0) {
+    close(fds[0]);
+    close(fds[1]);
+    *err = IO_ERR;
+    return true;
+  }
+  double t0 = now_ns();
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    if (copiedFds[0] >= 0) close(copiedFds[0]);
+    run_child(path, tmpPath, fds[1], copiedFds[1], t0);
+  }
+  close(fds[1]);
+  if (copiedFds[0] >= 0) {
+    // the child's copy is done (or it failed) once it writes or exits
+    close(copiedFds[1]);
+    if (pid > 0) {
+      char c;
+      ssize_t n = read(copiedFds[0], &c, 1);
+      (void)n;
+    }
+    close(copiedFds[0]);
+  }
+  stats.forkNs = now_ns() - t0;
+  if (pid < 0) {
+    close(fds[0]);
+    *err = IO_ERR;
+    return true;
+  }
+  child = pid;
+  reportFd = fds[0];
+  stats.isRunning = true;
+  return true;
+}
+
+// Collect the child which exited with status
+static void collect_child(int status) {
+  BgsaveReport report;
+  bool ok = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS &&
+    read(reportFd, &report, sizeof(report)) == sizeof(report);
+  close(reportFd);
+  child = -1;
+  reportFd = -1;
+  stats.isRunning = false;
+  if (ok) {
+    stats.nSaved++;
+    stats.elapsedNs = report.elapsedNs;
+    stats.bytes = report.bytes;
+    stats.cowBytes = report.cowBytes;
+  }
+  else {
+    stats.nFailed++;
+    fprintf(stderr, "snapshot failed: %s\n", errnum_to_string(IO_ERR));
+  }
+}
+
+void poll_bgsave(void) {
+  int status;
+  if (child != -1 && waitpid(child, &status, WNOHANG) == child) {
+    collect_child(status);
+  }
+}
+
+void get_bgsave_stats(BgsaveStats *s) {
+  poll_bgsave();
+  *s = stats;
+}
+
+void close_bgsave(void) {
+  int status;
+  if (child != -1 && waitpid(child, &status, 0) == child) {
+    collect_child(status);
+  }
+}
@@ -0,0 +1,56 @@
+#ifndef BGSAVE_H_
+#define BGSAVE_H_
+
+#include "errnum.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Background snapshots of the store to a file.
+ *
+ *  start_bgsave() forks, and the child writes the store's image (see
+ *  write_chat_image()) to a temporary file which it then renames to
+ *  the snapshot path, while the parent goes on serving from its
+ *  copy-on-write pages.  When it is done, the child reports over a
+ *  pipe how long it took, how many bytes it wrote and how many bytes
+ *  of pages were no longer shared with the parent, i.e. the memory
+ *  the snapshot cost in copies.  A store in shared memory (see
+ *  shmstore.h) is not copied on write, so the child first copies it
+ *  while the parent waits; the fork time includes that copy.  The
+ *  parent collects the report and the child's exit status in
+ *  poll_bgsave(), which never waits.  Only one snapshot runs at a
+ *  time.
+ *
+ *  Environment variable CHAT_SNAPSHOT gives the snapshot path
+ *  (default BGSAVE_DEFAULT_PATH).
+ */
+
+#define BGSAVE_DEFAULT_PATH "chat.snapshot"
+
+/** Outcome of background snapshots. */
+typedef struct {
+  size_t nSaved;        // # of snapshots completed
+  size_t nFailed;       // # of snapshots which failed
+  bool isRunning;
+  double forkNs;        // time the parent spent forking the last one
+  double elapsedNs;     // time the child of the last one took
+  size_t bytes;         // bytes written by the last one
+  size_t cowBytes;      // bytes of pages copied while it ran
+} BgsaveStats;
+
+/** Start a snapshot unless one is running, in which case return
+ *  false.  The store must not change during the call.  Sets *err to
+ *  MEM_ERR or IO_ERR if the child cannot be started.
+ */
+bool start_bgsave(ErrNum *err);
+
+/** Collect a finished snapshot, if any, reporting failure on stderr. */
+void poll_bgsave(void);
+
+/** Fill in *stats after polling. */
+void get_bgsave_stats(BgsaveStats *stats);
+
+/** Wait for a running snapshot to finish and collect it. */
+void close_bgsave(void);
+
+#endif //#ifndef BGSAVE_H_
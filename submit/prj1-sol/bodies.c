@@ -0,0 +1,125 @@
+#include "bodies.h"
+
+#include "dict.h"
+#include "epoch.h"
+#include "errnum.h"
+#include "storemem.h"
+#include "word.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  StoreRef bodies;      // Dict: body text -> Body
+  StoreRef byId;        // StoreRef[bodyIdsSize] of Bodies, 0 once freed
+  size_t nBodyIds;
+  size_t bodyIdsSize;
+  BodyStats stats;
+} Bodies;
+
+static Bodies localBodies;
+static Bodies *state = &localBodies;
+
+static inline StoreRef *bodies_by_id(void) {
+  return store_at(state->byId);
+}
+
+// Create a Body for text[len] with the next id.
+static Body *new_body(const char *text, size_t len, uint64_t hash,
+                      ErrNum *err) {
+  enum { INIT_BODY_IDS_SIZE = 16 };
+  if (state->nBodyIds == state->bodyIdsSize) {
+    size_t newSize = state->bodyIdsSize == 0
+      ? INIT_BODY_IDS_SIZE : 2 * state->bodyIdsSize;
+    StoreRef byId = store_realloc(state->byId,
+                                  state->bodyIdsSize * sizeof(StoreRef),
+                                  newSize * sizeof(StoreRef), err);
+    if (*err != NO_ERR) return NULL;
+    state->byId = byId;
+    state->bodyIdsSize = newSize;
+  }
+  Body *body = store_ptr(store_alloc(sizeof(Body) + len + 1, err));
+  if (*err != NO_ERR) return NULL;
+  *body = (Body) { .len = len, .hash = hash, .id = state->nBodyIds };
+  memcpy(body->text, text, len);
+  body->text[len] = '\0';
+  dict_put_hashed(store_at(state->bodies), body->text, len, hash, body, err);
+  if (*err != NO_ERR) {
+    store_free(store_ref(body), sizeof(Body) + len + 1);
+    return NULL;
+  }
+  bodies_by_id()[state->nBodyIds++] = store_ref(body);
+  state->stats.nBodies++;
+  return body;
+}
+
+const Body *share_body(const char *text, size_t len, ErrNum *err) {
+  *err = NO_ERR;
+  if (state->bodies == 0) {
+    state->bodies = store_ref(new_dict(err));
+    if (*err != NO_ERR) return NULL;
+  }
+  uint64_t hash = word_hash(text, len);
+  Body *body = dict_get_hashed(store_at(state->bodies), text, len, hash);
+  if (body == NULL) {
+    body = new_body(text, len, hash, err);
+    if (*err != NO_ERR) return NULL;
+  }
+  else {
+    state->stats.bytesSaved += len;
+  }
+  body->nRefs++;
+  state->stats.nRefs++;
+  return body;
+}
+
+const Body *body_by_id(size_t id) {
+  return store_at(bodies_by_id()[id]);
+}
+
+static void free_body(void *value) {
+  Body *body = value;
+  store_free(store_ref(body), sizeof(Body) + body->len + 1);
+}
+
+static void free_retired_body(Retired *retired) {
+  free_body(retired);
+}
+
+void release_body(size_t id) {
+  Body *body = store_at(bodies_by_id()[id]);
+  state->stats.nRefs--;
+  if (--body->nRefs > 0) {
+    state->stats.bytesSaved -= body->len;
+    return;
+  }
+  dict_remove_hashed(store_at(state->bodies), body->text, body->len,
+                     body->hash);
+  bodies_by_id()[id] = 0;
+  state->stats.nBodies--;
+  retire(&body->retired, free_retired_body);
+}
+
+void get_body_stats(BodyStats *bodyStats) {
+  *bodyStats = state->stats;
+}
+
+StoreRef share_bodies(ErrNum *err) {
+  StoreRef ref = store_alloc(sizeof(Bodies), err);
+  if (*err != NO_ERR) return 0;
+  state = store_at(ref);
+  *state = localBodies;
+  return ref;
+}
+
+void attach_bodies(StoreRef ref) {
+  state = store_at(ref);
+}
+
+void free_bodies(void) {
+  free_dict(store_ptr(state->bodies), free_body);
+  store_free(state->byId, state->bodyIdsSize * sizeof(StoreRef));
+  state->bodies = state->byId = 0;
+  state->nBodyIds = state->bodyIdsSize = 0;
+  state->stats = (BodyStats) { 0 };
+}
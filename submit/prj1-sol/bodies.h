@@ -0,0 +1,69 @@
+#ifndef BODIES_H_
+#define BODIES_H_
+
+#include "epoch.h"
+#include "errnum.h"
+#include "storemem.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Content-addressed store of message bodies shared by several
+ *  messages.  Identical bodies are found by hash and kept once with a
+ *  reference count.  Bodies are numbered by id so that records can
+ *  refer to them compactly.  Bodies are in store memory (see
+ *  storemem.h).
+ */
+
+/** Bodies shorter than this are not worth sharing: a reference costs
+ *  about as much as the body.
+ */
+enum { BODY_SHARE_MIN_LEN = 16 };
+
+typedef struct {
+  Retired retired;      // for deferred freeing once released
+  size_t len;
+  uint64_t hash;
+  size_t id;
+  size_t nRefs;
+  char text[];          // NUL-terminated
+} Body;
+
+/** Totals over all shared bodies. */
+typedef struct {
+  size_t nBodies;       // # of distinct shared bodies
+  size_t nRefs;         // # of messages referring to them
+  size_t bytesSaved;    // body bytes not stored thanks to sharing
+} BodyStats;
+
+/** Return the shared body equal to text[len], creating it if
+ *  necessary, and add a reference to it.  Sets *err to MEM_ERR on
+ *  failure.
+ */
+const Body *share_body(const char *text, size_t len, ErrNum *err);
+
+/** Return the body with the given id. */
+const Body *body_by_id(size_t id);
+
+/** Drop a reference to body id, retiring it (see epoch.h) when none
+ *  remain.
+ */
+void release_body(size_t id);
+
+/** Set *stats to the current totals. */
+void get_body_stats(BodyStats *stats);
+
+/** Move the (empty) store of bodies into store memory and return the
+ *  reference to it, by which another process mapping the same store
+ *  memory can use it with attach_bodies().  Sets *err to MEM_ERR on
+ *  failure.
+ */
+StoreRef share_bodies(ErrNum *err);
+
+/** Use the bodies shared at ref for reading only. */
+void attach_bodies(StoreRef ref);
+
+/** Free all shared bodies. */
+void free_bodies(void);
+
+#endif //#ifndef BODIES_H_
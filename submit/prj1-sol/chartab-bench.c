@@ -0,0 +1,83 @@
+// Microbenchmark of the chartab.h tables against <ctype.h> for the
+// per-byte work done by the command parsers: classify each byte as
+// space, letter or digit and lower-case it.
+//
+// usage: chartab-bench [N_BYTES [N_REPS]]
+//
+// The input is random command-like text.  The process locale is set
+// from the environment so that <ctype.h> pays for its locale lookups
+// as it would in a real program.
+
+#include "chartab.h"
+#include "errnum.h"
+
+#include <errors.h>
+
+#include <ctype.h>
+#include <locale.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Return a checksum of the classes and folded bytes of buf[n].  The
+// classes are summed rather than branched on so that the timings are
+// not dominated by mispredicting random input.
+static uint64_t scan_ctype(const unsigned char *buf, size_t n) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    unsigned char c = buf[i];
+    sum += (isspace(c) != 0) + 2*(isalpha(c) != 0) + 3*(isdigit(c) != 0);
+    sum += tolower(c);
+  }
+  return sum;
+}
+
+static uint64_t scan_table(const unsigned char *buf, size_t n) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    unsigned char c = buf[i];
+    sum += char_is_space(c) + 2*char_is_alpha(c) + 3*char_is_digit(c);
+    sum += char_fold(c);
+  }
+  return sum;
+}
+
+int
+main(int argc, const char *argv[])
+{
+  static const char alphabet[] =
+    "  \t@#abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+  size_t nBytes = argc > 1 ? atol(argv[1]) : 1 << 20;
+  size_t nReps = argc > 2 ? atol(argv[2]) : 100;
+  setlocale(LC_ALL, "");
+  unsigned char *buf = malloc(nBytes);
+  if (buf == NULL) fatal("%s", errnum_to_string(MEM_ERR));
+  uint64_t x = 88172645463325252ULL;
+  for (size_t i = 0; i < nBytes; i++) {
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    buf[i] = alphabet[x % (sizeof(alphabet) - 1)];
+  }
+
+  uint64_t sumCtype = 0, sumTable = 0;
+  double t0 = now_ns();
+  for (size_t r = 0; r < nReps; r++) sumCtype += scan_ctype(buf, nBytes);
+  double t1 = now_ns();
+  for (size_t r = 0; r < nReps; r++) sumTable += scan_table(buf, nBytes);
+  double t2 = now_ns();
+  if (sumCtype != sumTable) fatal("checksum mismatch: tables disagree with ctype");
+
+  double n = (double)nBytes * nReps;
+  printf("%zu bytes x %zu reps\n", nBytes, nReps);
+  printf("%-8s %12s\n", "method", "ns/byte");
+  printf("%-8s %12.3f\n", "ctype", (t1 - t0)/n);
+  printf("%-8s %12.3f\n", "table", (t2 - t1)/n);
+
+  free(buf);
+}
@@ -0,0 +1,44 @@
+#ifndef CHARTAB_H_
+#define CHARTAB_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Character classes and case folding for the command parsers.
+ *
+ *  These are compile-time tables indexed by an unsigned byte, so
+ *  classification costs a single load and does not depend on the
+ *  process locale: they agree with <ctype.h> in the "C" locale and
+ *  treat all bytes >= 0x80 as ordinary non-space characters.
+ */
+
+/** Bits of charClass[]. */
+enum {
+  CHAR_SPACE = 0x1,     // ' ', '\t', '\n', '\v', '\f', '\r'
+  CHAR_ALPHA = 0x2,     // 'a'-'z', 'A'-'Z'
+  CHAR_DIGIT = 0x4,     // '0'-'9'
+  CHAR_END = 0x8,       // '\0'
+};
+
+extern const uint8_t charClass[256];
+
+/** charFold[c] is c lower-cased. */
+extern const uint8_t charFold[256];
+
+static inline bool char_is_space(unsigned char c) {
+  return charClass[c] & CHAR_SPACE;
+}
+
+static inline bool char_is_alpha(unsigned char c) {
+  return charClass[c] & CHAR_ALPHA;
+}
+
+static inline bool char_is_digit(unsigned char c) {
+  return charClass[c] & CHAR_DIGIT;
+}
+
+static inline unsigned char char_fold(unsigned char c) {
+  return charFold[c];
+}
+
+#endif //#ifndef CHARTAB_H_
@@ -0,0 +1,248 @@
+// Standard benchmark workloads for the chat store, with comparison
+// against a stored baseline.
+//
+// usage: chat-bench [-o RESULTS] [-c BASELINE] [-t TIME_TOL] [-m MEM_TOL]
+//
+// Each command is fed to chat_io() on its own so that parsing is
+// included and per-command latencies can be measured.  For each
+// workload the throughput (commands/second) and the 99th percentile
+// latency are reported; the ADD workload also reports the heap bytes
+// used per message.  Results are written to RESULTS (stdout if
+// omitted) in the baseline format.
+//
+// With -c, the results are compared against BASELINE and the exit
+// status is non-zero if throughput dropped or p99 latency rose by
+// more than TIME_TOL percent (default 20), or if memory per message
+// rose by more than MEM_TOL percent (default 5).
+
+#include "chat.h"
+#include "chat-io.h"
+#include "errnum.h"
+
+#include <errors.h>
+
+#include <malloc.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Version of the results format; baselines of other versions are
+// rejected rather than misread.
+enum { BENCH_FORMAT_VERSION = 1 };
+
+enum {
+  N_ROOMS = 64,
+  N_TOPICS = 32,
+  N_USERS = 100,
+  N_ADDS = 50000,
+  N_QUERIES = 20000,
+  MAX_CMD_LEN = 256,
+};
+
+typedef enum { METRIC_THROUGHPUT, METRIC_P99, METRIC_BYTES, N_METRICS } Metric;
+
+static const char *metricNames[N_METRICS] = {
+  [METRIC_THROUGHPUT] = "throughput",
+  [METRIC_P99] = "p99_ns",
+  [METRIC_BYTES] = "bytes_per_msg",
+};
+
+typedef struct {
+  const char *name;
+  double values[N_METRICS];     // 0 if not measured
+} BenchResult;
+
+static FILE *devNull;
+static uint64_t rngState = 88172645463325252ULL;
+
+static uint64_t next_random(void) {
+  rngState ^= rngState << 13; rngState ^= rngState >> 7; rngState ^= rngState << 17;
+  return rngState;
+}
+
+// Rooms are skewed: a quarter of the traffic goes to room 0.
+static unsigned random_room(void) {
+  return next_random() % 4 == 0 ? 0 : next_random() % N_ROOMS;
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Large blocks are mmap()ed by malloc and not counted in uordblks.
+static size_t heap_in_use(void) {
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+// Run the command in cmd[len] through chat_io() and return its
+// latency in ns.
+static double run_command(char *cmd, size_t len) {
+  double t0 = now_ns();
+  FILE *in = fmemopen(cmd, len, "r");
+  if (in == NULL) fatal("cannot open command stream:");
+  chat_io("", in, devNull, devNull);
+  fclose(in);
+  return now_ns() - t0;
+}
+
+static int compare_doubles(const void *p1, const void *p2) {
+  double d1 = *(const double *)p1, d2 = *(const double *)p2;
+  return (d1 > d2) - (d1 < d2);
+}
+
+// Set throughput and p99 of result from latencies[n] measured over
+// totalNs.
+static void summarize(BenchResult *result, double latencies[], size_t n,
+                      double totalNs) {
+  qsort(latencies, n, sizeof(double), compare_doubles);
+  result->values[METRIC_THROUGHPUT] = n / (totalNs / 1e9);
+  result->values[METRIC_P99] = latencies[(size_t)(0.99 * (n - 1))];
+}
+
+static void bench_adds(BenchResult *result, double latencies[]) {
+  char cmd[MAX_CMD_LEN];
+  size_t heap0 = heap_in_use();
+  double t0 = now_ns();
+  for (size_t i = 0; i < N_ADDS; i++) {
+    int n = snprintf(cmd, sizeof(cmd), "+ @u%u r%u",
+                     (unsigned)(next_random() % N_USERS), random_room());
+    int nTopics = 1 + next_random() % 3;
+    for (int t = 0; t < nTopics; t++) {
+      n += snprintf(cmd + n, sizeof(cmd) - n, " #t%u",
+                    (unsigned)(next_random() % N_TOPICS));
+    }
+    n += snprintf(cmd + n, sizeof(cmd) - n, "\nmessage %zu\n.\n", i);
+    latencies[i] = run_command(cmd, n);
+  }
+  summarize(result, latencies, N_ADDS, now_ns() - t0);
+  result->values[METRIC_BYTES] = (double)(heap_in_use() - heap0) / N_ADDS;
+}
+
+// Query the store with nTopics (0, 1 or 2) random topics per query.
+static void bench_queries(BenchResult *result, double latencies[],
+                          int nTopics) {
+  char cmd[MAX_CMD_LEN];
+  double t0 = now_ns();
+  for (size_t i = 0; i < N_QUERIES; i++) {
+    int n = snprintf(cmd, sizeof(cmd), "? r%u 10", random_room());
+    for (int t = 0; t < nTopics; t++) {
+      n += snprintf(cmd + n, sizeof(cmd) - n, " #t%u",
+                    (unsigned)(next_random() % N_TOPICS));
+    }
+    n += snprintf(cmd + n, sizeof(cmd) - n, "\n.\n");
+    latencies[i] = run_command(cmd, n);
+  }
+  summarize(result, latencies, N_QUERIES, now_ns() - t0);
+}
+
+static void write_results(FILE *out, const BenchResult results[], size_t n) {
+  fprintf(out, "chat-bench %d\n", BENCH_FORMAT_VERSION);
+  for (size_t i = 0; i < n; i++) {
+    for (int m = 0; m < N_METRICS; m++) {
+      if (results[i].values[m] == 0) continue;
+      fprintf(out, "%s %s %.1f\n", results[i].name, metricNames[m],
+              results[i].values[m]);
+    }
+  }
+}
+
+// Compare results[n] against the baseline at path, reporting each
+// metric on stdout.  Returns # of regressions.
+static size_t compare_results(const char *path, const BenchResult results[],
+                              size_t n, double timeTol, double memTol) {
+  FILE *in = fopen(path, "r");
+  if (in == NULL) fatal("cannot read baseline %s:", path);
+  int version;
+  if (fscanf(in, "chat-bench %d", &version) != 1 ||
+      version != BENCH_FORMAT_VERSION) {
+    fatal("%s is not a version %d baseline", path, BENCH_FORMAT_VERSION);
+  }
+  size_t nRegressions = 0;
+  char name[64], metric[64];
+  double base;
+  printf("%-14s %-14s %14s %14s %8s\n", "workload", "metric", "baseline",
+         "current", "change");
+  while (fscanf(in, "%63s %63s %lf", name, metric, &base) == 3) {
+    int m = 0;
+    while (m < N_METRICS && strcmp(metricNames[m], metric) != 0) m++;
+    size_t i = 0;
+    while (i < n && strcmp(results[i].name, name) != 0) i++;
+    if (m == N_METRICS || i == n) {
+      printf("%-14s %-14s %14.1f %14s\n", name, metric, base, "(missing)");
+      nRegressions++;
+      continue;
+    }
+    double cur = results[i].values[m];
+    double change = 100 * (cur - base) / base;
+    bool isRegression = (m == METRIC_THROUGHPUT) ? -change > timeTol
+                      : (m == METRIC_P99) ? change > timeTol
+                      : change > memTol;
+    printf("%-14s %-14s %14.1f %14.1f %+7.1f%%%s\n", name, metric, base, cur,
+           change, isRegression ? " REGRESSION" : "");
+    nRegressions += isRegression;
+  }
+  fclose(in);
+  return nRegressions;
+}
+
+int
+main(int argc, char *argv[])
+{
+  const char *outPath = NULL;
+  const char *baselinePath = NULL;
+  double timeTol = 20, memTol = 5;
+  int opt;
+  while ((opt = getopt(argc, argv, "o:c:t:m:")) != -1) {
+    switch (opt) {
+    case 'o': outPath = optarg; break;
+    case 'c': baselinePath = optarg; break;
+    case 't': timeTol = atof(optarg); break;
+    case 'm': memTol = atof(optarg); break;
+    default:
+      fatal("usage: %s [-o RESULTS] [-c BASELINE] [-t TIME_TOL] [-m MEM_TOL]",
+            argv[0]);
+    }
+  }
+  devNull = fopen("/dev/null", "w");
+  double *latencies = malloc(N_ADDS * sizeof(double));
+  if (devNull == NULL || latencies == NULL) {
+    fatal("%s", errnum_to_string(MEM_ERR));
+  }
+
+  BenchResult results[] = {
+    { .name = "add" },
+    { .name = "query-recent" },
+    { .name = "query-topic" },
+    { .name = "query-topics2" },
+  };
+  bench_adds(&results[0], latencies);
+  for (int t = 0; t <= 2; t++) bench_queries(&results[1 + t], latencies, t);
+  size_t nResults = sizeof(results)/sizeof(results[0]);
+
+  FILE *out = stdout;
+  if (outPath != NULL && (out = fopen(outPath, "w")) == NULL) {
+    fatal("cannot write %s:", outPath);
+  }
+  if (baselinePath == NULL || outPath != NULL) {
+    write_results(out, results, nResults);
+  }
+  if (out != stdout) fclose(out);
+  size_t nRegressions = baselinePath == NULL ? 0
+    : compare_results(baselinePath, results, nResults, timeTol, memTol);
+
+  free_chats();
+  free(latencies);
+  fclose(devNull);
+  if (nRegressions > 0) {
+    fprintf(stderr, "%zu benchmark regressions\n", nRegressions);
+    return 1;
+  }
+  return 0;
+}
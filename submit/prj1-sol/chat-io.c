@@ -1,14 +1,28 @@
 #include "chat-io.h"
 
+#include "bgsave.h"
 #include "chat.h"
+#include "chartab.h"
 #include "errnum.h"
+#include "filter.h"
+#include "grep.h"
+#include "lexer.h"
+#include "perfctr.h"
+#include "server.h"
+#include "shmstore.h"
+#include "slowlog.h"
+#include "sweeper.h"
+#include "word.h"
 
 #include <errors.h>
 
 #include <assert.h>
-#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 
 /** This function should read commands from `in` and write successful
@@ -146,29 +160,6 @@
 
 #define MAX_STRING_LENGTH 100
 
-// Function to copy a string into newly allocated memory
-//This allocates memory fpr and copies string.
-//This ensure dynamic memory allocation for string
-// like user names , room mates and topics.
-
-char* allocate_and_copy_string(const char *str) {
-
-    if (str == NULL) 
-    {
-      return NULL;
-    }
-
-    size_t length = strlen(str) + 1; // +1 for the null terminator
-    char *copy = malloc(length);
-
-    if (copy == NULL) {
-        perror("Failed to allocate memory");
-        exit(EXIT_FAILURE);
-    }
-    strcpy(copy, str);
-    return copy;
-}
-
 // This concatenates new line to existing messages.
 
 char* concatenate_message(char *message, const char *line) {
@@ -206,138 +197,410 @@ char* concatenate_message(char *message, const char *line) {
 
     return new_message;
 }
-// Trims leading and trailing whitespace from a string.
-void trim_whitespace(char *str) {
-    
-    if (str == NULL) {
-        return; // Handle null pointer
+// Append word to the growable topics array
+static Word *add_topic(Word *topics, size_t num_topics, const Word *word) {
+    Word *new_topics = realloc(topics, (num_topics + 1) * sizeof(Word));
+    if (new_topics == NULL) {
+        perror("Failed to allocate memory for topics");
+        exit(EXIT_FAILURE);
     }
+    new_topics[num_topics] = *word;
+    return new_topics;
+}
 
-    // Trim leading whitespace
-    char *start = str;
-    while (isspace((unsigned char)*start)) {
-        start++;
+// Report how the last query was executed for an EXPLAIN command
+static void print_explain(FILE *out) {
+    const QueryPlan *plan = last_query_plan();
+    const QueryStats *stats = last_query_stats();
+    fprintf(out, "EXPLAIN plan %s count %zu topics %zu\n",
+            plan_kind_to_string(plan->kind), plan->count, plan->nTopics);
+    fprintf(out, "  cards room %zu min-topic %zu sum-topic %zu\n",
+            plan->roomCard, plan->minTopicCard, plan->sumTopicCard);
+    fprintf(out, "  costs scan %g intersect %g bitmap %g\n",
+            plan->scanCost, plan->intersectCost, plan->bitmapCost);
+    fprintf(out, "  examined %zu records %zu emitted %zu bytes %zu "
+            "elapsed %.1fus\n", stats->examined, stats->records,
+            stats->emitted, stats->bytes, stats->elapsedNs / 1e3);
+}
+
+// Report on the shared memory store, if any
+static void print_shm_stats(FILE *out) {
+    ShmStats shm;
+    if (get_shm_stats(&shm)) {
+        fprintf(out, "  shm in-use %zu committed %zu size %zu failed %zu%s\n",
+                shm.inUse, shm.committed, shm.size, shm.nFailed,
+                is_shm_reader() ? " attached" : "");
     }
+}
+
+// Report totals describing the store for a STATS command
+static void print_stats(FILE *out) {
+    ChatStats stats;
+    get_chat_stats(&stats);
+    fprintf(out, "STATS messages %zu record-bytes %zu\n",
+            stats.messages, stats.arenaBytes);
+    fprintf(out, "  users %zu rooms %zu topics %zu\n",
+            stats.users, stats.rooms, stats.topics);
+    fprintf(out, "  dedup bodies %zu refs %zu bytes-saved %zu\n",
+            stats.sharedBodies, stats.sharedRefs, stats.dedupSaved);
+    fprintf(out, "  deleted %zu dead-bytes %zu compactions %zu reclaimed %zu\n",
+            stats.deleted, stats.deadBytes, stats.compactions,
+            stats.reclaimedBytes);
+    fprintf(out, "  snapshots %zu retired %zu\n",
+            stats.snapshots, stats.retired);
+    BgsaveStats save;
+    get_bgsave_stats(&save);
+    fprintf(out, "  bgsave saved %zu failed %zu%s fork %.1fus elapsed %.1fms "
+            "bytes %zu cow-bytes %zu\n", save.nSaved, save.nFailed,
+            save.isRunning ? " running" : "", save.forkNs / 1e3,
+            save.elapsedNs / 1e6, save.bytes, save.cowBytes);
+    print_shm_stats(out);
+}
 
-    // If the string is all whitespace
-    if (*start == '\0') {
-        *str = '\0'; // Empty string
+// Handle the rest of a DELETE SEQ command
+static void delete_command(Lexer *lexer, FILE *err) {
+    Word seq, extra;
+    bool ok = lex_word(lexer, &seq) && seq.kind == WORD_COUNT &&
+              !lex_word(lexer, &extra);
+    if (ok) {
+        lock_store();
+        ok = delete_chat_msg(seq.count);
+        unlock_store();
+    }
+    if (!ok) {
+        fprintf(err, "BAD_SEQ\n");
+    }
+}
+
+// Handle the rest of a TTL ROOM SECONDS command
+static void ttl_command(Lexer *lexer, FILE *err) {
+    Word room, seconds, extra;
+    if (!lex_word(lexer, &room) || room.kind != WORD_ROOM) {
+        fprintf(err, "BAD_ROOM\n");
+    } else if (!lex_word(lexer, &seconds) || seconds.kind != WORD_COUNT ||
+               lex_word(lexer, &extra)) {
+        fprintf(err, "BAD_COUNT\n");
+    } else {
+        lock_store();
+        bool ok = set_room_ttl(&room, seconds.count);
+        unlock_store();
+        if (!ok) {
+            fprintf(err, "BAD_ROOM\n");
+        }
+    }
+}
+
+// Handle the rest of a SNAPSHOT command
+static void snapshot_command(Lexer *lexer, FILE *err) {
+    Word extra;
+    if (lex_word(lexer, &extra)) {
+        fprintf(err, "BAD_COMMAND\n");
         return;
     }
+    ErrNum errnum;
+    lock_store();
+    bool isStarted = start_bgsave(&errnum);
+    unlock_store();
+    if (!isStarted) {
+        fprintf(err, "BUSY\n");
+    } else if (errnum != NO_ERR) {
+        fprintf(err, "Error saving snapshot: %s\n", errnum_to_string(errnum));
+    }
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
 
-    // Trim trailing whitespace
-    char *end = start + strlen(start) - 1;
-    while (end > start && isspace((unsigned char)*end)) {
-        end--;
+// Output produced while the store is locked is built in memory and
+// only written to its destination once the lock is released, so that
+// a slow client cannot hold up the other users of the store.
+typedef struct {
+    FILE *out;          // where to produce it
+    FILE *dest;
+    char *text;
+    size_t len;
+} Response;
+
+// Start a response for dest and return the stream to produce it on;
+// without memory for a buffer, that is dest itself
+static FILE *begin_response(Response *response, FILE *dest) {
+    *response = (Response) { .dest = dest };
+    response->out = open_memstream(&response->text, &response->len);
+    if (response->out == NULL) {
+        response->out = dest;
     }
+    return response->out;
+}
 
-    // Null-terminate the trimmed string
-    *(end + 1) = '\0';
+// Write out a response begun by begin_response()
+static void end_response(Response *response) {
+    if (response->out == response->dest) {
+        return;
+    }
+    fclose(response->out);
+    fwrite(response->text, 1, response->len, response->dest);
+    free(response->text);
+}
+
+// Handle the rest of a GREP ROOM COUNT? TOPIC* = TEXT (or ~ REGEX)
+// command, whose words up to the = or ~ are those of a QUERY
+static void grep_command(Lexer *lexer, bool explain, const char *line,
+                         size_t command_len, FILE *err) {
+    Word token;
+    bool has_token = lex_word(lexer, &token);
+    Word room;
+    size_t count = 1;
+    Word *topics = NULL;
+    size_t num_topics = 0;
+    if (has_token && token.kind == WORD_ROOM) {
+        room = token;
+        has_token = lex_word(lexer, &token);
+    } else {
+        fprintf(err, "BAD_ROOM\n");
+        return;
+    }
+    if (has_token && token.kind == WORD_BAD_COUNT) {
+        fprintf(err, "BAD_COUNT\n");
+        return;
+    }
+    if (has_token && token.kind == WORD_COUNT) {
+        count = token.count;
+        if (count == 0) {
+            fprintf(err, "BAD_COUNT\n");
+            return;
+        }
+        has_token = lex_word(lexer, &token);
+    }
+    while (has_token && is_filter_clause(&token)) {
+        topics = add_topic(topics, num_topics, &token);
+        num_topics++;
+        has_token = lex_word(lexer, &token);
+    }
+    bool is_regex = has_token && strcmp(token.text, "~") == 0;
+    if (!has_token || (!is_regex && strcmp(token.text, "=") != 0)) {
+        fprintf(err, has_token ? "BAD_TOPIC\n" : "BAD_PATTERN\n");
+        free(topics);
+        return;
+    }
 
-    // Move trimmed string to the beginning
-    memmove(str, start, strlen(start) + 1);
+    // The pattern is the rest of the line, as is
+    size_t pattern_len;
+    const char *text = lex_rest(lexer, &pattern_len);
+    ErrNum errnum = NO_ERR;
+    BodyPattern *pattern = pattern_len == 0 ? NULL
+        : compile_body_pattern(text, pattern_len, is_regex, &errnum);
+    if (pattern == NULL) {
+        if (errnum != NO_ERR) {
+            fprintf(err, "Error compiling pattern: %s\n",
+                    errnum_to_string(errnum));
+        } else {
+            fprintf(err, "BAD_PATTERN\n");
+        }
+        free(topics);
+        return;
+    }
+    Response response;
+    FILE *out = begin_response(&response, err);
+    grep_chat_messages(count, &room, topics, num_topics, pattern, out);
+    if (explain) {
+        print_explain(out);
+    }
+    QueryStats stats = *last_query_stats();
+    end_response(&response);
+    if (slow_log_wants(stats.elapsedNs)) {
+        slow_log_command(line, command_len, stats.examined, stats.elapsedNs);
+    }
+    free_body_pattern(pattern);
+    free(topics);
 }
 
 // This is main function that handles I/O commands.
-
+// ADD and QUERY commands slower than the slow-log threshold are logged,
+// and hardware counters (if enabled) are attributed to each command
+// type from just after its line is read until the next read.
+// A QUERY may be prefixed by EXPLAIN to follow its output with the
+// plan and counters from its execution; STATS reports store totals.
+// The ROOM of a QUERY may be a comma-separated list of rooms (unless
+// it names a room itself), whose messages are merged newest first.
+// Besides plain topics, its TOPICs may be OR groups like (#a|#b) and
+// negated topics or groups like !#a; see filter.h.
+// DELETE SEQ deletes the SEQ'th message added (counting from 0), and
+// TTL ROOM SECONDS expires ROOM's messages SECONDS after they were
+// added (0 keeps them for ever); both output BAD_SEQ, BAD_ROOM or
+// BAD_COUNT errors like the other commands.
+// GREP ROOM COUNT? TOPIC* = TEXT outputs like the same QUERY the
+// newest COUNT matching messages whose bodies contain TEXT, the rest
+// of the line after the space following =; with ~ instead of = the
+// rest of the line is a regular expression (see grep.h).  A missing
+// or malformed pattern outputs BAD_PATTERN.
+// SNAPSHOT starts writing an image of the store in the background (see
+// bgsave.h), outputting BUSY if one is already being written; how it
+// went is reported by STATS.
+// A reader attached to a shared memory store (see shmstore.h) runs
+// QUERY, GREP, EXPLAIN and STATS against it like the writer, and
+// rejects the commands which would change the store (ADD, DELETE, TTL
+// and SNAPSHOT) with BAD_COMMAND.
+// The command line is lexed in place, so its words point into `line`
+// and message lines are read into a separate buffer.  The store is
+// only locked while it is used, never while waiting for input or
+// writing output (responses are built in memory while it is locked),
+// so the background sweeper (and other connections, see server.h)
+// run while we wait.  QUERY and GREP lock it a batch of matches at a
+// time, so writers are not held up by a long query (except by a
+// reader of a shared memory store, which locks it for the whole
+// query).  The prompt is flushed with any output before each command
+// is read, so it also marks the end of each response.
 
 void chat_io(const char *prompt, FILE *in, FILE *out, FILE *err) {
   
     char *line = NULL;
     size_t len = 0;
+    char *msg_line = NULL;
+    size_t msg_len = 0;
     ssize_t read;
     ErrNum errnum = NO_ERR;
 
 
-    while ((read = getline(&line, &len, in)) != -1) {
-        // Strip newline character
-        if (line[read - 1] == '\n') {
-            line[read - 1] = '\0';
+    PerfCmd perf_cmd = PERF_CMD_NONE;
+    for (;;) {
+        perf_end(perf_cmd);
+        if (*prompt != '\0') {
+            fputs(prompt, out);
+            fflush(out);
         }
-
+        if ((read = getline(&line, &len, in)) == -1) {
+            break;
+        }
+        perf_begin();
+        lock_store();
+        poll_bgsave();
+        unlock_store();
+        size_t command_len = read;
         // Determine command type
-        trim_whitespace(line);
-        if (line[0] == '+') {
+        Lexer lexer;
+        init_lexer(&lexer, line);
+        bool explain = lex_keyword(&lexer, "explain");
+        bool stats = !explain && lex_keyword(&lexer, "stats");
+        if (!explain && !stats && lex_keyword(&lexer, "delete")) {
+            perf_cmd = PERF_CMD_OTHER;
+            if (is_shm_reader()) {
+                fprintf(err, "BAD_COMMAND\n");
+            } else {
+                delete_command(&lexer, err);
+            }
+            continue;
+        }
+        if (!explain && !stats && lex_keyword(&lexer, "snapshot")) {
+            perf_cmd = PERF_CMD_OTHER;
+            if (is_shm_reader()) {
+                fprintf(err, "BAD_COMMAND\n");
+            } else {
+                snapshot_command(&lexer, err);
+            }
+            continue;
+        }
+        if (!explain && !stats && lex_keyword(&lexer, "ttl")) {
+            perf_cmd = PERF_CMD_OTHER;
+            if (is_shm_reader()) {
+                fprintf(err, "BAD_COMMAND\n");
+            } else {
+                ttl_command(&lexer, err);
+            }
+            continue;
+        }
+        if (!stats && lex_keyword(&lexer, "grep")) {
+            perf_cmd = PERF_CMD_QUERY;
+            grep_command(&lexer, explain, line, command_len, err);
+            continue;
+        }
+        int command = lex_command(&lexer);
+        perf_cmd = command == '+' ? PERF_CMD_ADD
+                 : command == '?' ? PERF_CMD_QUERY : PERF_CMD_OTHER;
+        if (stats) {
+            if (command == '\0') {
+                Response response;
+                FILE *out = begin_response(&response, err);
+                lock_store();
+                print_stats(out);
+                unlock_store();
+                end_response(&response);
+            } else {
+                fprintf(err, "BAD_COMMAND\n");
+            }
+        } else if (explain && command != '?') {
+            fprintf(err, "BAD_COMMAND\n");
+        } else if (command == '+') {
             // Handle ADD command
-            char *token = strtok(line + 1, " ");  // Skip the leading '+'
-            char *user = NULL;
-            char *room = NULL;
-            char **topics = NULL;
+            Word token;
+            bool has_token = lex_word(&lexer, &token);
+            Word user;
+            Word room;
+            Word *topics = NULL;
             size_t num_topics = 0;
             char *message = NULL;
 
             // Parses user
-            if (token && token[0] == '@') {
-                user = allocate_and_copy_string(token);
-                token = strtok(NULL, " ");
+            if (has_token && token.kind == WORD_USER) {
+                user = token;
+                has_token = lex_word(&lexer, &token);
             } else {
                 fprintf(err, "BAD_USER\n");
                 continue;
             }
             //parses room
-            if (token && isalpha(token[0])) {
-                room = allocate_and_copy_string(token);
-                token = strtok(NULL, " ");
+            if (has_token && token.kind == WORD_ROOM) {
+                room = token;
+                has_token = lex_word(&lexer, &token);
             } else {
                 fprintf(err, "BAD_ROOM\n");
-                free(user);
                 continue;
             }
 
             // // Parses topics
-            if(token && token[0] == '#') {
+            if(has_token && token.kind == WORD_TOPIC) {
                 //Multiple topics
-                while (token && token[0] == '#') {
-                    if (num_topics == 0) {
-                        topics = (char **)malloc(sizeof(char *));
-                    } else {
-                        topics = (char **)realloc(topics, (num_topics + 1) * sizeof(char *)); //multiple topics
-                    }
-                    if (topics == NULL) {
-                        perror("Failed to allocate memory for topics");
-                        free(user);
-                        free(room);
-                        continue;
-                    }
-                    topics[num_topics] = allocate_and_copy_string(token);
-                    to_lowercase(topics[num_topics]);
+                while (has_token && token.kind == WORD_TOPIC) {
+                    topics = add_topic(topics, num_topics, &token);
                     num_topics++;
-                    token = strtok(NULL, " ");
+                    has_token = lex_word(&lexer, &token);
                 }
             } else {
                 fprintf(err, "BAD_TOPIC\n");
-                free(user);
-                free(room);
                 continue;
             }
 
             // Collect message lines until 'period'
-            while ((read = getline(&line, &len, in)) != -1) {
+            while ((read = getline(&msg_line, &msg_len, in)) != -1) {
                 // Check for end of message input
-                if (line[0] == '.') {
+                if (msg_line[0] == '.') {
                     break;  // End of message input
                 }
-                message = concatenate_message(message, line);
+                message = concatenate_message(message, msg_line);
                 if (message == NULL) {
                     fprintf(err, "NO_MSG\n");
-                    free(user);
-                    free(room);
-                    for (size_t i = 0; i < num_topics; i++) {
-                        free(topics[i]);
-                    }
                     free(topics);
+                    free(msg_line);
                     free(line);
                     return;
                 }
             }
 
             // Create and store chat message
-            if (user && room && message) {
-                ChatMsg *chat_msg = create_chat_message(user, room, message, topics, num_topics, &errnum);
-                if (errnum == NO_ERR) {
-                    // Example: Store or handle the chat message
-                    add_chat_msg(chat_msg);
-                } else {
+            if (message && is_shm_reader()) {
+                fprintf(err, "BAD_COMMAND\n");
+            } else if (message) {
+                double t0 = now_ns();
+                lock_store();
+                add_chat_msg(&user, &room, message, strlen(message), topics, num_topics, &errnum);
+                unlock_store();
+                double elapsed = now_ns() - t0;
+                if (slow_log_wants(elapsed)) {
+                    slow_log_command(line, command_len, 0, elapsed);
+                }
+                if (errnum != NO_ERR) {
                     fprintf(err, "Error creating chat message: %s\n", errnum_to_string(errnum));
                 }
             } else {
@@ -345,79 +608,75 @@ void chat_io(const char *prompt, FILE *in, FILE *out, FILE *err) {
             }
 
             // Free topics array
-            for (size_t i = 0; i < num_topics; i++) {
-                free(topics[i]);
-            }
             free(topics);
-            free(user);
-            free(room);
+            free(message);
 
-        } else if (line[0] == '?') {
+        } else if (command == '?') {
             // Handle QUERY command
-            char *token = strtok(line + 2, " ");  // Skip the leading '?'
-            char *room = NULL;
+            Word token;
+            bool has_token = lex_word(&lexer, &token);
+            Word room;
             size_t count = 1;  // Default count
-            char **topics = NULL;
+            Word *topics = NULL;
             size_t num_topics = 0;
 
             // Parse QUERY command components: room
-            if (token && isalpha(token[0])) {
-                room = allocate_and_copy_string(token);
-                token = strtok(NULL, " ");
+            if (has_token && token.kind == WORD_ROOM) {
+                room = token;
+                has_token = lex_word(&lexer, &token);
             } else {
                 fprintf(err, "BAD_ROOM\n");
                 continue;
             }
 
-            if (token && isdigit(token[0])) {
-                count = (size_t)atoi(allocate_and_copy_string(token));
-                if(count < 0) {
+            if (has_token && token.kind == WORD_BAD_COUNT) {
+                fprintf(err, "BAD_COUNT\n");
+                continue;
+            }
+            if (has_token && token.kind == WORD_COUNT) {
+                count = token.count;
+                if (count == 0) {
                     fprintf(err, "BAD_COUNT\n");
-                    free(room);
                     continue;
                 }
-                token = strtok(NULL, " ");
+                has_token = lex_word(&lexer, &token);
             }
 
-            // Collect topics
-            if(token && token[0] == '#') {
-                while (token && token[0] == '#') {
-                    if (num_topics == 0) {
-                        topics = (char **)malloc(sizeof(char *));
-                    } else {
-                        topics = (char **)realloc(topics, (num_topics + 1) * sizeof(char *));
-                    }
-                    if (topics == NULL) {
-                        perror("Failed to allocate memory for topics");
-                        free(room);
-                        continue;
-                    }
-                    topics[num_topics] = allocate_and_copy_string(token);
-                    to_lowercase(topics[num_topics]);
+            // Collect topics, each a clause of the topic filter
+            if(has_token && is_filter_clause(&token)) {
+                while (has_token && is_filter_clause(&token)) {
+                    topics = add_topic(topics, num_topics, &token);
                     num_topics++;
-                    token = strtok(NULL, " ");
+                    has_token = lex_word(&lexer, &token);
                 }
-            }  else if(token) {
+            }  else if(has_token) {
                 fprintf(err, "BAD_TOPIC\n");
-                free(room);
                 continue;
             }
 
             // Perform query and display results
-            display_chat_messages(count, room, topics, num_topics, err);
+            Response response;
+            FILE *out = begin_response(&response, err);
+            display_chat_messages(count, &room, topics, num_topics, out);
+            if (explain) {
+                print_explain(out);
+            }
+            QueryStats stats = *last_query_stats();
+            end_response(&response);
+            if (slow_log_wants(stats.elapsedNs)) {
+                slow_log_command(line, command_len, stats.examined,
+                                 stats.elapsedNs);
+            }
 
             // Free topics array
-            for (size_t i = 0; i < num_topics; i++) {
-                free(topics[i]);
-            }
             free(topics);
-            free(room);
-        } else if (line[0] != '.') {
+        } else if (command != '.') {
                fprintf(err, "BAD_COMMAND\n");
         }
     }
 
-    // Free the line buffer
+    // Free the line buffers
+    free(msg_line);
     free(line);
 }
 
@@ -427,7 +686,7 @@ void to_lowercase(char *str) {
     }
 
     for (size_t i = 0; str[i] != '\0'; i++) {
-        str[i] = tolower((unsigned char) str[i]);
+        str[i] = char_fold(str[i]);
     }
 }
 
@@ -440,7 +699,45 @@ int main(int argc, const char *argv[]) {
   bool isInteractive = isatty(fileno(stdin));
   const char *prompt = isInteractive ? "> " : "";
   FILE *err = stderr;
-  chat_io(prompt, stdin, stdout, err);
+  ErrNum errnum;
+  init_slow_log(&errnum);
+  if (errnum != NO_ERR) {
+    perror("Failed to open slow log");
+    exit(EXIT_FAILURE);
+  }
+  const char *dedup = getenv("CHAT_DEDUP");
+  set_body_dedup(dedup != NULL && *dedup != '\0');
+  const char *port = getenv("CHAT_LISTEN");
+  bool isServing = port != NULL && *port != '\0';
+  //when serving, connections open counters of their own
+  init_perf_counters(&errnum);
+  if (errnum != NO_ERR) {
+    fprintf(stderr, "perf counters unavailable: %s\n", strerror(errno));
+  }
+  init_shm_store(&errnum);
+  if (errnum != NO_ERR) {
+    perror("Failed to open shared memory store");
+    exit(EXIT_FAILURE);
+  }
+  init_sweeper(&errnum);
+  if (errnum != NO_ERR) {
+    perror("Failed to start sweeper");
+    exit(EXIT_FAILURE);
+  }
+  if (isServing) {
+    serve_chat(port, &errnum);
+    if (errnum != NO_ERR) {
+      perror("Failed to serve connections");
+      exit(EXIT_FAILURE);
+    }
+  } else {
+    chat_io(prompt, stdin, stdout, err);
+  }
+  close_bgsave();
+  close_sweeper();
+  close_shm_store();
+  close_perf_counters(stderr);
+  close_slow_log();
 }
 
 #endif //#ifndef NO_CHAT_IO_MAIN
\ No newline at end of file
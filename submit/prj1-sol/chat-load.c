@@ -0,0 +1,433 @@
+// Open-loop load generator for chat serving connections (see
+// server.h).
+//
+// usage: chat-load -p PORT [-h HOST] [-c CONNS] [-t THREADS] [-r RATE]
+//                  [-d SECONDS] [-q QUERY_PCT]
+//
+// Opens CONNS connections (default 16) to HOST (default localhost),
+// driven by THREADS threads (default 4), and offers RATE commands a
+// second (default 1000) in total over SECONDS seconds (default 10),
+// QUERY_PCT percent of them (default 20) QUERYs and the rest ADDs.
+//
+// Each connection's commands are due at fixed intervals, staggered
+// across connections, and are sent when due without waiting for the
+// responses to earlier ones.  A command's latency runs from when it
+// was due to when the prompt ending its response arrives, so a
+// command delayed behind a slow one (in the server or in sending) is
+// measured as late rather than silently sent late, which would hide
+// the stall from the percentiles (coordinated omission).
+//
+// For each kind of command, and for both together, the number
+// answered, the throughput and the p50, p99, p999 and maximum
+// latencies are reported, along with the number still unanswered
+// DRAIN_SECONDS after the last was due.  Latencies are kept in
+// log-linear histograms accurate to 1 part in 2^SUB_BITS.
+
+#include "errnum.h"
+
+#include <errors.h>
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+enum {
+  N_ROOMS = 64,
+  N_TOPICS = 32,
+  N_USERS = 100,
+  QUERY_COUNT = 10,             // messages asked for by each QUERY
+  MAX_CMD_LEN = 128,
+  READ_SIZE = 64 * 1024,
+  DRAIN_SECONDS = 5,
+  SUB_BITS = 6,
+  N_SUB_BUCKETS = 1 << SUB_BITS,
+  N_BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS,
+};
+
+typedef enum { CMD_ADD, CMD_QUERY, N_CMD_KINDS } CmdKind;
+
+static const char *cmdNames[N_CMD_KINDS] = {
+  [CMD_ADD] = "add", [CMD_QUERY] = "query",
+};
+
+// Latencies in ns: values below 2*N_SUB_BUCKETS have a bucket each,
+// larger ones share N_SUB_BUCKETS buckets per power of 2.
+typedef struct {
+  uint64_t counts[N_BUCKETS];
+  uint64_t n;
+  uint64_t maxNs;
+} Histogram;
+
+typedef struct {
+  double dueNs;
+  CmdKind kind;
+} Pending;
+
+// State of the response line being read
+typedef enum { LINE_START, LINE_DOT, LINE_OTHER } LineState;
+
+typedef struct {
+  int fd;
+  double nextNs;                // when its next command is due
+  bool isGreeted;               // the prompt sent on opening was read
+  LineState lineState;
+  char *out;                    // commands queued, sent up to outSent
+  size_t outLen, outSent, outSize;
+  Pending *pending;             // ring of commands awaiting responses
+  size_t pendingHead, nPending, pendingSize;
+} Conn;
+
+typedef struct {
+  pthread_t thread;
+  Conn *conns;
+  size_t nConns;
+  uint64_t rngState;
+  uint64_t nQueued;
+  double lastResponseNs;
+  Histogram latencies[N_CMD_KINDS];
+  uint64_t nUnanswered[N_CMD_KINDS];
+} Worker;
+
+// Set up by main() before the workers start
+static double startNs, endNs, nsPerCmd;
+static unsigned queryPct = 20;
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t next_random(uint64_t *state) {
+  *state ^= *state << 13; *state ^= *state >> 7; *state ^= *state << 17;
+  return *state;
+}
+
+static size_t bucket_of(uint64_t ns) {
+  if (ns < 2 * N_SUB_BUCKETS) return ns;
+  int shift = 63 - __builtin_clzll(ns) - SUB_BITS;
+  return ((shift + 1) << SUB_BITS) + (ns >> shift) - N_SUB_BUCKETS;
+}
+
+// Return the largest value in bucket.
+static uint64_t bucket_max(size_t bucket) {
+  if (bucket < 2 * N_SUB_BUCKETS) return bucket;
+  int shift = (bucket >> SUB_BITS) - 1;
+  uint64_t min = (uint64_t)(N_SUB_BUCKETS + bucket % N_SUB_BUCKETS) << shift;
+  return min + ((uint64_t)1 << shift) - 1;
+}
+
+static void add_latency(Histogram *histogram, double ns) {
+  uint64_t value = ns < 0 ? 0 : (uint64_t)ns;
+  histogram->counts[bucket_of(value)]++;
+  histogram->n++;
+  if (value > histogram->maxNs) histogram->maxNs = value;
+}
+
+static void merge_histogram(Histogram *to, const Histogram *from) {
+  for (size_t i = 0; i < N_BUCKETS; i++) to->counts[i] += from->counts[i];
+  to->n += from->n;
+  if (from->maxNs > to->maxNs) to->maxNs = from->maxNs;
+}
+
+// Return the latency which a fraction p of histogram's does not
+// exceed, to within its bucket.
+static uint64_t percentile(const Histogram *histogram, double p) {
+  uint64_t rank = (uint64_t)(p * histogram->n + 0.5);
+  if (rank == 0) rank = 1;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < N_BUCKETS; i++) {
+    seen += histogram->counts[i];
+    if (seen >= rank) {
+      uint64_t max = bucket_max(i);
+      return max < histogram->maxNs ? max : histogram->maxNs;
+    }
+  }
+  return histogram->maxNs;
+}
+
+static int open_conn(const char *host, const char *port) {
+  struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+  struct addrinfo *addrs;
+  int status = getaddrinfo(host, port, &hints, &addrs);
+  if (status != 0) fatal("cannot resolve %s:%s: %s", host, port, gai_strerror(status));
+  int fd = -1;
+  for (struct addrinfo *a = addrs; a != NULL && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addrs);
+  if (fd < 0) fatal("cannot connect to %s:%s:", host, port);
+  int on = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  return fd;
+}
+
+static void push_pending(Conn *conn, double dueNs, CmdKind kind) {
+  if (conn->nPending == conn->pendingSize) {
+    size_t size = conn->pendingSize == 0 ? 16 : 2 * conn->pendingSize;
+    Pending *pending = malloc(size * sizeof(Pending));
+    if (pending == NULL) fatal("%s", errnum_to_string(MEM_ERR));
+    for (size_t i = 0; i < conn->nPending; i++) {
+      pending[i] = conn->pending[(conn->pendingHead + i) % conn->pendingSize];
+    }
+    free(conn->pending);
+    conn->pending = pending;
+    conn->pendingHead = 0;
+    conn->pendingSize = size;
+  }
+  size_t tail = (conn->pendingHead + conn->nPending) % conn->pendingSize;
+  conn->pending[tail] = (Pending) { .dueNs = dueNs, .kind = kind };
+  conn->nPending++;
+}
+
+// Queue the command due on conn at conn->nextNs.
+static void queue_command(Worker *worker, Conn *conn) {
+  if (conn->outSize - conn->outLen < MAX_CMD_LEN) {
+    size_t size = conn->outSize == 0 ? 4096 : 2 * conn->outSize;
+    conn->out = realloc(conn->out, size);
+    if (conn->out == NULL) fatal("%s", errnum_to_string(MEM_ERR));
+    conn->outSize = size;
+  }
+  char *p = conn->out + conn->outLen;
+  unsigned room = next_random(&worker->rngState) % N_ROOMS;
+  CmdKind kind;
+  int n;
+  if (next_random(&worker->rngState) % 100 < queryPct) {
+    kind = CMD_QUERY;
+    n = snprintf(p, MAX_CMD_LEN, "? r%u %d\n", room, QUERY_COUNT);
+  }
+  else {
+    kind = CMD_ADD;
+    n = snprintf(p, MAX_CMD_LEN, "+ @u%u r%u #t%u\nmessage %llu\n.\n",
+                 (unsigned)(next_random(&worker->rngState) % N_USERS), room,
+                 (unsigned)(next_random(&worker->rngState) % N_TOPICS),
+                 (unsigned long long)worker->nQueued);
+  }
+  conn->outLen += n;
+  worker->nQueued++;
+  push_pending(conn, conn->nextNs, kind);
+}
+
+// Send as much of conn's queued commands as it will take.
+static void send_queued(Conn *conn) {
+  while (conn->outSent < conn->outLen) {
+    ssize_t n = send(conn->fd, conn->out + conn->outSent,
+                     conn->outLen - conn->outSent, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) fatal("cannot send commands:");
+    conn->outSent += n;
+  }
+  conn->outLen = conn->outSent = 0;
+}
+
+// Record the response ended by a prompt read on conn at nowNs.
+static void complete_command(Worker *worker, Conn *conn, double nowNs) {
+  if (!conn->isGreeted) {
+    conn->isGreeted = true;
+    return;
+  }
+  if (conn->nPending == 0) fatal("prompt from server without a command");
+  Pending *pending = &conn->pending[conn->pendingHead];
+  add_latency(&worker->latencies[pending->kind], nowNs - pending->dueNs);
+  conn->pendingHead = (conn->pendingHead + 1) % conn->pendingSize;
+  conn->nPending--;
+  worker->lastResponseNs = nowNs;
+}
+
+// Read what has arrived on conn (at nowNs), completing a command for
+// each prompt line.
+static void read_responses(Worker *worker, Conn *conn, double nowNs) {
+  char buf[READ_SIZE];
+  for (;;) {
+    ssize_t n = recv(conn->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) fatal("cannot read responses:");
+    if (n == 0) fatal("connection closed by server");
+    for (ssize_t i = 0; i < n; i++) {
+      if (buf[i] == '\n') {
+        if (conn->lineState == LINE_DOT) complete_command(worker, conn, nowNs);
+        conn->lineState = LINE_START;
+      }
+      else {
+        conn->lineState = conn->lineState == LINE_START && buf[i] == '.'
+          ? LINE_DOT : LINE_OTHER;
+      }
+    }
+  }
+}
+
+// Queue and send the commands due on worker's connections until
+// endNs, then wait up to DRAIN_SECONDS for their responses.  Waits
+// on a timer rather than a poll() timeout, whose milliseconds are
+// too coarse to pace commands.
+static void *run_worker(void *arg) {
+  Worker *worker = arg;
+  int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  struct pollfd *fds = calloc(worker->nConns + 1, sizeof(struct pollfd));
+  if (timerFd < 0 || fds == NULL) fatal("cannot set up worker:");
+  double drainNs = endNs + DRAIN_SECONDS * 1e9;
+  for (;;) {
+    double now = now_ns();
+    double nextNs = endNs;
+    size_t nPending = 0;
+    for (size_t i = 0; i < worker->nConns; i++) {
+      Conn *conn = &worker->conns[i];
+      for (; conn->nextNs <= now && conn->nextNs < endNs; conn->nextNs += nsPerCmd) {
+        queue_command(worker, conn);
+      }
+      send_queued(conn);
+      if (conn->nextNs < nextNs) nextNs = conn->nextNs;
+      nPending += conn->nPending;
+      fds[i] = (struct pollfd) {
+        .fd = conn->fd,
+        .events = POLLIN | (conn->outSent < conn->outLen ? POLLOUT : 0),
+      };
+    }
+    if (now >= endNs && (nPending == 0 || now >= drainNs)) break;
+    double wakeNs = now < endNs ? nextNs : drainNs;
+    struct itimerspec wake = {
+      .it_value = { .tv_sec = wakeNs / 1e9, .tv_nsec = (uint64_t)wakeNs % 1000000000 },
+    };
+    timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &wake, NULL);
+    fds[worker->nConns] = (struct pollfd) { .fd = timerFd, .events = POLLIN };
+    if (poll(fds, worker->nConns + 1, -1) < 0 && errno != EINTR) {
+      fatal("cannot wait for responses:");
+    }
+    now = now_ns();
+    for (size_t i = 0; i < worker->nConns; i++) {
+      if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+        read_responses(worker, &worker->conns[i], now);
+      }
+    }
+    uint64_t nExpired;
+    ssize_t n = read(timerFd, &nExpired, sizeof(nExpired));
+    (void)n;
+  }
+  for (size_t i = 0; i < worker->nConns; i++) {
+    Conn *conn = &worker->conns[i];
+    for (size_t j = 0; j < conn->nPending; j++) {
+      Pending *pending = &conn->pending[(conn->pendingHead + j) % conn->pendingSize];
+      worker->nUnanswered[pending->kind]++;
+    }
+  }
+  close(timerFd);
+  free(fds);
+  return NULL;
+}
+
+static void print_result(const char *name, const Histogram *histogram,
+                         uint64_t nUnanswered, double seconds) {
+  printf("%-8s %10llu %10.0f %10.1f %10.1f %10.1f %10.1f %10llu\n", name,
+         (unsigned long long)histogram->n, histogram->n / seconds,
+         percentile(histogram, 0.5) / 1e3, percentile(histogram, 0.99) / 1e3,
+         percentile(histogram, 0.999) / 1e3, histogram->maxNs / 1e3,
+         (unsigned long long)nUnanswered);
+}
+
+int
+main(int argc, char *argv[])
+{
+  const char *host = "localhost";
+  const char *port = NULL;
+  size_t nConns = 16;
+  size_t nThreads = 4;
+  double rate = 1000;
+  double seconds = 10;
+  int opt;
+  while ((opt = getopt(argc, argv, "h:p:c:t:r:d:q:")) != -1) {
+    switch (opt) {
+    case 'h': host = optarg; break;
+    case 'p': port = optarg; break;
+    case 'c': nConns = atol(optarg); break;
+    case 't': nThreads = atol(optarg); break;
+    case 'r': rate = atof(optarg); break;
+    case 'd': seconds = atof(optarg); break;
+    case 'q': queryPct = atoi(optarg); break;
+    default: port = NULL; optind = argc; break;
+    }
+  }
+  if (port == NULL || nConns == 0 || nThreads == 0 || rate <= 0 ||
+      seconds <= 0 || queryPct > 100) {
+    fatal("usage: %s -p PORT [-h HOST] [-c CONNS] [-t THREADS] [-r RATE] "
+          "[-d SECONDS] [-q QUERY_PCT]", argv[0]);
+  }
+  if (nThreads > nConns) nThreads = nConns;
+  Conn *conns = calloc(nConns, sizeof(Conn));
+  Worker *workers = calloc(nThreads, sizeof(Worker));
+  if (conns == NULL || workers == NULL) fatal("%s", errnum_to_string(MEM_ERR));
+  for (size_t i = 0; i < nConns; i++) conns[i].fd = open_conn(host, port);
+
+  nsPerCmd = nConns * 1e9 / rate;
+  startNs = now_ns();
+  endNs = startNs + seconds * 1e9;
+  for (size_t i = 0; i < nConns; i++) {
+    conns[i].nextNs = startNs + i * nsPerCmd / nConns;
+  }
+  for (size_t t = 0; t < nThreads; t++) {
+    Worker *worker = &workers[t];
+    size_t lo = t * nConns / nThreads, hi = (t + 1) * nConns / nThreads;
+    worker->conns = &conns[lo];
+    worker->nConns = hi - lo;
+    worker->rngState = 88172645463325252ULL ^ ((t + 1) * 0x9E3779B97F4A7C15ULL);
+    if (pthread_create(&worker->thread, NULL, run_worker, worker) != 0) {
+      fatal("cannot start worker thread");
+    }
+  }
+
+  Histogram *totals = calloc(N_CMD_KINDS + 1, sizeof(Histogram));
+  if (totals == NULL) fatal("%s", errnum_to_string(MEM_ERR));
+  uint64_t nUnanswered[N_CMD_KINDS + 1] = { 0 };
+  double lastResponseNs = startNs;
+  for (size_t t = 0; t < nThreads; t++) {
+    Worker *worker = &workers[t];
+    pthread_join(worker->thread, NULL);
+    for (int k = 0; k < N_CMD_KINDS; k++) {
+      merge_histogram(&totals[k], &worker->latencies[k]);
+      merge_histogram(&totals[N_CMD_KINDS], &worker->latencies[k]);
+      nUnanswered[k] += worker->nUnanswered[k];
+      nUnanswered[N_CMD_KINDS] += worker->nUnanswered[k];
+    }
+    if (worker->lastResponseNs > lastResponseNs) {
+      lastResponseNs = worker->lastResponseNs;
+    }
+  }
+
+  printf("offered %.0f commands/s on %zu connections for %.1f s "
+         "(%u%% queries)\n", rate, nConns, seconds, queryPct);
+  printf("%-8s %10s %10s %10s %10s %10s %10s %10s\n", "command", "answered",
+         "per-sec", "p50-us", "p99-us", "p999-us", "max-us", "unanswered");
+  double elapsed = (lastResponseNs - startNs) / 1e9;
+  if (elapsed <= 0) elapsed = seconds;
+  for (int k = 0; k < N_CMD_KINDS; k++) {
+    print_result(cmdNames[k], &totals[k], nUnanswered[k], elapsed);
+  }
+  print_result("all", &totals[N_CMD_KINDS], nUnanswered[N_CMD_KINDS], elapsed);
+
+  for (size_t i = 0; i < nConns; i++) {
+    close(conns[i].fd);
+    free(conns[i].out);
+    free(conns[i].pending);
+  }
+  free(conns);
+  free(workers);
+  free(totals);
+  return 0;
+}
@@ -1,313 +1,1493 @@
-#include <ctype.h>
 #include <stdio.h>  
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "arena.h"
+#include "bodies.h"
+#include "chartab.h"
 #include "chat.h"
+#include "epoch.h"
 #include "errnum.h"
+#include "filter.h"
+#include "grep.h"
+#include "index.h"
+#include "planner.h"
+#include "postings.h"
+#include "record.h"
+#include "roaring.h"
+#include "shmstore.h"
+#include "storemem.h"
+#include "sweeper.h"
 // #define DO_TRACE
 #include <stdbool.h>
 #include <trace.h>
 
-ChatMsgNode *head = NULL;
+enum { INIT_OFFSETS_SIZE = 16 };
 
-// TODO: define chat ADT
+// The messages' state, kept in store memory once shared (see
+// share_chats()) so that processes attaching to the store find it.
+typedef struct {
+  // Message records (see record.h) in an arena, with their offsets
+  // indexed by sequence number, oldest first.  Once the oldest
+  // messages are all dead their offsets are dropped, so msgOffsets[i]
+  // is the offset of message seqBase + i.
+  Arena msgArena;
+  StoreRef msgOffsets;
+  size_t seqBase;               // always a multiple of 64
+  size_t nMsgs;                 // # of messages ever added
+  size_t msgOffsetsSize;
 
-// This function takes pointer of a chatMsg stucture and returns pointer of newly created ChatMsgNode
-// We are allocating memory using malloc of size specified
-//Based on the condition if node  is null we are sending message suitable.
+  // Tombstones: bit i of deadSeqs is set once message seqBase + i has
+  // been deleted or has expired.  Dead records stay in the arena (as
+  // deadBytes of it) until the next compaction.
+  StoreRef deadSeqs;
+  size_t nDeadWords;
+  size_t nDeadMsgs;
+  size_t deadBytes;
+  size_t nCompactions;
+  size_t reclaimedBytes;
 
-//Else Case proceeds normally
-// We will link it to newNode and sets it next to null as we normally  do in Linked List
+  // Start of the store's clock for message times
+  struct timespec storeEpoch;
+  bool hasStoreEpoch;
 
-ChatMsgNode *create_chat_msg_node(ChatMsg *chat_msg) {
+  // Roots of the indexes and bodies once shared
+  StoreRef indexes;
+  StoreRef bodies;
+} Chats;
 
-  ChatMsgNode *node = malloc(sizeof(ChatMsgNode));
-  if (node == NULL) {
-    perror("Failed to allocate memory for chat message node");
-    exit(EXIT_FAILURE);
-  }
-  node->chat_msg = chat_msg;
-  node->next = NULL;
-  return node;
+static Chats localChats;
+static Chats *chats = &localChats;
+
+// Whether bodies of new messages are deduplicated
+static bool isBodyDedup = false;
+
+// Plan chosen by and counters from the last call to
+// display_chat_messages() in this thread: as the store is unlocked
+// while a query runs, another thread's query may run in between.
+static _Thread_local QueryPlan lastPlan;
+static _Thread_local QueryStats lastStats;
+
+static inline size_t *msg_offsets(void) {
+  return store_at(chats->msgOffsets);
 }
 
+static inline uint64_t *dead_words(void) {
+  return store_at(chats->deadSeqs);
+}
 
-// Function to add a chat message to the linked list
-// Adding the msg into linked List making it as first Node of our list
-// Same we are allocating the memory using malloc
-//then checking if newNode is Null we are cleaning the memory
+// Return the record of live or dead message seq >= seqBase
+static inline const uint8_t *msg_record(size_t seq) {
+  return arena_at(&chats->msgArena, msg_offsets()[seq - chats->seqBase]);
+}
 
-//Else
-// Intializing the new node and then set it to head;
-void add_chat_msg(ChatMsg *msg) {
+// Return the # of messages from seqBase which the offsets and the
+// tombstones both have room for
+static size_t msg_capacity(void) {
+  size_t nBits = 64 * chats->nDeadWords;
+  return nBits < chats->msgOffsetsSize ? nBits : chats->msgOffsetsSize;
+}
 
-  ChatMsgNode *new_node = malloc(sizeof(ChatMsgNode));
-  if (new_node == NULL) {
-      free_chat_message(msg); // Clean up allocated ChatMsg
-      return;
-  }
+// Return true if message seq has been deleted or has expired
+static bool is_dead(size_t seq) {
+  if (seq < chats->seqBase) return true;
+  size_t i = seq - chats->seqBase;
+  return dead_words()[i / 64] >> (i % 64) & 1;
+}
 
-  new_node->chat_msg = msg;
-  new_node->next = head;
-  head = new_node;
+// Return the # of whole seconds since the store's clock was started
+static size_t store_time(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (!chats->hasStoreEpoch) {
+    chats->storeEpoch = now;
+    chats->hasStoreEpoch = true;
+  }
+  return now.tv_sec - chats->storeEpoch.tv_sec -
+    (now.tv_nsec < chats->storeEpoch.tv_nsec);
+}
 
+// Return the time before which messages in room have expired, 0 if
+// they never expire
+static size_t expiry_cutoff(const Room *room) {
+  if (room->ttl == 0) return 0;
+  size_t now = store_time();
+  return now <= room->ttl ? 0 : now - room->ttl;
 }
 
+// Resize msgOffsets and deadSeqs to hold newSize messages
+// Each keeps its own size, so if only one is resized msg_capacity()
+// is still right.
+static void resize_offsets(size_t newSize, ErrNum *err) {
+  StoreRef offsets =
+    store_realloc(chats->msgOffsets, chats->msgOffsetsSize * sizeof(size_t),
+                  newSize * sizeof(size_t), err);
+  if (*err != NO_ERR) return;
+  chats->msgOffsets = offsets;
+  chats->msgOffsetsSize = newSize;
+  size_t nWords = chats->nDeadWords;
+  size_t newNWords = (newSize + 63) / 64;
+  StoreRef dead = store_realloc(chats->deadSeqs, nWords * sizeof(uint64_t),
+                                newNWords * sizeof(uint64_t), err);
+  if (*err != NO_ERR) return;
+  chats->deadSeqs = dead;
+  chats->nDeadWords = newNWords;
+  if (newNWords > nWords) {
+    memset(dead_words() + nWords, 0, (newNWords - nWords) * sizeof(uint64_t));
+  }
+}
 
-// Function to safely copy a string with dynamic memory allocation
-//Creating a copied string of the string that came.
-// If string coming is null, then we will throw error.
-// allocation of +1 in string size is done because of Null terminator.
+// Function to add a chat message to the store
+// The user, room and topics are interned and the message is encoded
+// as a record in the arena under the next sequence number; it is
+// then added to the room and topic indexes.
 
-char *copy_string(const char *str, ErrNum *err) {
-  if (str == NULL) {
-    *err = MEM_ERR;
-    return NULL;
+void add_chat_msg(const Word *user, const Word *room, const char *message,
+                  size_t msg_len, const Word topics[], size_t num_topics,
+                  ErrNum *err) {
+  *err = NO_ERR;
+  if (chats->nMsgs - chats->seqBase == msg_capacity()) {
+    size_t n = msg_capacity();
+    resize_offsets(n == 0 ? INIT_OFFSETS_SIZE : 2 * n, err);
+    if (*err != NO_ERR) return;
+  }
+  User *u = intern_user(user, err);
+  if (*err != NO_ERR) return;
+  Room *r = intern_room(room, err);
+  if (*err != NO_ERR) return;
+  Topic *msg_topics[num_topics > 0 ? num_topics : 1];
+  size_t topic_ids[num_topics > 0 ? num_topics : 1];
+  for (size_t i = 0; i < num_topics; i++) {
+    msg_topics[i] = intern_topic(&topics[i], err);
+    if (*err != NO_ERR) return;
+    topic_ids[i] = msg_topics[i]->id;
+  }
+  size_t body_id = RECORD_INLINE_BODY;
+  if (isBodyDedup && msg_len >= BODY_SHARE_MIN_LEN) {
+    const Body *body = share_body(message, msg_len, err);
+    if (*err != NO_ERR) return;
+    body_id = body->id;
   }
-  size_t length = strlen(str) + 1;  // +1 for null terminator
-  char *copy = malloc(length);
+  size_t offset = encode_record(&chats->msgArena, u->id, r->id, store_time(),
+                                topic_ids, num_topics, body_id, message,
+                                msg_len, err);
+  if (*err != NO_ERR) {
+    if (body_id != RECORD_INLINE_BODY) release_body(body_id);
+    return;
+  }
+  size_t seq = chats->nMsgs++;
+  msg_offsets()[seq - chats->seqBase] = offset;
+  index_chat_msg(seq, r, msg_topics, num_topics, err);
+}
+
+
+// Function to copy a word
+// The word's length is already known so its text is copied as is.
+
+char *copy_word(const Word *word, ErrNum *err) {
+  char *copy = malloc(word->len + 1);
   if (copy == NULL) {
     *err = MEM_ERR;
     return NULL;
   }
-  strcpy(copy, str);
+  memcpy(copy, word->text, word->len + 1);
   *err = NO_ERR;
   return copy;
 }
 
-// Function to create a chat message
+// Decode the record for message seq, resolving a shared body
+static void load_record(size_t seq, ChatRecord *record) {
+  decode_record(msg_record(seq), record);
+  if (record->isSharedBody) {
+    const Body *body = body_by_id(record->bodyId);
+    record->body = body->text;
+    record->bodyLen = body->len;
+  }
+}
 
-// This the method reponsbile for creating chat messages.
-//Memory Allocation for the chat structure is done
-//Error handling is also done as per the condition
-ChatMsg *create_chat_message(const char *user, const char *room,
-                             const char *message, char **topics,
-                             size_t num_topics, ErrNum *err) {
-  ChatMsg *chat_msg = malloc(sizeof(ChatMsg));
-  if (chat_msg == NULL) {
-    *err = MEM_ERR;
-    return NULL;
+// Tombstone message seq whose record is *record
+// Its shared body (if any) is released right away; the record and
+// index entries are left for compact_chats().
+static void kill_chat_msg(size_t seq, const ChatRecord *record) {
+  size_t i = seq - chats->seqBase;
+  dead_words()[i / 64] |= (uint64_t)1 << (i % 64);
+  chats->nDeadMsgs++;
+  chats->deadBytes += record->len;
+  size_t topic_ids[record->nTopics > 0 ? record->nTopics : 1];
+  const uint8_t *ids = record->topicIds;
+  for (size_t t = 0; t < record->nTopics; t++) {
+    topic_ids[t] = record_next_topic(&ids);
+  }
+  unindex_chat_msg(record->roomId, topic_ids, record->nTopics);
+  if (record->isSharedBody) release_body(record->bodyId);
+}
+
+// Function to delete a message by sequence number
+// Deletion only sets the message's tombstone, so it is O(1) in the
+// size of the store.
+bool delete_chat_msg(size_t seq) {
+  if (seq >= chats->nMsgs || is_dead(seq)) return false;
+  ChatRecord record;
+  decode_record(msg_record(seq), &record);
+  kill_chat_msg(seq, &record);
+  return true;
+}
+
+// Function to set how long messages are kept in a room
+bool set_room_ttl(const Word *room, size_t seconds) {
+  Room *r = find_room(room);
+  if (r == NULL) return false;
+  r->ttl = seconds;
+  return true;
+}
+
+// Tombstone the expired messages of room
+// A room's messages are in time order, so this stops at the first one
+// which has not expired; room->nExpired remembers where it stopped.
+static void expire_room(Room *room) {
+  size_t cutoff = expiry_cutoff(room);
+  if (cutoff == 0) return;
+  PostingsIter iter;
+  postings_iter_init(&iter, &room->msgs);
+  size_t n = postings_size(&room->msgs);
+  for (; room->nExpired < n; room->nExpired++) {
+    size_t seq;
+    postings_iter_at(&iter, room->nExpired, &seq);
+    if (is_dead(seq)) continue;
+    ChatRecord record;
+    decode_record(msg_record(seq), &record);
+    if (record.time >= cutoff) break;
+    kill_chat_msg(seq, &record);
+  }
+}
+
+// Drop the offsets and tombstones of the oldest messages, 64 at a
+// time, as long as they are all dead
+static void drop_dead_prefix(void) {
+  size_t nFullWords = (chats->nMsgs - chats->seqBase) / 64;
+  uint64_t *dead = dead_words();
+  size_t w = 0;
+  while (w < nFullWords && dead[w] == UINT64_MAX) w++;
+  if (w == 0) return;
+  size_t nWords = chats->nDeadWords;
+  size_t nLeft = chats->nMsgs - chats->seqBase - 64 * w;
+  size_t *offsets = msg_offsets();
+  memmove(offsets, offsets + 64 * w, nLeft * sizeof(size_t));
+  memmove(dead, dead + w, (nWords - w) * sizeof(uint64_t));
+  memset(dead + nWords - w, 0, w * sizeof(uint64_t));
+  chats->seqBase += 64 * w;
+  if (chats->msgOffsetsSize > INIT_OFFSETS_SIZE &&
+      nLeft < chats->msgOffsetsSize / 4) {
+    ErrNum err;   // if shrinking fails the arrays just stay large
+    resize_offsets(nLeft < INIT_OFFSETS_SIZE/2 ? INIT_OFFSETS_SIZE : 2 * nLeft,
+                   &err);
   }
+}
 
-  // Copy user, room, and message strings
-  
-  chat_msg->user = copy_string(user, err);
+// Copy the live records into a new arena and retire the old one, then
+// rebuild the indexes of rooms with dead messages
+// The offsets are only updated once the old arena has been retired,
+// by walking the copied records.  If a room cannot be rebuilt it just
+// keeps its dead entries, which queries skip anyway.
+static void compact_chats(ErrNum *err) {
+  Arena live;
+  init_arena(&live);
+  arena_alloc(&live, chats->msgArena.len - chats->deadBytes, err);
+  if (*err != NO_ERR) return;
+  size_t offset = 0;
+  for (size_t seq = chats->seqBase; seq < chats->nMsgs; seq++) {
+    if (is_dead(seq)) continue;
+    const uint8_t *p = msg_record(seq);
+    ChatRecord record;
+    decode_record(p, &record);
+    memcpy(arena_at(&live, offset), p, record.len);
+    offset += record.len;
+  }
+  retire_arena(&chats->msgArena, err);
   if (*err != NO_ERR) {
-    free(chat_msg);  // Free the previously allocated memory
-    return NULL;
+    free_arena(&live);
+    return;
+  }
+  chats->msgArena = live;
+  offset = 0;
+  for (size_t seq = chats->seqBase; seq < chats->nMsgs; seq++) {
+    if (is_dead(seq)) continue;
+    msg_offsets()[seq - chats->seqBase] = offset;
+    ChatRecord record;
+    decode_record(arena_at(&chats->msgArena, offset), &record);
+    offset += record.len;
+  }
+  chats->reclaimedBytes += chats->deadBytes;
+  chats->deadBytes = 0;
+  chats->nCompactions++;
+  for (size_t id = 0; id < n_rooms(); id++) {
+    Room *room = room_by_id(id);
+    if (room->nDead == 0) continue;
+    ErrNum roomErr;
+    compact_room_index(room, is_dead, &roomErr);
+    if (roomErr != NO_ERR) *err = roomErr;
+  }
+  drop_dead_prefix();
+}
+
+// Function to reclaim the space of dead messages
+// Expired messages are tombstoned first; the store is then compacted
+// in bulk, but only once enough of the arena is dead to pay for it.
+void sweep_chats(ErrNum *err) {
+  enum {
+    SWEEP_MIN_DEAD_BYTES = 4096,        // never compact for less
+    SWEEP_DEAD_DIVISOR = 4,             // min fraction of arena dead
+  };
+  *err = NO_ERR;
+  for (size_t id = 0; id < n_rooms(); id++) expire_room(room_by_id(id));
+  if (chats->deadBytes >= SWEEP_MIN_DEAD_BYTES &&
+      chats->deadBytes * SWEEP_DEAD_DIVISOR >= chats->msgArena.len) {
+    compact_chats(err);
+  }
+  reclaim_retired();
+}
+
+// Function to write an image of the store
+// Messages which have expired but are not yet tombstoned are left out
+// like dead ones.  A body not ending in a newline (possible only for
+// the last line of input) gets one, as it must to be read back.
+void write_chat_image(FILE *out, ErrNum *err) {
+  *err = NO_ERR;
+  for (size_t seq = chats->seqBase; seq < chats->nMsgs; seq++) {
+    if (is_dead(seq)) continue;
+    ChatRecord record;
+    load_record(seq, &record);
+    const Room *room = room_by_id(record.roomId);
+    if (record.time < expiry_cutoff(room)) continue;
+    fprintf(out, "+ %s %s", user_by_id(record.userId)->name, room->name);
+    const uint8_t *topic_ids = record.topicIds;
+    for (size_t i = 0; i < record.nTopics; i++) {
+      fprintf(out, " %s", topic_by_id(record_next_topic(&topic_ids))->name);
+    }
+    fprintf(out, "\n");
+    fwrite(record.body, 1, record.bodyLen, out);
+    if (record.bodyLen == 0 || record.body[record.bodyLen - 1] != '\n') {
+      fprintf(out, "\n");
+    }
+    fprintf(out, ".\n");
+  }
+  for (size_t id = 0; id < n_rooms(); id++) {
+    const Room *room = room_by_id(id);
+    if (room->ttl != 0) fprintf(out, "ttl %s %zu\n", room->name, room->ttl);
+  }
+  if (ferror(out)) *err = IO_ERR;
+}
+
+void open_snapshot(ChatSnapshot *snapshot, ErrNum *err) {
+  snapshot->pin = pin_epoch(err);
+  snapshot->seq = chats->nMsgs;
+}
+
+void close_snapshot(ChatSnapshot *snapshot) {
+  unpin_epoch(snapshot->pin);
+}
+
+void set_body_dedup(bool enable) {
+  isBodyDedup = enable;
+}
+
+void get_chat_stats(ChatStats *stats) {
+  BodyStats bodyStats;
+  get_body_stats(&bodyStats);
+  *stats = (ChatStats) {
+    .messages = chats->nMsgs,
+    .arenaBytes = chats->msgArena.len,
+    .deleted = chats->nDeadMsgs,
+    .deadBytes = chats->deadBytes,
+    .compactions = chats->nCompactions,
+    .reclaimedBytes = chats->reclaimedBytes,
+    .snapshots = n_epoch_pins(),
+    .retired = n_retired(),
+    .users = n_users(),
+    .rooms = n_rooms(),
+    .topics = n_topics(),
+    .sharedBodies = bodyStats.nBodies,
+    .sharedRefs = bodyStats.nRefs,
+    .dedupSaved = bodyStats.bytesSaved,
+  };
+}
+
+const QueryPlan *last_query_plan(void) {
+  return &lastPlan;
+}
+
+const QueryStats *last_query_stats(void) {
+  return &lastStats;
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// State of a query cursor; clauses[] is the query's topic filter and
+// topicIds[] holds the ids of its topics (FILTER_NO_TOPIC for unknown
+// ones).  A PLAN_TOPIC_FILTER cursor has a union of posting lists
+// for each clause with messages in the room, those to intersect
+// (smallest first) followed by those to subtract.  A
+// multi-room cursor (PLAN_MERGE) has no iterators of its own, but
+// parts[] with one cursor per room, sharing its snapshot, and a
+// max-heap of the parts with a current match keyed by its seq.
+struct ChatCursor {
+  ChatSnapshot snapshot;
+  bool isPinned;                // snapshot is this cursor's own
+  Room *room;
+  PlanKind kind;
+  bool isFiltered;              // kind needs topics checked per message
+  bool isDone;
+  size_t limit;                 // # of matches to return at most
+  size_t nMatched;
+  size_t cutoff;                // see expiry_cutoff()
+  size_t compactions;           // nCompactions when iterators were set up
+  size_t nextSeq;               // candidates >= nextSeq were all offered
+  bool hasPending;              // pendingSeq is the next candidate
+  size_t pendingSeq;
+  PostingsIter roomIter;
+  PostingsIter *iters;          // PLAN_TOPIC_INTERSECT and _FILTER only
+  size_t nIters;
+  PostingsUnion *unions;        // PLAN_TOPIC_FILTER only
+  size_t nIncl;
+  size_t nExcl;
+  size_t *heads;                // PLAN_TOPIC_FILTER only
+  RoaringAndIter *andIter;      // PLAN_BITMAP_AND only
+  const Roaring **bitmaps;      // PLAN_BITMAP_AND only
+  size_t *next;                 // PLAN_BITMAP_AND only
+  size_t examined;
+  size_t records;               // # of records decoded
+  ChatCursor **parts;           // PLAN_MERGE only
+  size_t nParts;
+  size_t *heap;                 // indices into parts[]
+  size_t heapLen;
+  bool hasLast;                 // lastPart's match was returned last
+  size_t lastPart;
+  double t0;
+  ChatMatch match;
+  FilterClause *clauses;
+  size_t nClauses;
+  size_t nTopics;
+  size_t topicIds[];
+};
+
+// Add the entries examined by cursor's current iterators to its count
+static void count_examined(ChatCursor *cursor) {
+  if (cursor->kind == PLAN_ROOM_SCAN) {
+    cursor->examined += cursor->roomIter.nVisited;
+  }
+  else if (cursor->kind == PLAN_TOPIC_INTERSECT ||
+           cursor->kind == PLAN_TOPIC_FILTER) {
+    for (size_t i = 0; i < cursor->nIters; i++) {
+      cursor->examined += cursor->iters[i].nVisited;
+    }
+  }
+  else if (cursor->kind == PLAN_BITMAP_AND) {
+    cursor->examined += cursor->andIter->nWords;
+  }
+}
+
+static void free_cursor_iters(ChatCursor *cursor) {
+  free(cursor->iters);
+  free(cursor->andIter);
+  free(cursor->bitmaps);
+  free(cursor->next);
+  free(cursor->unions);
+  free(cursor->heads);
+  cursor->iters = NULL;
+  cursor->andIter = NULL;
+  cursor->bitmaps = NULL;
+  cursor->next = NULL;
+  cursor->unions = NULL;
+  cursor->heads = NULL;
+  cursor->nIters = 0;
+}
+
+// Add a union over the lists of roomTopics[] for clause to cursor's
+// unions, returning false (adding nothing) if it has none
+static bool add_clause_union(ChatCursor *cursor, const RoomTopic *roomTopics[],
+                             const FilterClause *clause) {
+  size_t first = cursor->nIters;
+  for (size_t i = clause->first; i < clause->first + clause->n; i++) {
+    if (roomTopics[i] == NULL) continue;
+    postings_iter_init(&cursor->iters[cursor->nIters++],
+                       &roomTopics[i]->postings);
+  }
+  if (cursor->nIters == first) return false;
+  postings_union_init(&cursor->unions[cursor->nIncl + cursor->nExcl],
+                      &cursor->iters[first], cursor->nIters - first,
+                      &cursor->heads[first]);
+  return true;
+}
+
+// Return the total size of the lists of u
+static size_t union_size(const PostingsUnion *u) {
+  size_t size = 0;
+  for (size_t i = 0; i < u->nIters; i++) {
+    size += postings_size(u->iters[i].postings);
+  }
+  return size;
+}
+
+// Set up the iterators of cursor for plan kind over the room's topic
+// indexes roomTopics[]
+static void init_cursor_iters(ChatCursor *cursor,
+                              const RoomTopic *roomTopics[], ErrNum *err) {
+  size_t n = cursor->nTopics;
+  if (cursor->kind == PLAN_ROOM_SCAN) {
+    postings_iter_init(&cursor->roomIter, &cursor->room->msgs);
+  }
+  else if (cursor->kind == PLAN_TOPIC_INTERSECT) {
+    cursor->iters = malloc(n * sizeof(PostingsIter));
+    if (cursor->iters == NULL) {
+      *err = MEM_ERR;
+      return;
+    }
+    // rarest topic first so that it drives the intersection
+    cursor->nIters = n;
+    PostingsIter *iters = cursor->iters;
+    for (size_t i = 0; i < n; i++) {
+      size_t j = i;
+      size_t card = postings_size(&roomTopics[i]->postings);
+      for (; j > 0 && postings_size(iters[j - 1].postings) > card; j--) {
+        iters[j] = iters[j - 1];
+      }
+      postings_iter_init(&iters[j], &roomTopics[i]->postings);
+    }
   }
- 
+  else if (cursor->kind == PLAN_BITMAP_AND) {
+    // AND the bitmaps from the newest local index down; each local
+    // index is mapped back to a sequence number via the room postings
+    cursor->andIter = malloc(sizeof(RoaringAndIter));
+    cursor->bitmaps = malloc(n * sizeof(Roaring *));
+    cursor->next = malloc(n * sizeof(size_t));
+    if (cursor->andIter == NULL || cursor->bitmaps == NULL ||
+        cursor->next == NULL) {
+      *err = MEM_ERR;
+      return;
+    }
+    for (size_t i = 0; i < n; i++) {
+      cursor->bitmaps[i] = room_topic_bitmap(roomTopics[i]);
+    }
+    roaring_and_iter_init(cursor->andIter, cursor->bitmaps, n, cursor->next);
+    postings_iter_init(&cursor->roomIter, &cursor->room->msgs);
+  }
+  else if (cursor->kind == PLAN_TOPIC_FILTER) {
+    // the room's own list stands in for the clauses to intersect when
+    // all are negated; negated clauses with no messages are dropped
+    cursor->iters = malloc((n + 1) * sizeof(PostingsIter));
+    cursor->heads = malloc((n + 1) * sizeof(size_t));
+    cursor->unions = malloc((cursor->nClauses + 1) * sizeof(PostingsUnion));
+    if (cursor->iters == NULL || cursor->heads == NULL ||
+        cursor->unions == NULL) {
+      *err = MEM_ERR;
+      return;
+    }
+    PostingsUnion *unions = cursor->unions;
+    for (size_t c = 0; c < cursor->nClauses; c++) {
+      if (cursor->clauses[c].isNegated ||
+          !add_clause_union(cursor, roomTopics, &cursor->clauses[c])) {
+        continue;
+      }
+      size_t j = cursor->nIncl++;
+      PostingsUnion u = unions[j];
+      size_t size = union_size(&u);
+      for (; j > 0 && union_size(&unions[j - 1]) > size; j--) {
+        unions[j] = unions[j - 1];
+      }
+      unions[j] = u;
+    }
+    if (cursor->nIncl == 0) {
+      postings_iter_init(&cursor->iters[cursor->nIters], &cursor->room->msgs);
+      postings_union_init(&unions[0], &cursor->iters[cursor->nIters], 1,
+                          &cursor->heads[cursor->nIters]);
+      cursor->nIters++;
+      cursor->nIncl = 1;
+    }
+    for (size_t c = 0; c < cursor->nClauses; c++) {
+      if (cursor->clauses[c].isNegated &&
+          add_clause_union(cursor, roomTopics, &cursor->clauses[c])) {
+        cursor->nExcl++;
+      }
+    }
+  }
+}
+
+// Free cursor and its parts, closing its snapshot if it is its own
+static void free_cursor(ChatCursor *cursor) {
+  for (size_t i = 0; i < cursor->nParts; i++) free_cursor(cursor->parts[i]);
+  free(cursor->parts);
+  free(cursor->heap);
+  free(cursor->clauses);
+  free_cursor_iters(cursor);
+  if (cursor->isPinned) close_snapshot(&cursor->snapshot);
+  free(cursor);
+}
 
- // Room copy
-  chat_msg->room = copy_string(room, err);
+// Open a cursor over room r (NULL if unknown) reading *snapshot, which
+// the caller keeps open, returning at most limit matches
+// The planner picks between walking the room newest-first and
+// combining the room's topic posting lists; either way candidates
+// come out in LIFO order.  The plan is for the count matches wanted,
+// which limit exceeds when matches are filtered further (see GREP).
+static ChatCursor *open_room_cursor(size_t count, size_t limit, Room *r,
+                                    const Word topics[], size_t num_topics,
+                                    const ChatSnapshot *snapshot,
+                                    ErrNum *err) {
+  *err = NO_ERR;
+  size_t nTopics = count_filter_topics(topics, num_topics);
+  ChatCursor *cursor = malloc(sizeof(ChatCursor) + nTopics * sizeof(size_t));
+  if (cursor == NULL) {
+    *err = MEM_ERR;
+    return NULL;
+  }
+  *cursor = (ChatCursor) {
+    .snapshot = *snapshot, .limit = limit, .nTopics = nTopics,
+    .nClauses = num_topics,
+  };
+  cursor->clauses = malloc(num_topics * sizeof(FilterClause));
+  if (num_topics > 0 && cursor->clauses == NULL) {
+    free_cursor(cursor);
+    *err = MEM_ERR;
+    return NULL;
+  }
+  cursor->room = r;
+  cursor->cutoff = r == NULL ? 0 : expiry_cutoff(r);
+  cursor->compactions = chats->nCompactions;
+  cursor->nextSeq = cursor->snapshot.seq;
+  Word filterTopics[nTopics > 0 ? nTopics : 1];
+  parse_topic_filter(topics, num_topics, cursor->clauses, filterTopics);
+  const RoomTopic *roomTopics[nTopics > 0 ? nTopics : 1];
+  for (size_t i = 0; i < nTopics; i++) {
+    Topic *t = find_topic(&filterTopics[i]);
+    roomTopics[i] = t == NULL || r == NULL ? NULL : find_room_topic(r, t);
+    cursor->topicIds[i] = t == NULL ? FILTER_NO_TOPIC : t->id;
+  }
+  plan_query(&lastPlan, r, roomTopics, cursor->clauses, num_topics, count);
+  TRACE("query %s: plan %s (scan %g, intersect %g, bitmap %g)\n",
+        r == NULL ? "?" : r->name, plan_kind_to_string(lastPlan.kind),
+        lastPlan.scanCost, lastPlan.intersectCost, lastPlan.bitmapCost);
+  cursor->kind = lastPlan.kind;
+  cursor->isFiltered = cursor->kind == PLAN_ROOM_SCAN;
+  cursor->isDone = cursor->kind == PLAN_EMPTY;
+  init_cursor_iters(cursor, roomTopics, err);
   if (*err != NO_ERR) {
-    free(chat_msg->user);  // Free previously allocated memory
-    free(chat_msg);
+    free_cursor(cursor);
     return NULL;
   }
+  return cursor;
+}
 
-//Message copy
-  chat_msg->message = copy_string(message, err);
-  if (*err != NO_ERR) {
-    free(chat_msg->room);  // Free previously allocated memory
-    free(chat_msg->user);
-    free(chat_msg);
+// Open a query cursor on a room planned for count matches and
+// returning at most limit of them (see open_room_cursor())
+static ChatCursor *open_limited_cursor(size_t count, size_t limit,
+                                       const Word *room, const Word topics[],
+                                       size_t num_topics, ErrNum *err) {
+  double t0 = now_ns();
+  lastStats = (QueryStats) { 0 };
+  ChatSnapshot snapshot;
+  open_snapshot(&snapshot, err);
+  if (*err != NO_ERR) return NULL;
+  ChatCursor *cursor = open_room_cursor(count, limit, find_room(room),
+                                        topics, num_topics, &snapshot, err);
+  if (cursor == NULL) {
+    close_snapshot(&snapshot);
     return NULL;
   }
+  cursor->isPinned = true;
+  cursor->t0 = t0;
+  return cursor;
+}
+
+// Function to open a query cursor on a room
+ChatCursor *open_chat_cursor(size_t count, const Word *room,
+                             const Word topics[], size_t num_topics,
+                             ErrNum *err) {
+  return open_limited_cursor(count, count, room, topics, num_topics, err);
+}
 
-  // Allocate memory for topics array
-  // Allocating the memory for array of pointers
+static inline size_t heap_seq(const ChatCursor *cursor, size_t i) {
+  return cursor->parts[cursor->heap[i]]->match.seq;
+}
 
-  chat_msg->topics = malloc(num_topics * sizeof(char *));
-  if (!chat_msg->topics) {
+// Add part to cursor's heap
+static void heap_push(ChatCursor *cursor, size_t part) {
+  size_t i = cursor->heapLen++;
+  cursor->heap[i] = part;
+  for (; i > 0 && heap_seq(cursor, (i - 1) / 2) < heap_seq(cursor, i);
+       i = (i - 1) / 2) {
+    size_t parent = cursor->heap[(i - 1) / 2];
+    cursor->heap[(i - 1) / 2] = cursor->heap[i];
+    cursor->heap[i] = parent;
+  }
+}
+
+// Remove and return the part with the newest match from cursor's heap
+static size_t heap_pop(ChatCursor *cursor) {
+  size_t *heap = cursor->heap;
+  size_t top = heap[0];
+  heap[0] = heap[--cursor->heapLen];
+  for (size_t i = 0; ; ) {
+    size_t newest = i;
+    for (size_t c = 2 * i + 1; c <= 2 * i + 2 && c < cursor->heapLen; c++) {
+      if (heap_seq(cursor, c) > heap_seq(cursor, newest)) newest = c;
+    }
+    if (newest == i) break;
+    size_t part = heap[i];
+    heap[i] = heap[newest];
+    heap[newest] = part;
+    i = newest;
+  }
+  return top;
+}
+
+// Open a query cursor on several rooms planned for count matches and
+// returning at most limit of them
+// Each distinct known room gets a cursor of its own, planned as for a
+// single room; only their current matches are held in the heap, so at
+// most limit + nRooms candidates are matched in all.  The plan left
+// in lastPlan sums the rooms' cardinalities and costs.
+static ChatCursor *open_limited_feed(size_t count, size_t limit,
+                                     const Word rooms[], size_t nRooms,
+                                     const Word topics[], size_t num_topics,
+                                     ErrNum *err) {
+  double t0 = now_ns();
+  lastStats = (QueryStats) { 0 };
+  ChatCursor *cursor = malloc(sizeof(ChatCursor));
+  if (cursor == NULL) {
     *err = MEM_ERR;
-    free(chat_msg->message);  
-    free(chat_msg->room);
-    free(chat_msg->user);
-    free(chat_msg);
     return NULL;
   }
-
-  // Copy each topic string
-  chat_msg->num_topics = num_topics;
-  for (size_t i = 0; i < num_topics; i++) {
-    chat_msg->topics[i] = copy_string(topics[i], err);
-    if (*err != NO_ERR) {
-      // Free previously allocated topic strings
-      for (size_t j = 0; j < i; j++) {
-        free(chat_msg->topics[j]);
-      }
-      free(chat_msg->topics);
-      free(chat_msg->message);
-      free(chat_msg->room);
-      free(chat_msg->user);
-      free(chat_msg);
+  *cursor = (ChatCursor) { .t0 = t0, .limit = limit, .kind = PLAN_MERGE };
+  cursor->parts = malloc(nRooms * sizeof(ChatCursor *));
+  cursor->heap = malloc(nRooms * sizeof(size_t));
+  if (cursor->parts == NULL || cursor->heap == NULL) {
+    free_cursor(cursor);
+    *err = MEM_ERR;
+    return NULL;
+  }
+  open_snapshot(&cursor->snapshot, err);
+  if (*err != NO_ERR) {
+    free_cursor(cursor);
+    return NULL;
+  }
+  cursor->isPinned = true;
+  QueryPlan plan = {
+    .kind = PLAN_MERGE, .count = count, .nTopics = num_topics,
+  };
+  for (size_t i = 0; i < nRooms; i++) {
+    Room *r = find_room(&rooms[i]);
+    bool isDuplicate = false;
+    for (size_t j = 0; j < cursor->nParts; j++) {
+      isDuplicate = isDuplicate || cursor->parts[j]->room == r;
+    }
+    if (r == NULL || isDuplicate) continue;
+    ChatCursor *part = open_room_cursor(count, limit, r, topics, num_topics,
+                                        &cursor->snapshot, err);
+    if (part == NULL) {
+      free_cursor(cursor);
       return NULL;
     }
+    cursor->parts[cursor->nParts++] = part;
+    plan.roomCard += lastPlan.roomCard;
+    plan.minTopicCard += lastPlan.minTopicCard;
+    plan.sumTopicCard += lastPlan.sumTopicCard;
+    plan.scanCost += lastPlan.scanCost;
+    plan.intersectCost += lastPlan.intersectCost;
+    plan.bitmapCost += lastPlan.bitmapCost;
+    if (next_chat_match(part) != NULL) heap_push(cursor, cursor->nParts - 1);
+  }
+  lastPlan = plan;
+  return cursor;
+}
+
+// Function to open a query cursor on several rooms
+ChatCursor *open_chat_feed(size_t count, const Word rooms[], size_t nRooms,
+                           const Word topics[], size_t num_topics,
+                           ErrNum *err) {
+  return open_limited_feed(count, count, rooms, nRooms, topics, num_topics,
+                           err);
+}
+
+// Return the next match of a multi-room cursor: the newest current
+// match of its parts
+// A part's match is overwritten when the part is advanced, so the
+// part whose match was returned last is only advanced (and put back
+// on the heap) by the following call.
+static const ChatMatch *next_merged_match(ChatCursor *cursor) {
+  if (cursor->nMatched == cursor->limit) return NULL;
+  if (cursor->hasLast) {
+    cursor->hasLast = false;
+    if (next_chat_match(cursor->parts[cursor->lastPart]) != NULL) {
+      heap_push(cursor, cursor->lastPart);
+    }
   }
+  if (cursor->heapLen == 0) return NULL;
+  cursor->lastPart = heap_pop(cursor);
+  cursor->hasLast = true;
+  cursor->nMatched++;
+  return &cursor->parts[cursor->lastPart]->match;
+}
 
-  *err = NO_ERR;
-  return chat_msg;
+// Resume cursor as a room scan from below the last candidate offered,
+// since a compaction has rebuilt the indexes its iterators walked
+// (the old ones are still readable, being retired while the cursor's
+// snapshot is open, but their positions no longer correspond)
+static void reseek_cursor(ChatCursor *cursor) {
+  count_examined(cursor);
+  free_cursor_iters(cursor);
+  cursor->kind = PLAN_ROOM_SCAN;
+  cursor->isFiltered = true;
+  cursor->compactions = chats->nCompactions;
+  postings_iter_init(&cursor->roomIter, &cursor->room->msgs);
+  cursor->hasPending = cursor->nextSeq > 0 &&
+    postings_iter_seek(&cursor->roomIter, cursor->nextSeq - 1,
+                       &cursor->pendingSeq);
+  cursor->isDone = !cursor->hasPending;
+}
+
+// Set *seq to cursor's next candidate and return true; return false
+// when there are no more
+static bool next_candidate(ChatCursor *cursor, size_t *seq) {
+  switch (cursor->kind) {
+  case PLAN_ROOM_SCAN:
+    if (cursor->hasPending) {
+      cursor->hasPending = false;
+      *seq = cursor->pendingSeq;
+      return true;
+    }
+    return postings_iter_prev(&cursor->roomIter, seq);
+  case PLAN_TOPIC_INTERSECT:
+    return postings_intersect_prev(cursor->iters, cursor->nTopics, seq);
+  case PLAN_TOPIC_FILTER:
+    return postings_filter_prev(cursor->unions, cursor->nIncl,
+                                cursor->unions + cursor->nIncl, cursor->nExcl,
+                                seq);
+  case PLAN_BITMAP_AND: {
+    size_t local;
+    if (!roaring_and_iter_prev(cursor->andIter, &local)) return false;
+    postings_iter_at(&cursor->roomIter, local, seq);
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+// Function to return a cursor's next match
+// Candidates outside the cursor's snapshot and deleted messages are
+// skipped without decoding their records, and the cursor stops at the
+// first expired one: since candidates come newest-first, so have all
+// the remaining ones.  Only a room scan with topics decodes records
+// which do not match, so an unfiltered query for COUNT messages
+// decodes COUNT records (plus the expired one it stops at, if any).
+const ChatMatch *next_chat_match(ChatCursor *cursor) {
+  if (cursor->parts != NULL) return next_merged_match(cursor);
+  if (!cursor->isDone && cursor->compactions != chats->nCompactions) {
+    reseek_cursor(cursor);
+  }
+  size_t seq;
+  while (!cursor->isDone && cursor->nMatched < cursor->limit &&
+         next_candidate(cursor, &seq)) {
+    cursor->nextSeq = seq;
+    if (seq >= cursor->snapshot.seq || is_dead(seq)) continue;
+    ChatRecord record;
+    load_record(seq, &record);
+    cursor->records++;
+    if (record.time < cursor->cutoff) break;
+    if (cursor->isFiltered &&
+        !record_matches_filter(&record, cursor->clauses, cursor->nClauses,
+                               cursor->topicIds)) {
+      continue;
+    }
+    cursor->nMatched++;
+    cursor->match = (ChatMatch) {
+      .seq = seq,
+      .user = user_by_id(record.userId)->name,
+      .room = cursor->room->name,
+      .nTopics = record.nTopics,
+      .topics = record.topicIds,
+      .body = record.body,
+      .bodyLen = record.bodyLen,
+    };
+    return &cursor->match;
+  }
+  cursor->isDone = true;
+  return NULL;
+}
+
+const char *next_match_topic(const uint8_t **topics) {
+  return topic_by_id(record_next_topic(topics))->name;
 }
 
-// Function to free a chat message
+// Add the entries examined and records decoded by cursor and its parts
+// to *examined and *records
+static void tally_cursor(ChatCursor *cursor, size_t *examined,
+                         size_t *records) {
+  count_examined(cursor);
+  *examined += cursor->examined;
+  *records += cursor->records;
+  for (size_t i = 0; i < cursor->nParts; i++) {
+    tally_cursor(cursor->parts[i], examined, records);
+  }
+}
+
+void close_chat_cursor(ChatCursor *cursor) {
+  lastStats.examined = lastStats.records = 0;
+  tally_cursor(cursor, &lastStats.examined, &lastStats.records);
+  lastStats.emitted = cursor->nMatched;
+  lastStats.elapsedNs = now_ns() - cursor->t0;
+  free_cursor(cursor);
+}
 
-// Kind of Helper function to clear the chat msgs
-//Free memory of user, room and strings
+// Printing a single message as specified for QUERY output, returning
+// the # of bytes written
+static size_t print_chat_match(const ChatMatch *match, FILE *err) {
+  int n = fprintf(err, "%s %s ", match->user, match->room);
 
-void free_chat_message(ChatMsg *chat_msg) {
-  if (chat_msg==NULL)
-  {
-     return;
-  } 
+  const uint8_t *topics = match->topics;
+  for (size_t i = 0; i < match->nTopics; i++) {
+    n += fprintf(err, "%s", next_match_topic(&topics));
 
-  
-  free(chat_msg->user);
-  free(chat_msg->room);
-  free(chat_msg->message);
+    if(i + 1 < match->nTopics) {
+        n += fprintf(err, " ");
+    }
+  }
+  n += fprintf(err, "\n");
+  n += fwrite(match->body, 1, match->bodyLen, err);
+  return n;
+}
 
-  // Free each topic
-  for (size_t i = 0; i < chat_msg->num_topics; i++) {
-    free(chat_msg->topics[i]);
+// Split room, a list of rooms separated by commas, into *nRooms words
+// pointing into its text, returning NULL with *err set to MEM_ERR on
+// failure.  An empty element or one not starting with a letter is
+// returned as a word of kind WORD_OTHER.
+static Word *split_rooms(const Word *room, size_t *nRooms, ErrNum *err) {
+  size_t n = 1;
+  for (size_t i = 0; i < room->len; i++) n += room->text[i] == ',';
+  Word *rooms = malloc(n * sizeof(Word));
+  if (rooms == NULL) {
+    *err = MEM_ERR;
+    return NULL;
+  }
+  char *start = room->text;
+  char *end = room->text + room->len;
+  for (size_t i = 0; i < n; i++) {
+    char *comma = memchr(start, ',', end - start);
+    size_t len = (comma == NULL ? end : comma) - start;
+    rooms[i] = (Word) {
+      .text = start, .len = len, .hash = word_hash(start, len),
+      .kind = len > 0 && char_is_alpha(start[0]) ? WORD_ROOM : WORD_OTHER,
+    };
+    start += len + 1;
   }
+  *nRooms = n;
+  return rooms;
+}
 
-  // Free topics array
-  free(chat_msg->topics);
+// # of matches taken from a cursor each time the store is locked
+enum { QUERY_BATCH = 64 };
 
-  // Free the ChatMsg structure itself
-  free(chat_msg);
+// Lock and unlock the store around a batch of a query's matches.  A
+// reader of a shared memory store keeps it locked for the whole query
+// instead: its cursor's pin (see epoch.h) only holds back reclamation
+// in its own process, so the writer could free and reuse what the
+// cursor points to between batches.
+static void lock_batch(void) {
+  if (!is_shm_reader()) lock_store();
 }
 
-// Function to diplay chat message based on room and topics
-void display_chat_messages(size_t count, char *room, char **topics, size_t num_topics, FILE *err) {
-  // Traverse the list and push messages onto the stack
-  ChatMsgNode *current = head;
-  size_t current_count = 0;
-  bool found = false;
-  while (current != NULL && current_count < count) {
-    ChatMsg *chat_msg = current->chat_msg;
-    if (strcmp(room, current->chat_msg->room) == 0 && message_matches_topics(chat_msg, topics, num_topics)) {
-      // Print message details
-      fprintf(err, "%s %s ", chat_msg->user, chat_msg->room);
-
-      for (size_t i = 0; i < chat_msg->num_topics; i++) {
-        //printf("%s", chat_msg->topics[i]);
-        fprintf(err, "%s", chat_msg->topics[i]);
-
-        if(i + 1 < chat_msg->num_topics) {
-            fprintf(err, " ");
+static void unlock_batch(void) {
+  if (!is_shm_reader()) unlock_store();
+}
+
+// Print the matches of cursor, adding the bytes printed to *bytes and
+// returning their #.  The store is locked for QUERY_BATCH matches at a
+// time (see lock_batch()), so that it can be changed between batches;
+// the topic names of a match are looked up as it is printed, so that
+// is done locked too.
+static size_t print_matches(ChatCursor *cursor, size_t *bytes, FILE *err) {
+  bool isDone = false;
+  while (!isDone) {
+    lock_batch();
+    for (size_t n = 0; n < QUERY_BATCH; n++) {
+      const ChatMatch *match = next_chat_match(cursor);
+      if (match == NULL) {
+        isDone = true;
+        break;
+      }
+      *bytes += print_chat_match(match, err);
+    }
+    unlock_batch();
+  }
+  return cursor->nMatched;
+}
+
+// Bounds on the # of matches whose bodies are searched at once by
+// grep_matches()
+enum { GREP_MIN_BATCH = 64, GREP_MAX_BATCH = 64 * 1024 };
+
+// Batches of matches from a cursor, with their bodies laid out for
+// grep_bodies()
+typedef struct {
+  ChatMatch *matches;
+  const char **bodies;
+  size_t *lens;
+  bool *isMatch;
+  size_t size;
+} GrepBatch;
+
+static void free_grep_batch(GrepBatch *batch) {
+  free(batch->matches);
+  free(batch->bodies);
+  free(batch->lens);
+  free(batch->isMatch);
+}
+
+static void grow_grep_batch(GrepBatch *batch, size_t size, ErrNum *err) {
+  ChatMatch *matches = realloc(batch->matches, size * sizeof(ChatMatch));
+  if (matches != NULL) batch->matches = matches;
+  const char **bodies = realloc(batch->bodies, size * sizeof(char *));
+  if (bodies != NULL) batch->bodies = bodies;
+  size_t *lens = realloc(batch->lens, size * sizeof(size_t));
+  if (lens != NULL) batch->lens = lens;
+  bool *isMatch = realloc(batch->isMatch, size * sizeof(bool));
+  if (isMatch != NULL) batch->isMatch = isMatch;
+  if (matches == NULL || bodies == NULL || lens == NULL || isMatch == NULL) {
+    *err = MEM_ERR;
+    return;
+  }
+  batch->size = size;
+}
+
+// Print the first count matches of cursor whose bodies match pattern,
+// adding the bytes printed to *bytes and returning their #.  Matches
+// are taken from the cursor in batches growing from GREP_MIN_BATCH,
+// so a query satisfied by the newest few candidates only searches
+// those, while the bodies of a large room are searched in batches big
+// enough to be split between threads (see grep.h).  A batch is taken
+// QUERY_BATCH matches at a time like print_matches(), and its bodies
+// are searched between batches, as the cursor's snapshot keeps them
+// from being freed.
+static size_t grep_matches(ChatCursor *cursor, size_t count,
+                           BodyPattern *pattern, size_t *bytes, FILE *err,
+                           ErrNum *errp) {
+  GrepBatch batch = { 0 };
+  size_t nFound = 0;
+  for (size_t size = GREP_MIN_BATCH; nFound < count;
+       size = size < GREP_MAX_BATCH ? 4 * size : size) {
+    if (size > batch.size) {
+      grow_grep_batch(&batch, size, errp);
+      if (*errp != NO_ERR) break;
+    }
+    size_t n = 0;
+    bool isDone = false;
+    while (n < size && !isDone) {
+      size_t end = n + QUERY_BATCH < size ? n + QUERY_BATCH : size;
+      lock_batch();
+      for (; n < end; n++) {
+        const ChatMatch *match = next_chat_match(cursor);
+        if (match == NULL) {
+          isDone = true;
+          break;
         }
+        batch.matches[n] = *match;
+        batch.bodies[n] = match->body;
+        batch.lens[n] = match->bodyLen;
       }
-      fprintf(err, "\n");
-      fprintf(err, "%s", chat_msg->message);
+      unlock_batch();
+    }
+    grep_bodies(pattern, batch.bodies, batch.lens, n, batch.isMatch, errp);
+    if (*errp != NO_ERR) break;
+    lock_batch();
+    for (size_t i = 0; i < n && nFound < count; i++) {
+      if (!batch.isMatch[i]) continue;
+      *bytes += print_chat_match(&batch.matches[i], err);
+      nFound++;
+    }
+    unlock_batch();
+    if (n < size) break;
+  }
+  free_grep_batch(&batch);
+  return nFound;
+}
 
-      found = true;
-      current_count++;
+// Run a QUERY (pattern NULL) or a GREP: see display_chat_messages()
+// and grep_chat_messages().  The store is locked to open and close the
+// cursor and by print_matches() and grep_matches() (see lock_batch()).
+static void run_chat_query(size_t count, const Word *room,
+                           const Word topics[], size_t num_topics,
+                           BodyPattern *pattern, FILE *err) {
+  ErrNum cursorErr = NO_ERR;
+  const Word *rooms = room;
+  Word *split = NULL;
+  size_t nRooms = 1;
+  lock_store();
+  if (memchr(room->text, ',', room->len) != NULL && find_room(room) == NULL) {
+    rooms = split = split_rooms(room, &nRooms, &cursorErr);
+  }
+  for (size_t i = 0; rooms != NULL && i < nRooms; i++) {
+    if (rooms[i].kind != WORD_ROOM) {
+      unlock_store();
+      fprintf(err, "BAD_ROOM\n");
+      free(split);
+      return;
     }
-    current = current->next;
   }
+  size_t limit = pattern == NULL ? count : SIZE_MAX;
+  ChatCursor *cursor = rooms == NULL ? NULL
+    : nRooms == 1
+    ? open_limited_cursor(count, limit, room, topics, num_topics, &cursorErr)
+    : open_limited_feed(count, limit, rooms, nRooms, topics, num_topics,
+                        &cursorErr);
+  if (cursor == NULL) {
+    unlock_store();
+    fprintf(err, "Error querying chat messages: %s\n",
+            errnum_to_string(cursorErr));
+    free(split);
+    return;
+  }
+  unlock_batch();
+  size_t bytes = 0;
+  size_t nFound;
+  if (pattern == NULL) {
+    nFound = print_matches(cursor, &bytes, err);
+  }
+  else {
+    nFound = grep_matches(cursor, count, pattern, &bytes, err, &cursorErr);
+  }
+  bool found = nFound > 0;
+  lock_batch();
+  close_chat_cursor(cursor);
+  lastStats.emitted = nFound;
+  lastStats.bytes = bytes;
+  if (cursorErr != NO_ERR) {
+    fprintf(err, "Error querying chat messages: %s\n",
+            errnum_to_string(cursorErr));
+  }
+  bool isKnownRooms = true;
+  for (size_t i = 0; i < nRooms; i++) {
+    isKnownRooms = isKnownRooms && is_valid_room(&rooms[i]);
+  }
+  bool isKnownTopics =
+    found || num_topics == 0 || is_valid_topics(topics, num_topics);
+  unlock_store();
+  free(split);
   if(found == false){
-      if(!is_valid_room(room)){
+      if(!isKnownRooms){
         fprintf(err, "BAD_ROOM\n");
         }
   }
-  if(found == false && num_topics > 0){
-     if(!is_valid_topics(topics, num_topics)){
+  if(found == false && !isKnownTopics){
         fprintf(err, "BAD_TOPIC\n");
-    }
   }
 
 }
 
-//Checking if a room exists in linkedList
+// Function to diplay chat message based on room and topics
+// A room containing commas (unless it is itself the name of a room)
+// lists several rooms whose matches are merged newest-first; then if
+// nothing is output, BAD_ROOM means one of them is unknown.
+// The matches come from a query cursor, so the query sees neither
+// messages added while it runs nor freed memory, and the store is
+// only locked (see sweeper.h) a batch of matches at a time.
+// Execution counters are left in lastStats.
+void display_chat_messages(size_t count, const Word *room, const Word topics[], size_t num_topics, FILE *err) {
+  run_chat_query(count, room, topics, num_topics, NULL, err);
+}
 
-bool is_valid_room(char *room) {
-ChatMsgNode *current = head;
-  while (current != NULL) {
-    if (strcmp(room, current->chat_msg->room) == 0) {
-      return true;
-    }
-    current = current->next;
-  }
-  return false;
-}
-// Same checking if topics are valid
-
-bool is_valid_topics(char **topics, size_t num_topics){
-    if (num_topics == 0) 
-    {
-        return true;
-
-     }
-          // No topics to match, always true
-
-      // Iterate through each topic in the chat message
-
-      for (size_t i = 0; i < num_topics; i++) {
-        bool found = false;
-        ChatMsgNode *current = head;
-          while (current != NULL) {
-          ChatMsg *chat_msg = current->chat_msg;
-            for (size_t j = 0; j < chat_msg->num_topics; j++) {
-              if (strcmp(chat_msg->topics[j], topics[i]) == 0) {
-                found = true;
-                break;
-              }
-            }
-            if(found == true){
-                break;
-            }
-            current = current->next;
-        }
+// The query is planned for count matches, but the cursor's candidates
+// are unbounded, as any number of them may fail to match pattern;
+// lastStats.emitted counts only those printed.
+void grep_chat_messages(size_t count, const Word *room, const Word topics[],
+                        size_t num_topics, BodyPattern *pattern, FILE *err) {
+  run_chat_query(count, room, topics, num_topics, pattern, err);
+}
 
-        if (!found) return false;  // If any topic is not found, return false
-      }
+//Checking if a room exists in the room index
+
+bool is_valid_room(const Word *room) {
+  return find_room(room) != NULL;
+}
+
+// Same checking if topics exist in the topic index
+// Every topic named by a clause counts, whether negated or in a group.
+
+bool is_valid_topics(const Word topics[], size_t num_topics){
+  size_t nTopics = count_filter_topics(topics, num_topics);
+  FilterClause clauses[num_topics > 0 ? num_topics : 1];
+  Word filterTopics[nTopics > 0 ? nTopics : 1];
+  parse_topic_filter(topics, num_topics, clauses, filterTopics);
+  for (size_t i = 0; i < nTopics; i++) {
+    if (find_topic(&filterTopics[i]) == NULL) return false;
+  }
   return true;
-  
 }
 
 
 
+// Function to move the store's state into store memory
+// The clock is started here so that attached processes, which only
+// read the store, never have to start it.
+StoreRef share_chats(ErrNum *err) {
+  StoreRef ref = store_alloc(sizeof(Chats), err);
+  if (*err != NO_ERR) return 0;
+  store_time();
+  chats = store_at(ref);
+  *chats = localChats;
+  chats->indexes = share_indexes(err);
+  if (*err == NO_ERR) chats->bodies = share_bodies(err);
+  return ref;
+}
+
+// Function to use the state shared at ref by share_chats()
+void attach_chats(StoreRef ref) {
+  chats = store_at(ref);
+  attach_indexes(chats->indexes);
+  attach_bodies(chats->bodies);
+}
+
 void free_chats() {
-  ChatMsgNode *current = head;
-  while (current != NULL) {
-    ChatMsgNode *next = current->next;
-    free(current->chat_msg->user);
-    free(current->chat_msg->room);
-    free(current->chat_msg->message);
-    for (size_t i = 0; i < current->chat_msg->num_topics; i++) {
-      free(current->chat_msg->topics[i]);
-    }
-    free(current->chat_msg->topics);
-    free(current->chat_msg);
-    free(current);
-    current = next;
+  free_arena(&chats->msgArena);
+  store_free(chats->msgOffsets, chats->msgOffsetsSize * sizeof(size_t));
+  store_free(chats->deadSeqs, chats->nDeadWords * sizeof(uint64_t));
+  *chats = (Chats) { 0 };
+  free_indexes();
+  free_bodies();
+  free_retired();
+}
+
+
+#ifdef TEST_CHAT
+
+#include <assert.h>
+
+// Return text (lower-case) as a word of the kind the lexer gives it
+static Word test_word(char *text) {
+  size_t len = strlen(text);
+  WordKind kind = text[0] == '@' ? WORD_USER
+    : text[0] == '#' ? WORD_TOPIC
+    : ('a' <= text[0] && text[0] <= 'z') ? WORD_ROOM : WORD_OTHER;
+  return (Word) {
+    .text = text, .len = len, .hash = word_hash(text, len), .kind = kind,
+  };
+}
+
+enum { TEST_MAX_MATCHES = 4000 };
+
+// A match copied out of its cursor
+typedef struct {
+  size_t seq;
+  const char *user;
+  const char *room;
+  char topics[64];
+  char body[64];
+} TestMatch;
+
+static void copy_match(const ChatMatch *match, TestMatch *copy) {
+  *copy = (TestMatch) { .seq = match->seq, .user = match->user,
+                        .room = match->room };
+  const uint8_t *topics = match->topics;
+  for (size_t i = 0; i < match->nTopics; i++) {
+    strcat(copy->topics, next_match_topic(&topics));
+  }
+  assert(match->bodyLen < sizeof(copy->body));
+  memcpy(copy->body, match->body, match->bodyLen);
+}
+
+// Run cursor to the end, appending its matches to matches[*n]
+static void drain_cursor(ChatCursor *cursor, TestMatch matches[], size_t *n) {
+  const ChatMatch *match;
+  while ((match = next_chat_match(cursor)) != NULL) {
+    assert(*n < TEST_MAX_MATCHES);
+    copy_match(match, &matches[(*n)++]);
   }
 }
 
-bool message_matches_topics(ChatMsg *chat_msg, char **topics,
-                            size_t num_topics) {
-  if (num_topics == 0) 
-  {
-    return true; 
+// Check that got[nGot] are the matches of want[nWant]
+static void assert_same_matches(const TestMatch got[], size_t nGot,
+                                const TestMatch want[], size_t nWant) {
+  assert(nGot == nWant);
+  for (size_t i = 0; i < nGot; i++) {
+    assert(got[i].seq == want[i].seq);
+    assert(strcmp(got[i].user, want[i].user) == 0);
+    assert(strcmp(got[i].room, want[i].room) == 0);
+    assert(strcmp(got[i].topics, want[i].topics) == 0);
+    assert(strcmp(got[i].body, want[i].body) == 0);
   }
-     // No topics to match, always true
+}
 
-  // Iterate through each topic in the chat message
-  for (size_t i = 0; i < num_topics; i++) {
-    bool found = false;
-    for (size_t j = 0; j < chat_msg->num_topics; j++) {
-      if (strcmp(chat_msg->topics[j], topics[i]) == 0) {
-        found = true;
-        break;
+// Open a cursor over the newest count messages matching topicText in
+// rooms: a single room or, when rooms has a comma, a feed over the
+// rooms listed
+static ChatCursor *test_cursor(size_t count, const char *rooms,
+                               const char *topicText) {
+  static char buf[2][128];
+  strcpy(buf[0], rooms);
+  strcpy(buf[1], topicText);
+  Word roomWords[4], topics[4];
+  size_t nRooms = 0, nTopics = 0;
+  for (char *s = strtok(buf[0], ","); s != NULL; s = strtok(NULL, ",")) {
+    roomWords[nRooms++] = test_word(s);
+  }
+  for (char *s = strtok(buf[1], " "); s != NULL; s = strtok(NULL, " ")) {
+    topics[nTopics++] = test_word(s);
+  }
+  ErrNum err;
+  ChatCursor *cursor = strchr(rooms, ',') == NULL
+    ? open_chat_cursor(count, &roomWords[0], topics, nTopics, &err)
+    : open_chat_feed(count, roomWords, nRooms, topics, nTopics, &err);
+  assert(cursor != NULL && err == NO_ERR);
+  return cursor;
+}
+
+// Topics given to test messages, each with the percentage of
+// messages having it
+static const struct {
+  const char *name;
+  int percent;
+} topicMix[] = {
+  { "#dense", 60 }, { "#half", 50 }, { "#mid", 10 }, { "#rare", 2 },
+  { "#odd", 3 },
+};
+enum { N_MIX = sizeof(topicMix) / sizeof(topicMix[0]) };
+
+// Add test message i to a random room with random topics
+static void add_test_msg(size_t i) {
+  char user[16], room[16], body[64];
+  char topicText[N_MIX][16];
+  sprintf(user, "@u%d", rand() % 20);
+  sprintf(room, "r%d", rand() % 3);
+  if (rand() % 2 == 0) sprintf(body, "shared body %d", rand() % 10);
+  else sprintf(body, "body %zu of the test with padding %d", i, rand());
+  Word topics[N_MIX];
+  size_t nTopics = 0;
+  for (size_t t = 0; t < N_MIX; t++) {
+    if (rand() % 100 >= topicMix[t].percent) continue;
+    strcpy(topicText[nTopics], topicMix[t].name);
+    topics[nTopics] = test_word(topicText[nTopics]);
+    nTopics++;
+  }
+  Word userWord = test_word(user), roomWord = test_word(room);
+  ErrNum err;
+  add_chat_msg(&userWord, &roomWord, body, strlen(body), topics, nTopics,
+               &err);
+  assert(err == NO_ERR);
+}
+
+// Check that a cursor which sees messages added, or the store
+// compacted (and rooms' messages deleted or expired), part way
+// through produces what a query run to the end before the change
+// does, or one started afterwards, for each kind of plan: add
+// messages with topics of several densities, kill some by DELETE and
+// some by TTL, then for each query open a cursor, take a few matches,
+// add enough messages to fill the tails of the rooms' posting lists,
+// and finish the cursor; then do the same but sweeping and compacting
+// instead of adding.
+int
+main(int argc, const char *argv[])
+{
+  srand(argc > 1 ? atoi(argv[1]) : 1);
+  enum { N_MSGS = 6000, N_ADDS = 400 };
+  static const struct {
+    size_t count;
+    const char *rooms, *topics;
+  } queries[] = {
+    { 20, "r0", "" },
+    { 300, "r1", "#dense" },
+    { 50, "r1", "#rare #mid" },
+    { 400, "r2", "#dense #half" },
+    { 40, "r0", "(#rare|#odd) !#half" },
+    { 200, "r2", "!#dense" },
+    { 100, "r0,r1,r2", "#mid" },
+    { 30, "r2,r0", "(#odd|#mid) !#dense" },
+    { 1000, "r1", "" },
+  };
+  enum { N_QUERIES = sizeof(queries) / sizeof(queries[0]) };
+
+  set_body_dedup(true);
+  ErrNum err;
+  size_t nAdded = 0;
+  for (; nAdded < N_MSGS; nAdded++) {
+    if (nAdded == N_MSGS / 2) chats->storeEpoch.tv_sec -= 100;  //100s go by
+    add_test_msg(nAdded);
+  }
+  char r0[] = "r0";
+  Word r0Word = test_word(r0);
+  assert(set_room_ttl(&r0Word, 50));       //expires r0's older half
+
+  static TestMatch got[TEST_MAX_MATCHES], want[TEST_MAX_MATCHES];
+  size_t nReseeks = 0, nMatches = 0;
+  bool isPlanned[PLAN_MERGE + 1] = { false };
+  for (int round = 0; round < 3; round++) {
+    for (size_t q = 0; q < N_QUERIES; q++) {
+      for (size_t i = 0; i < N_MSGS / 20; i++) {
+        delete_chat_msg(rand() % N_MSGS);
       }
+
+      // the cursor ends as it would have without the messages added
+      size_t nWant = 0;
+      ChatCursor *cursor =
+        test_cursor(queries[q].count, queries[q].rooms, queries[q].topics);
+      drain_cursor(cursor, want, &nWant);
+      close_chat_cursor(cursor);
+      cursor =
+        test_cursor(queries[q].count, queries[q].rooms, queries[q].topics);
+      size_t nGot = 0;
+      for (int i = rand() % 5; i > 0; i--) {
+        const ChatMatch *match = next_chat_match(cursor);
+        if (match == NULL) break;
+        copy_match(match, &got[nGot++]);
+      }
+      for (size_t i = 0; i < N_ADDS; i++) add_test_msg(nAdded++);
+      drain_cursor(cursor, got, &nGot);
+      close_chat_cursor(cursor);
+      assert_same_matches(got, nGot, want, nWant);
+      nMatches += nGot;
+
+      // the cursor ends as one started after compacting does
+      cursor =
+        test_cursor(queries[q].count, queries[q].rooms, queries[q].topics);
+      isPlanned[last_query_plan()->kind] = true;
+      nGot = 0;
+      for (int i = rand() % 5; i > 0; i--) {
+        const ChatMatch *match = next_chat_match(cursor);
+        if (match == NULL) break;
+        copy_match(match, &got[nGot++]);
+      }
+      size_t compactions = chats->nCompactions;
+      sweep_chats(&err);
+      assert(err == NO_ERR);
+      if (chats->nCompactions == compactions) compact_chats(&err);
+      assert(err == NO_ERR && chats->nCompactions > compactions);
+      drain_cursor(cursor, got, &nGot);
+      nReseeks += cursor->parts == NULL && cursor->kind == PLAN_ROOM_SCAN &&
+        last_query_plan()->kind != PLAN_ROOM_SCAN;
+      close_chat_cursor(cursor);
+
+      nWant = 0;
+      cursor =
+        test_cursor(queries[q].count, queries[q].rooms, queries[q].topics);
+      drain_cursor(cursor, want, &nWant);
+      close_chat_cursor(cursor);
+      assert_same_matches(got, nGot, want, nWant);
+      nMatches += nGot;
     }
-    if (!found) 
-    {
-        return false; 
-     }
-         // If any topic is not found, return false
   }
-  return true;  // All topics are matched
+  for (PlanKind k = PLAN_ROOM_SCAN; k <= PLAN_MERGE; k++) {
+    if (!isPlanned[k]) printf("no %s plan\n", plan_kind_to_string(k));
+  }
+  ChatStats stats;
+  get_chat_stats(&stats);
+  assert(stats.snapshots == 0);
+  free_chats();
+  printf("chat ok (%zu matches, %zu reseeks, %zu compactions)\n", nMatches,
+         nReseeks, stats.compactions);
 }
+
+#endif //#ifdef TEST_CHAT
@@ -2,55 +2,179 @@
 #define CHAT_H_
 
 #include "errnum.h"
+#include "grep.h"
 #include "msgargs.h"
+#include "planner.h"
+#include "storemem.h"
+#include "word.h"
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 //TODO: define API for chat ADT
 
 //ash start
 
-// Structure for holding a chat message
-typedef struct ChatMsg {
-    char *user;      // pointer to user string
-    char *room;      // pointer to room string
-    char **topics;   // pointer to an array of topic strings
-    char *message;   // pointer to the message string
-    size_t num_topics; // number of topics
-} ChatMsg;
-
-// Node of a linked list to hold chat messages
-typedef struct ChatMsgNode {
-    ChatMsg *chat_msg;      // Pointer to the ChatMsg
-    struct ChatMsgNode *next; // Pointer to the next node
-} ChatMsgNode;
+// Counters from executing a query
+typedef struct QueryStats {
+    size_t examined;   // # of posting entries (or bitmap words) examined
+    size_t records;    // # of message records decoded
+    size_t emitted;    // # of messages output
+    size_t bytes;      // # of bytes of messages output
+    double elapsedNs;  // wall-clock time for the query
+} QueryStats;
+
+// Totals describing the store
+typedef struct ChatStats {
+    size_t messages;      // # of messages added
+    size_t arenaBytes;    // bytes of message records
+    size_t deleted;       // # of messages deleted or expired
+    size_t deadBytes;     // bytes of their records not yet reclaimed
+    size_t compactions;   // # of times dead records were reclaimed
+    size_t reclaimedBytes; // total bytes of records reclaimed
+    size_t users;         // # of distinct users, rooms and topics
+    size_t rooms;
+    size_t topics;
+    size_t sharedBodies;  // # of distinct deduplicated bodies
+    size_t sharedRefs;    // # of messages using them
+    size_t dedupSaved;    // body bytes not stored thanks to dedup
+    size_t snapshots;     // # of open snapshots
+    size_t retired;       // # of retired objects awaiting reclamation
+} ChatStats;
+
+// A reader's consistent view of the store: it sees only the messages
+// added before it was opened, and store memory it is reading is not
+// freed until it is closed (see epoch.h)
+typedef struct ChatSnapshot {
+    size_t seq;        // messages numbered below seq are visible
+    size_t pin;        // epoch pin held while open
+} ChatSnapshot;
+
+// A message matched by a query cursor.  The match itself is
+// overwritten by the next call on the cursor, but its pointers are
+// borrowed from the store and stay valid until the cursor is closed,
+// since the cursor holds a snapshot (see ChatSnapshot).
+typedef struct ChatMatch {
+    size_t seq;            // sequence number of the message
+    const char *user;
+    const char *room;
+    size_t nTopics;        // including any duplicates, as added
+    const uint8_t *topics; // read with next_match_topic()
+    const char *body;      // not NUL-terminated
+    size_t bodyLen;
+} ChatMatch;
+
+// A streaming query over the store: matches are produced one at a
+// time, as they are found, without being copied or buffered
+typedef struct ChatCursor ChatCursor;
 
 // Function prototypes
 
-// Function to create a chat message
-ChatMsg* create_chat_message(const char *user, const char *room, const char *message, char **topics, size_t num_topics, ErrNum *err);
-
-// Function to free a chat message
-void free_chat_message(ChatMsg *chat_msg);
-
-// Function to copy a string safely
-char* copy_string(const char *source, ErrNum *err);
-
-// Function to display chat message for debugging purposes
-void display_chat_messages(size_t count, char *room, char **topics, size_t num_topics, FILE *err);
-
-void add_chat_msg(ChatMsg *msg);
-
-ChatMsgNode* create_chat_msg_node(ChatMsg *chat_msg);
+// Function to copy a word's text without rescanning it
+char* copy_word(const Word *word, ErrNum *err);
+
+// Function to open a cursor over the newest count messages in room
+// matching all of topics[num_topics], newest first, where each of
+// topics[] is a clause as checked by is_filter_clause() (see
+// filter.h); it sees only the messages added before it was opened.
+// Returns NULL and sets *err to MEM_ERR on failure.  The plan chosen
+// is left in last_query_plan().
+ChatCursor *open_chat_cursor(size_t count, const Word *room,
+                             const Word topics[], size_t num_topics,
+                             ErrNum *err);
+
+// Function to open a cursor like open_chat_cursor() but over the
+// messages in any of rooms[nRooms], merged newest first.  Unknown and
+// repeated rooms are ignored.
+ChatCursor *open_chat_feed(size_t count, const Word rooms[], size_t nRooms,
+                           const Word topics[], size_t num_topics,
+                           ErrNum *err);
+
+// Function to return the next match of cursor, NULL when there are
+// no more.  The store may be changed between calls.
+const ChatMatch *next_chat_match(ChatCursor *cursor);
+
+// Function to return the name of the topic at *topics (initially a
+// match's topics) and advance *topics to the next one
+const char *next_match_topic(const uint8_t **topics);
+
+// Function to close cursor; its counters are left in
+// last_query_stats() (all but bytes, which only a printer knows)
+void close_chat_cursor(ChatCursor *cursor);
+
+// Function to display chat message for debugging purposes; it locks
+// the store itself (see sweeper.h), so must be called without the lock
+void display_chat_messages(size_t count, const Word *room, const Word topics[], size_t num_topics, FILE *err);
+
+// Function to display, like display_chat_messages(), the newest count
+// messages in room matching topics whose bodies match pattern (see
+// grep.h)
+void grep_chat_messages(size_t count, const Word *room, const Word topics[],
+                        size_t num_topics, BodyPattern *pattern, FILE *err);
+
+// Function to add a chat message to the store and its indexes;
+// message[msg_len] is its body
+void add_chat_msg(const Word *user, const Word *room, const char *message, size_t msg_len, const Word topics[], size_t num_topics, ErrNum *err);
+
+// Function to delete message seq (messages are numbered from 0 in the
+// order added); returns false if there is no such live message
+bool delete_chat_msg(size_t seq);
+
+// Function to expire messages in room once they are older than
+// seconds (0 to keep them for ever); returns false if room is unknown
+bool set_room_ttl(const Word *room, size_t seconds);
+
+// Function to reclaim the records and index entries of deleted and
+// expired messages in bulk; leaves the store usable on failure
+void sweep_chats(ErrNum *err);
+
+// Function to write an image of the store to out: the ADD commands
+// for its live messages, oldest first, then TTL commands for its rooms
+// with a TTL, so that reading the image as input rebuilds the store
+// (though deleted messages no longer take up sequence numbers).  Sets
+// *err to IO_ERR if out cannot be written.
+void write_chat_image(FILE *out, ErrNum *err);
+
+// Function to open a snapshot of the store; never waits for writers,
+// nor makes them wait.  Sets *err to MEM_ERR if too many are open.
+void open_snapshot(ChatSnapshot *snapshot, ErrNum *err);
+
+// Function to close a snapshot, letting memory retired while it was
+// open be reclaimed
+void close_snapshot(ChatSnapshot *snapshot);
+
+// Function to return the plan chosen for the last query (in this
+// thread)
+const QueryPlan *last_query_plan(void);
+
+// Function to return the counters from executing the last query (in
+// this thread)
+const QueryStats *last_query_stats(void);
+
+// Function to turn deduplication of message bodies on or off for
+// subsequently added messages
+void set_body_dedup(bool enable);
+
+// Function to return totals describing the store
+void get_chat_stats(ChatStats *stats);
+
+// Function to move the store's state, which must still be empty, into
+// store memory (see storemem.h) and return a reference to it, so that
+// other processes mapping the same memory can attach to it.  Sets
+// *err to MEM_ERR if it cannot be allocated.
+StoreRef share_chats(ErrNum *err);
+
+// Function to make this process use the store whose state another
+// process shared at ref; the store may then only be read.
+void attach_chats(StoreRef ref);
 
 void free_chats(void);
 
-bool message_matches_topics(ChatMsg *chat_msg, char **topics, size_t num_topics);
-
-bool is_valid_room(char *room);
+bool is_valid_room(const Word *room);
 
-bool is_valid_topics(char **topics, size_t num_topics);
+bool is_valid_topics(const Word topics[], size_t num_topics);
 
 
 //ash end
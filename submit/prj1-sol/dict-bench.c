@@ -0,0 +1,168 @@
+// Microbenchmark of the Swiss-table Dict against a separately chained
+// hash table (the dictionary the store used previously).
+//
+// usage: dict-bench [N_KEYS [N_LOOKUPS]]
+//
+// Inserts N_KEYS distinct names into each table and then performs
+// N_LOOKUPS lookups, half of which miss.  Lookup keys are separate
+// copies of the names so that neither table can short-circuit on
+// pointer equality.
+
+#include "dict.h"
+#include "errnum.h"
+
+#include <errors.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct ChainEntry {
+  const char *key;
+  void *value;
+  uint64_t hash;
+  struct ChainEntry *next;
+} ChainEntry;
+
+typedef struct {
+  ChainEntry **buckets;
+  size_t nBuckets;
+  size_t nEntries;
+} ChainDict;
+
+static uint64_t hash_string(const char *key) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (const unsigned char *p = (const unsigned char *)key; *p != '\0'; p++) {
+    h ^= *p;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static void chain_init(ChainDict *dict) {
+  dict->nBuckets = 16;
+  dict->nEntries = 0;
+  dict->buckets = calloc(dict->nBuckets, sizeof(ChainEntry *));
+  if (dict->buckets == NULL) fatal("%s", errnum_to_string(MEM_ERR));
+}
+
+static void *chain_get(const ChainDict *dict, const char *key) {
+  uint64_t h = hash_string(key);
+  for (ChainEntry *e = dict->buckets[h & (dict->nBuckets - 1)]; e != NULL;
+       e = e->next) {
+    if (e->hash == h && strcmp(e->key, key) == 0) return e->value;
+  }
+  return NULL;
+}
+
+static void chain_put(ChainDict *dict, const char *key, void *value) {
+  if (dict->nEntries >= dict->nBuckets) {
+    size_t nBuckets = 2 * dict->nBuckets;
+    ChainEntry **buckets = calloc(nBuckets, sizeof(ChainEntry *));
+    if (buckets == NULL) fatal("%s", errnum_to_string(MEM_ERR));
+    for (size_t i = 0; i < dict->nBuckets; i++) {
+      ChainEntry *e = dict->buckets[i];
+      while (e != NULL) {
+        ChainEntry *next = e->next;
+        ChainEntry **b = &buckets[e->hash & (nBuckets - 1)];
+        e->next = *b; *b = e;
+        e = next;
+      }
+    }
+    free(dict->buckets);
+    dict->buckets = buckets; dict->nBuckets = nBuckets;
+  }
+  ChainEntry *e = malloc(sizeof(ChainEntry));
+  if (e == NULL) fatal("%s", errnum_to_string(MEM_ERR));
+  e->key = key; e->value = value; e->hash = hash_string(key);
+  ChainEntry **b = &dict->buckets[e->hash & (dict->nBuckets - 1)];
+  e->next = *b; *b = e;
+  dict->nEntries++;
+}
+
+static void chain_free(ChainDict *dict) {
+  for (size_t i = 0; i < dict->nBuckets; i++) {
+    ChainEntry *e = dict->buckets[i];
+    while (e != NULL) {
+      ChainEntry *next = e->next;
+      free(e);
+      e = next;
+    }
+  }
+  free(dict->buckets);
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+main(int argc, const char *argv[])
+{
+  size_t nKeys = argc > 1 ? atol(argv[1]) : 100000;
+  size_t nLookups = argc > 2 ? atol(argv[2]) : 4000000;
+  char **names = malloc(nKeys * sizeof(char *));
+  char **probes = malloc(2 * nKeys * sizeof(char *));
+  if (names == NULL || probes == NULL) fatal("%s", errnum_to_string(MEM_ERR));
+  for (size_t i = 0; i < nKeys; i++) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "#topic%zx", i * 2654435761u);
+    names[i] = strdup(buf);
+    probes[2*i] = strdup(buf);             //hit
+    buf[1] = 'T';
+    probes[2*i + 1] = strdup(buf);         //miss
+    if (names[i] == NULL || probes[2*i] == NULL || probes[2*i + 1] == NULL) {
+      fatal("%s", errnum_to_string(MEM_ERR));
+    }
+  }
+  //visit probes in a pseudo-random order
+  size_t *order = malloc(nLookups * sizeof(size_t));
+  if (order == NULL) fatal("%s", errnum_to_string(MEM_ERR));
+  uint64_t x = 88172645463325252ULL;
+  for (size_t i = 0; i < nLookups; i++) {
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    order[i] = x % (2 * nKeys);
+  }
+
+  ErrNum err;
+  double t0 = now_ns();
+  Dict *dict = new_dict(&err);
+  for (size_t i = 0; i < nKeys && err == NO_ERR; i++) {
+    dict_put(dict, names[i], names[i], &err);
+  }
+  if (err != NO_ERR) fatal("%s", errnum_to_string(err));
+  double t1 = now_ns();
+  size_t nHits = 0;
+  for (size_t i = 0; i < nLookups; i++) {
+    nHits += dict_get(dict, probes[order[i]]) != NULL;
+  }
+  double t2 = now_ns();
+
+  ChainDict chain;
+  chain_init(&chain);
+  for (size_t i = 0; i < nKeys; i++) chain_put(&chain, names[i], names[i]);
+  double t3 = now_ns();
+  size_t nChainHits = 0;
+  for (size_t i = 0; i < nLookups; i++) {
+    nChainHits += chain_get(&chain, probes[order[i]]) != NULL;
+  }
+  double t4 = now_ns();
+  assert(nHits == nChainHits);
+
+  printf("%zu keys, %zu lookups (%zu hits)\n", nKeys, nLookups, nHits);
+  printf("%-8s %12s %12s\n", "table", "insert ns", "lookup ns");
+  printf("%-8s %12.1f %12.1f\n", "swiss", (t1 - t0)/nKeys, (t2 - t1)/nLookups);
+  printf("%-8s %12.1f %12.1f\n", "chained", (t3 - t2)/nKeys, (t4 - t3)/nLookups);
+
+  free_dict(dict, NULL);
+  chain_free(&chain);
+  for (size_t i = 0; i < nKeys; i++) {
+    free(names[i]); free(probes[2*i]); free(probes[2*i + 1]);
+  }
+  free(names); free(probes); free(order);
+}
@@ -0,0 +1,269 @@
+#include "dict.h"
+
+#include "errnum.h"
+#include "storemem.h"
+#include "word.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Open-addressing hash table in the style of a Swiss table.
+//
+// Each slot has a control byte: CTRL_EMPTY, CTRL_DELETED (a tombstone
+// left by a removal) or the low 7 bits of the key's hash (its "H2").
+// The rest of the hash (its "H1") selects the group of GROUP_SIZE
+// slots where probing starts; a probe compares all GROUP_SIZE control
+// bytes of a group against H2 at once (with SSE2) and only compares
+// keys for slots whose byte matches.  A group containing an empty
+// slot ends the probe; tombstones do not, but they are reused by
+// inserts and dropped when the table is rehashed.  Groups are visited
+// in triangular order, which visits every group when the # of slots
+// is a power of 2.
+//
+// Keys are references to strings owned by the caller (typically the
+// interned name held by the value), so a slot is just a key reference,
+// its length, its full hash and the value's reference.  Lookups with
+// the identical key pointer skip the string comparison.  Keys are
+// hashed with word_hash() so callers which already have a Word never
+// rehash.
+
+enum {
+  GROUP_SIZE = 16,
+  CTRL_EMPTY = 0x80,
+  CTRL_DELETED = 0xfe,  // like CTRL_EMPTY, has its high bit set
+  INIT_N_SLOTS = 16,    // must be a power of 2 >= GROUP_SIZE
+};
+
+typedef struct {
+  StoreRef key;
+  size_t len;
+  uint64_t hash;
+  StoreRef value;
+} DictSlot;
+
+struct Dict {
+  StoreRef ctrl;        // nSlots control bytes + copy of first GROUP_SIZE
+  StoreRef slots;       // DictSlot[nSlots]
+  size_t nSlots;        // always a power of 2
+  size_t nEntries;
+  size_t nDeleted;      // # of CTRL_DELETED slots
+};
+
+static inline uint8_t hash_h2(uint64_t hash) {
+  return hash & 0x7f;
+}
+
+static inline size_t hash_h1(uint64_t hash) {
+  return hash >> 7;
+}
+
+// Return a bitmask of the slots in the group starting at ctrl[pos]
+// whose control byte is c.
+static inline unsigned match_group(const uint8_t *ctrl, size_t pos, uint8_t c) {
+#ifdef __SSE2__
+  __m128i group = _mm_loadu_si128((const __m128i *)(ctrl + pos));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(c)));
+#else
+  unsigned mask = 0;
+  for (unsigned i = 0; i < GROUP_SIZE; i++) {
+    if (ctrl[pos + i] == c) mask |= 1u << i;
+  }
+  return mask;
+#endif
+}
+
+// Return a bitmask of the slots in the group starting at ctrl[pos]
+// which are empty or deleted, i.e. whose control byte has its high
+// bit set.
+static inline unsigned match_free(const uint8_t *ctrl, size_t pos) {
+#ifdef __SSE2__
+  return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(ctrl + pos)));
+#else
+  unsigned mask = 0;
+  for (unsigned i = 0; i < GROUP_SIZE; i++) {
+    if (ctrl[pos + i] & 0x80) mask |= 1u << i;
+  }
+  return mask;
+#endif
+}
+
+static inline bool is_full(uint8_t c) {
+  return (c & 0x80) == 0;
+}
+
+// Set the control byte for slot i, keeping the copy of the first
+// group after the end of ctrl[] (so groups can be loaded without
+// wrapping) up to date.
+static inline void set_ctrl(Dict *dict, size_t i, uint8_t c) {
+  uint8_t *ctrl = store_at(dict->ctrl);
+  ctrl[i] = c;
+  if (i < GROUP_SIZE) ctrl[dict->nSlots + i] = c;
+}
+
+// Allocate empty ctrl[] and slots[] for nSlots slots in dict.
+static void alloc_slots(Dict *dict, size_t nSlots, ErrNum *err) {
+  StoreRef ctrl = store_alloc(nSlots + GROUP_SIZE, err);
+  if (*err != NO_ERR) return;
+  StoreRef slots = store_alloc(nSlots * sizeof(DictSlot), err);
+  if (*err != NO_ERR) {
+    store_free(ctrl, nSlots + GROUP_SIZE);
+    return;
+  }
+  memset(store_at(ctrl), CTRL_EMPTY, nSlots + GROUP_SIZE);
+  dict->ctrl = ctrl;
+  dict->slots = slots;
+  dict->nSlots = nSlots;
+  dict->nDeleted = 0;
+}
+
+static void free_slots(Dict *dict) {
+  store_free(dict->ctrl, dict->nSlots + GROUP_SIZE);
+  store_free(dict->slots, dict->nSlots * sizeof(DictSlot));
+}
+
+Dict *new_dict(ErrNum *err) {
+  *err = NO_ERR;
+  Dict *dict = store_ptr(store_alloc(sizeof(Dict), err));
+  if (*err != NO_ERR) return NULL;
+  alloc_slots(dict, INIT_N_SLOTS, err);
+  if (*err != NO_ERR) {
+    store_free(store_ref(dict), sizeof(Dict));
+    return NULL;
+  }
+  dict->nEntries = 0;
+  return dict;
+}
+
+void *dict_get(const Dict *dict, const char *key) {
+  size_t len = strlen(key);
+  return dict_get_hashed(dict, key, len, word_hash(key, len));
+}
+
+// Return the index of the slot for key, or nSlots if none.
+static size_t find_slot(const Dict *dict, const char *key, size_t len,
+                        uint64_t h) {
+  uint8_t h2 = hash_h2(h);
+  const uint8_t *ctrl = store_at(dict->ctrl);
+  const DictSlot *slots = store_at(dict->slots);
+  size_t mask = dict->nSlots - 1;
+  size_t pos = hash_h1(h) & mask;
+  for (size_t step = GROUP_SIZE; ;
+       pos = (pos + step) & mask, step += GROUP_SIZE) {
+    for (unsigned m = match_group(ctrl, pos, h2); m != 0; m &= m - 1) {
+      size_t i = (pos + __builtin_ctz(m)) & mask;
+      const DictSlot *slot = &slots[i];
+      if (slot->hash == h && slot->len == len) {
+        const char *slotKey = store_at(slot->key);
+        if (slotKey == key || memcmp(slotKey, key, len) == 0) return i;
+      }
+    }
+    if (match_group(ctrl, pos, CTRL_EMPTY) != 0) return dict->nSlots;
+  }
+}
+
+static inline void *slot_value(const Dict *dict, size_t i) {
+  return store_ptr(((const DictSlot *)store_at(dict->slots))[i].value);
+}
+
+void *dict_get_hashed(const Dict *dict, const char *key, size_t len,
+                      uint64_t h) {
+  size_t i = find_slot(dict, key, len, h);
+  return i == dict->nSlots ? NULL : slot_value(dict, i);
+}
+
+// Store key/hash -> value in the first empty or deleted slot of its
+// probe sequence.
+static void insert_slot(Dict *dict, StoreRef key, size_t len,
+                        uint64_t hash, StoreRef value) {
+  const uint8_t *ctrl = store_at(dict->ctrl);
+  size_t mask = dict->nSlots - 1;
+  size_t pos = hash_h1(hash) & mask;
+  for (size_t step = GROUP_SIZE; ;
+       pos = (pos + step) & mask, step += GROUP_SIZE) {
+    unsigned m = match_free(ctrl, pos);
+    if (m != 0) {
+      size_t i = (pos + __builtin_ctz(m)) & mask;
+      if (ctrl[i] == CTRL_DELETED) dict->nDeleted--;
+      set_ctrl(dict, i, hash_h2(hash));
+      ((DictSlot *)store_at(dict->slots))[i] =
+        (DictSlot) { .key = key, .len = len, .hash = hash, .value = value };
+      return;
+    }
+  }
+}
+
+// Reallocate dict with nSlots slots, reinserting existing entries and
+// dropping tombstones.
+static void rehash_dict(Dict *dict, size_t nSlots, ErrNum *err) {
+  Dict old = *dict;
+  alloc_slots(dict, nSlots, err);
+  if (*err != NO_ERR) return;
+  const uint8_t *ctrl = store_at(old.ctrl);
+  const DictSlot *slots = store_at(old.slots);
+  for (size_t i = 0; i < old.nSlots; i++) {
+    if (is_full(ctrl[i])) {
+      const DictSlot *slot = &slots[i];
+      insert_slot(dict, slot->key, slot->len, slot->hash, slot->value);
+    }
+  }
+  free_slots(&old);
+}
+
+void dict_put(Dict *dict, const char *key, void *value, ErrNum *err) {
+  size_t len = strlen(key);
+  dict_put_hashed(dict, key, len, word_hash(key, len), value, err);
+}
+
+void dict_put_hashed(Dict *dict, const char *key, size_t len, uint64_t hash,
+                     void *value, ErrNum *err) {
+  *err = NO_ERR;
+  // keep the load factor (counting tombstones) at most 7/8; if
+  // tombstones are most of the load, rehashing in place suffices
+  if (8 * (dict->nEntries + dict->nDeleted + 1) > 7 * dict->nSlots) {
+    size_t nSlots = 16 * (dict->nEntries + 1) > 7 * dict->nSlots
+      ? 2 * dict->nSlots : dict->nSlots;
+    rehash_dict(dict, nSlots, err);
+    if (*err != NO_ERR) return;
+  }
+  insert_slot(dict, store_ref(key), len, hash, store_ref(value));
+  dict->nEntries++;
+}
+
+void *dict_remove_hashed(Dict *dict, const char *key, size_t len,
+                         uint64_t hash) {
+  size_t i = find_slot(dict, key, len, hash);
+  if (i == dict->nSlots) return NULL;
+  set_ctrl(dict, i, CTRL_DELETED);
+  dict->nDeleted++;
+  dict->nEntries--;
+  return slot_value(dict, i);
+}
+
+size_t dict_size(const Dict *dict) {
+  return dict->nEntries;
+}
+
+void dict_values(const Dict *dict, void *values[]) {
+  const uint8_t *ctrl = store_at(dict->ctrl);
+  size_t n = 0;
+  for (size_t i = 0; i < dict->nSlots; i++) {
+    if (is_full(ctrl[i])) values[n++] = slot_value(dict, i);
+  }
+}
+
+void free_dict(Dict *dict, void (*free_value)(void *value)) {
+  if (dict == NULL) return;
+  if (free_value != NULL) {
+    const uint8_t *ctrl = store_at(dict->ctrl);
+    for (size_t i = 0; i < dict->nSlots; i++) {
+      if (is_full(ctrl[i])) free_value(slot_value(dict, i));
+    }
+  }
+  free_slots(dict);
+  store_free(store_ref(dict), sizeof(Dict));
+}
@@ -0,0 +1,60 @@
+#ifndef DICT_H_
+#define DICT_H_
+
+#include "errnum.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** A dictionary mapping NUL-terminated string keys to opaque values.
+ *
+ *  The dictionary does not copy keys: a key must stay valid for as
+ *  long as its entry is in the dictionary.  Typically the key is the
+ *  name stored within the value itself.
+ *
+ *  The dictionary is in store memory (see storemem.h) and so must be
+ *  the keys and values put in it; lookup keys may be anywhere.
+ */
+typedef struct Dict Dict;
+
+/** Return a new empty dictionary.  Sets *err to MEM_ERR on failure. */
+Dict *new_dict(ErrNum *err);
+
+/** Return the value for key, NULL if none. */
+void *dict_get(const Dict *dict, const char *key);
+
+/** Add key -> value to dict; key must not already be present.
+ *  Sets *err to MEM_ERR on failure.
+ */
+void dict_put(Dict *dict, const char *key, void *value, ErrNum *err);
+
+/** Like dict_get() and dict_put() for a key of len bytes whose hash
+ *  (as computed by word_hash()) is already known; the key's bytes are
+ *  only read to confirm a match.
+ */
+void *dict_get_hashed(const Dict *dict, const char *key, size_t len,
+                      uint64_t hash);
+void dict_put_hashed(Dict *dict, const char *key, size_t len, uint64_t hash,
+                     void *value, ErrNum *err);
+
+/** Remove the entry for key (of len bytes with the given hash) from
+ *  dict and return its value, NULL if there was none.
+ */
+void *dict_remove_hashed(Dict *dict, const char *key, size_t len,
+                         uint64_t hash);
+
+/** Return # of entries in dict. */
+size_t dict_size(const Dict *dict);
+
+/** Copy the values of all entries of dict (in no particular order)
+ *  to values[dict_size(dict)].
+ */
+void dict_values(const Dict *dict, void *values[]);
+
+/** Free all memory used by dict.  If free_value is non-NULL, it is
+ *  called on each value.
+ */
+void free_dict(Dict *dict, void (*free_value)(void *value));
+
+#endif //#ifndef DICT_H_
@@ -0,0 +1,105 @@
+#include "epoch.h"
+
+#include "errnum.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A reader pins by storing the global epoch + 1 into a free slot of
+// pins[] (0 marks a free slot).  A writer tags an object with the
+// global epoch and then advances it, after the object was unlinked;
+// a reader which pinned a later epoch started after the unlinking and
+// cannot reach the object.  So an object can be freed once its tag is
+// below every pinned epoch.  All atomics are sequentially consistent
+// so that a pin is either seen by a writer checking for readers or
+// taken after the object being retired was unlinked.
+static atomic_size_t pins[MAX_EPOCH_PINS];
+static atomic_size_t nPins;
+static atomic_size_t globalEpoch;
+
+// Retired objects, newest first; only touched by writers.
+static Retired *retiredList = NULL;
+static size_t nRetired = 0;
+
+size_t pin_epoch(ErrNum *err) {
+  *err = NO_ERR;
+  atomic_fetch_add(&nPins, 1);
+  for (size_t i = 0; i < MAX_EPOCH_PINS; i++) {
+    size_t expected = 0;
+    if (atomic_load(&pins[i]) == 0 &&
+        atomic_compare_exchange_strong(&pins[i], &expected,
+                                       atomic_load(&globalEpoch) + 1)) {
+      return i;
+    }
+  }
+  atomic_fetch_sub(&nPins, 1);
+  *err = MEM_ERR;
+  return MAX_EPOCH_PINS;
+}
+
+void unpin_epoch(size_t pin) {
+  atomic_store(&pins[pin], 0);
+  atomic_fetch_sub(&nPins, 1);
+}
+
+bool is_epoch_pinned(void) {
+  return atomic_load(&nPins) > 0;
+}
+
+void retire(Retired *retired, void (*freeFn)(Retired *retired)) {
+  retired->free = freeFn;
+  retired->epoch = atomic_fetch_add(&globalEpoch, 1);
+  if (!is_epoch_pinned()) {
+    freeFn(retired);
+    return;
+  }
+  retired->next = retiredList;
+  retiredList = retired;
+  nRetired++;
+  reclaim_retired();
+}
+
+// Return the oldest pinned epoch, SIZE_MAX if none is pinned.
+static size_t oldest_pin(void) {
+  size_t oldest = SIZE_MAX;
+  for (size_t i = 0; i < MAX_EPOCH_PINS; i++) {
+    size_t pin = atomic_load(&pins[i]);
+    if (pin != 0 && pin - 1 < oldest) oldest = pin - 1;
+  }
+  return oldest;
+}
+
+void reclaim_retired(void) {
+  if (retiredList == NULL) return;
+  size_t oldest = oldest_pin();
+  for (Retired **p = &retiredList; *p != NULL; ) {
+    Retired *retired = *p;
+    if (retired->epoch < oldest) {
+      *p = retired->next;
+      nRetired--;
+      retired->free(retired);
+    }
+    else {
+      p = &retired->next;
+    }
+  }
+}
+
+size_t n_epoch_pins(void) {
+  return atomic_load(&nPins);
+}
+
+size_t n_retired(void) {
+  return nRetired;
+}
+
+void free_retired(void) {
+  while (retiredList != NULL) {
+    Retired *retired = retiredList;
+    retiredList = retired->next;
+    retired->free(retired);
+  }
+  nRetired = 0;
+}
@@ -0,0 +1,63 @@
+#ifndef EPOCH_H_
+#define EPOCH_H_
+
+#include "errnum.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Epoch-based deferred reclamation of store memory.
+ *
+ *  A reader which may hold pointers into the store while the store
+ *  changes pins the current epoch.  Memory which a writer unlinks
+ *  from the store is retired rather than freed: it is tagged with the
+ *  epoch in which it was retired and is only freed once every reader
+ *  pinned in or before that epoch has unpinned.  Pinning and
+ *  unpinning are lock-free, and writers never wait for readers; they
+ *  only leave retired memory allocated for longer.
+ *
+ *  Retiring and reclaiming must be serialized with respect to each
+ *  other (the store's writers are, by the store lock).  Pins are only
+ *  seen by the process taking them, so a reader of a shared memory
+ *  store (see shmstore.h) cannot rely on them against the writer.
+ */
+
+enum { MAX_EPOCH_PINS = 64 };
+
+/** Header of an object which can be retired; it must be the object's
+ *  first member.  free is called on the object when it is reclaimed.
+ */
+typedef struct Retired {
+  struct Retired *next;
+  size_t epoch;
+  void (*free)(struct Retired *retired);
+} Retired;
+
+/** Pin the current epoch and return the pin to pass to
+ *  unpin_epoch().  Sets *err to MEM_ERR if MAX_EPOCH_PINS pins are
+ *  already held.
+ */
+size_t pin_epoch(ErrNum *err);
+
+/** Release a pin returned by pin_epoch(). */
+void unpin_epoch(size_t pin);
+
+/** Return true if any reader is pinned. */
+bool is_epoch_pinned(void);
+
+/** Retire retired, to be freed by calling freeFn on it once no reader
+ *  can still see it (right away if no reader is pinned).
+ */
+void retire(Retired *retired, void (*freeFn)(Retired *retired));
+
+/** Free the retired objects which no pinned reader can see. */
+void reclaim_retired(void);
+
+/** Return # of pinned readers and # of objects awaiting reclamation. */
+size_t n_epoch_pins(void);
+size_t n_retired(void);
+
+/** Free all retired objects; no reader may be pinned. */
+void free_retired(void);
+
+#endif //#ifndef EPOCH_H_
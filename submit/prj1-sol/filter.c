@@ -0,0 +1,241 @@
+#include "filter.h"
+
+#include "record.h"
+#include "word.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+// Return true if text[len] is an OR group: "(" TOPIC ("|" TOPIC)* ")"
+// where each TOPIC is a non-empty word starting with '#'.
+static bool is_topic_group(const char *text, size_t len) {
+  if (len < 2 || text[0] != '(' || text[len - 1] != ')') return false;
+  for (size_t i = 1; i < len; i++) {
+    if ((i == 1 || text[i - 1] == '|') && text[i] != '#') return false;
+  }
+  return true;
+}
+
+// Strip a leading '!' from *text[*len], returning true if there was one
+static bool strip_negation(char **text, size_t *len) {
+  if (*len == 0 || **text != '!') return false;
+  (*text)++;
+  (*len)--;
+  return true;
+}
+
+bool is_filter_clause(const Word *word) {
+  if (word->kind == WORD_TOPIC) return true;
+  char *text = word->text;
+  size_t len = word->len;
+  if (strip_negation(&text, &len) && len > 0 && text[0] == '#') return true;
+  return is_topic_group(text, len);
+}
+
+size_t count_filter_topics(const Word words[], size_t nWords) {
+  size_t n = 0;
+  for (size_t i = 0; i < nWords; i++) {
+    char *text = words[i].text;
+    size_t len = words[i].len;
+    n++;
+    if (words[i].kind == WORD_TOPIC) continue;
+    strip_negation(&text, &len);
+    if (text[0] != '(') continue;
+    for (size_t j = 0; j < len; j++) n += text[j] == '|';
+  }
+  return n;
+}
+
+// Return the topic text[len] as a word
+static Word topic_word(char *text, size_t len) {
+  return (Word) {
+    .text = text, .len = len, .hash = word_hash(text, len), .kind = WORD_TOPIC,
+  };
+}
+
+void parse_topic_filter(const Word words[], size_t nWords,
+                        FilterClause clauses[], Word topics[]) {
+  size_t nTopics = 0;
+  for (size_t i = 0; i < nWords; i++) {
+    char *text = words[i].text;
+    size_t len = words[i].len;
+    bool isNegated = words[i].kind != WORD_TOPIC && strip_negation(&text, &len);
+    clauses[i] = (FilterClause) { .first = nTopics, .isNegated = isNegated };
+    if (words[i].kind == WORD_TOPIC) {
+      topics[nTopics++] = words[i];
+    }
+    else if (text[0] != '(') {
+      topics[nTopics++] = topic_word(text, len);
+    }
+    else {
+      // the elements of a group are delimited by '|' and the closing ')'
+      char *start = text + 1;
+      char *end = text + len - 1;
+      while (start < end) {
+        char *bar = memchr(start, '|', end - start);
+        char *stop = bar == NULL ? end : bar;
+        topics[nTopics++] = topic_word(start, stop - start);
+        start = stop + 1;
+      }
+    }
+    clauses[i].n = nTopics - clauses[i].first;
+  }
+}
+
+bool is_conjunction(const FilterClause clauses[], size_t nClauses) {
+  for (size_t i = 0; i < nClauses; i++) {
+    if (clauses[i].n != 1 || clauses[i].isNegated) return false;
+  }
+  return true;
+}
+
+// The record's topic ids are compared without decoding their names.
+bool record_matches_filter(const ChatRecord *record,
+                           const FilterClause clauses[], size_t nClauses,
+                           const size_t topicIds[]) {
+  for (size_t c = 0; c < nClauses; c++) {
+    const size_t *ids = &topicIds[clauses[c].first];
+    bool isFound = false;
+    const uint8_t *recordIds = record->topicIds;
+    for (size_t j = 0; j < record->nTopics && !isFound; j++) {
+      size_t id = record_next_topic(&recordIds);
+      for (size_t k = 0; k < clauses[c].n && !isFound; k++) {
+        isFound = id == ids[k];
+      }
+    }
+    if (isFound == clauses[c].isNegated) return false;
+  }
+  return true;
+}
+
+
+#ifdef TEST_FILTER
+
+#include "arena.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+enum { N_TOPICS = 6, MAX_CLAUSES = 4, MAX_GROUP = 3 };
+
+// Return text as a word of the kind the lexer gives it
+static Word make_word(char *text) {
+  size_t len = strlen(text);
+  return (Word) {
+    .text = text, .len = len, .hash = word_hash(text, len),
+    .kind = text[0] == '#' ? WORD_TOPIC : WORD_OTHER,
+  };
+}
+
+static bool is_clause(const char *text) {
+  char buf[32];
+  strcpy(buf, text);
+  Word word = make_word(buf);
+  return is_filter_clause(&word);
+}
+
+// Check clause syntax, then random filters of topics #t0..#t<N_TOPICS>
+// (the last never added) against brute force: their parse against the
+// clauses they were generated from, and record_matches_filter() over
+// records with random topics against the clauses' meaning.
+int
+main(int argc, const char *argv[])
+{
+  srand(argc > 1 ? atoi(argv[1]) : 1);
+  assert(is_clause("#a") && is_clause("!#a") && is_clause("(#a)"));
+  assert(is_clause("(#a|#b)") && is_clause("!(#a|#b|#c)"));
+  assert(is_clause("#a|b)") && is_clause("#(a)"));     //plain topics
+  assert(!is_clause("(#a|)") && !is_clause("(#a||#b)") && !is_clause("()"));
+  assert(!is_clause("(#a") && !is_clause("(a)") && !is_clause("(|#a)"));
+  assert(!is_clause("!") && !is_clause("!a") && !is_clause("!!#a"));
+  assert(!is_clause("a") && !is_clause("!()") && !is_clause("(#a|b)"));
+
+  Arena arena;
+  init_arena(&arena);
+  ErrNum err;
+  size_t nMatched = 0;
+  for (int trial = 0; trial < 2000; trial++) {
+    // generate the filter, remembering each clause's topics
+    size_t nClauses = 1 + rand() % MAX_CLAUSES;
+    char texts[MAX_CLAUSES][64];
+    Word words[MAX_CLAUSES];
+    bool isNegated[MAX_CLAUSES];
+    size_t nIn[MAX_CLAUSES], in[MAX_CLAUSES][MAX_GROUP];
+    for (size_t c = 0; c < nClauses; c++) {
+      isNegated[c] = rand() % 3 == 0;
+      bool isGroup = rand() % 2 == 0;
+      nIn[c] = isGroup ? 1 + rand() % MAX_GROUP : 1;
+      char *p = texts[c];
+      if (isNegated[c]) *p++ = '!';
+      if (isGroup) *p++ = '(';
+      for (size_t k = 0; k < nIn[c]; k++) {
+        in[c][k] = rand() % (N_TOPICS + 1);
+        p += sprintf(p, "%s#t%zu", k > 0 ? "|" : "", in[c][k]);
+      }
+      if (isGroup) *p++ = ')';
+      *p = '\0';
+      words[c] = make_word(texts[c]);
+      assert(is_filter_clause(&words[c]));
+    }
+
+    // parse it and check the parse against the generated clauses
+    size_t nTopics = count_filter_topics(words, nClauses);
+    size_t nExpected = 0;
+    for (size_t c = 0; c < nClauses; c++) nExpected += nIn[c];
+    assert(nTopics == nExpected);
+    FilterClause clauses[MAX_CLAUSES];
+    Word topics[MAX_CLAUSES * MAX_GROUP];
+    parse_topic_filter(words, nClauses, clauses, topics);
+    size_t topicIds[MAX_CLAUSES * MAX_GROUP];
+    bool isPlain = true;
+    for (size_t c = 0; c < nClauses; c++) {
+      assert(clauses[c].isNegated == isNegated[c] && clauses[c].n == nIn[c]);
+      assert(c == 0 || clauses[c].first ==
+             clauses[c - 1].first + clauses[c - 1].n);
+      isPlain = isPlain && nIn[c] == 1 && !isNegated[c];
+      for (size_t k = 0; k < nIn[c]; k++) {
+        const Word *t = &topics[clauses[c].first + k];
+        char name[16];
+        sprintf(name, "#t%zu", in[c][k]);
+        assert(t->kind == WORD_TOPIC && t->len == strlen(name));
+        assert(memcmp(t->text, name, t->len) == 0);
+        assert(t->hash == word_hash(name, t->len));
+        topicIds[clauses[c].first + k] =
+          in[c][k] == N_TOPICS ? FILTER_NO_TOPIC : in[c][k];
+      }
+    }
+    assert(is_conjunction(clauses, nClauses) == isPlain);
+
+    // match a few records against the meaning of the clauses
+    for (int r = 0; r < 8; r++) {
+      size_t ids[N_TOPICS], nIds = 0;
+      bool has[N_TOPICS + 1] = { false };
+      for (size_t t = 0; t < N_TOPICS; t++) {
+        if (rand() % 2 == 0) {
+          ids[nIds++] = t;
+          has[t] = true;
+        }
+      }
+      size_t offset = encode_record(&arena, 0, 0, 0, ids, nIds,
+                                    RECORD_INLINE_BODY, "x", 1, &err);
+      assert(err == NO_ERR);
+      ChatRecord record;
+      decode_record(arena_at(&arena, offset), &record);
+      bool isMatch = true;
+      for (size_t c = 0; c < nClauses; c++) {
+        bool isFound = false;
+        for (size_t k = 0; k < nIn[c]; k++) isFound = isFound || has[in[c][k]];
+        isMatch = isMatch && isFound != isNegated[c];
+      }
+      assert(record_matches_filter(&record, clauses, nClauses, topicIds) ==
+             isMatch);
+      nMatched += isMatch;
+    }
+  }
+  free_arena(&arena);
+  printf("filter ok (%zu of 16000 records matched)\n", nMatched);
+}
+
+#endif //#ifdef TEST_FILTER
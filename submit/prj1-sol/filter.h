@@ -0,0 +1,64 @@
+#ifndef FILTER_H_
+#define FILTER_H_
+
+#include "record.h"
+#include "word.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Topic filters of QUERY commands.  Each TOPIC word of a query is a
+ *  clause of the filter, one of
+ *
+ *    #a             the message has topic #a
+ *    (#a|#b|...)    it has at least one of the topics
+ *    !#a, !(#a|#b)  it has none of them
+ *
+ *  and a message matches the filter when it satisfies every clause.
+ *  A plain #a is always a single topic, even if it contains '|' or
+ *  parentheses.
+ *
+ *  Parsing splits the clauses into their topics, pointing into the
+ *  clause words; whoever evaluates the filter looks the topics up,
+ *  either as ids to compare against a record's (see
+ *  record_matches_filter()) or as posting lists to combine.
+ */
+
+/** A clause: the topics first .. first + n - 1 of its filter. */
+typedef struct {
+  size_t first;
+  size_t n;
+  bool isNegated;
+} FilterClause;
+
+/** Topic id of a topic which was never added, matching no message. */
+#define FILTER_NO_TOPIC SIZE_MAX
+
+/** Return true if word is a well-formed clause. */
+bool is_filter_clause(const Word *word);
+
+/** Return the # of topics named by the well-formed clause words
+ *  words[nWords].
+ */
+size_t count_filter_topics(const Word words[], size_t nWords);
+
+/** Split the well-formed clause words words[nWords] into clauses[nWords]
+ *  over topics[count_filter_topics()].
+ */
+void parse_topic_filter(const Word words[], size_t nWords,
+                        FilterClause clauses[], Word topics[]);
+
+/** Return true if every clause is a single topic which is not negated,
+ *  i.e. the filter is a plain AND of topics.
+ */
+bool is_conjunction(const FilterClause clauses[], size_t nClauses);
+
+/** Return true if record satisfies clauses[nClauses], where topicIds[]
+ *  gives the ids of their topics.
+ */
+bool record_matches_filter(const ChatRecord *record,
+                           const FilterClause clauses[], size_t nClauses,
+                           const size_t topicIds[]);
+
+#endif //#ifndef FILTER_H_
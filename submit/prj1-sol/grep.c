@@ -0,0 +1,819 @@
+#include "grep.h"
+
+#include "chartab.h"
+#include "errnum.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*************************** Literal Search ****************************/
+
+// Return true if needle[n] occurs in text[len].  With SSE2, each step
+// compares needle's first and last bytes against the 16 positions
+// starting at text + i, so the rest of the needle is only compared
+// where both match; positions too near the end for a whole step are
+// left to memchr().
+static bool has_substring(const char *text, size_t len,
+                          const char *needle, size_t n) {
+  if (n == 0) return true;
+  if (n > len) return false;
+  if (n == 1) return memchr(text, needle[0], len) != NULL;
+  size_t i = 0;
+#ifdef __SSE2__
+  __m128i first = _mm_set1_epi8(needle[0]);
+  __m128i last = _mm_set1_epi8(needle[n - 1]);
+  for (; i + n - 1 + 16 <= len; i += 16) {
+    __m128i blockFirst = _mm_loadu_si128((const __m128i *)(text + i));
+    __m128i blockLast = _mm_loadu_si128((const __m128i *)(text + i + n - 1));
+    unsigned mask =
+      _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, blockFirst),
+                                      _mm_cmpeq_epi8(last, blockLast)));
+    for (; mask != 0; mask &= mask - 1) {
+      const char *p = text + i + __builtin_ctz(mask);
+      if (memcmp(p + 1, needle + 1, n - 2) == 0) return true;
+    }
+  }
+#endif
+  const char *end = text + len - n + 1;
+  for (const char *p = text + i; (p = memchr(p, needle[0], end - p)) != NULL;
+       p++) {
+    if (memcmp(p + 1, needle + 1, n - 1) == 0) return true;
+  }
+  return false;
+}
+
+/************************ Regular Expressions **************************/
+
+// Sets of bytes, as 256 bits.
+static inline void add_byte(uint64_t set[4], unsigned c) {
+  set[c >> 6] |= (uint64_t)1 << (c & 63);
+}
+
+static inline bool has_byte(const uint64_t set[4], unsigned c) {
+  return (set[c >> 6] >> (c & 63)) & 1;
+}
+
+static void add_range(uint64_t set[4], unsigned lo, unsigned hi) {
+  for (unsigned c = lo; c <= hi; c++) add_byte(set, c);
+}
+
+// A regular expression is first parsed into a tree of ReNodes.
+enum {
+  RE_BYTES,             // any byte of bytes
+  RE_EMPTY,             // the empty string
+  RE_CAT,               // left then right
+  RE_ALT,               // left or right
+  RE_STAR,              // left zero or more times
+  RE_PLUS,              // left one or more times
+  RE_QUEST,             // left zero or one times
+  RE_BOL,               // the start of a line
+  RE_EOL,               // the end of a line
+};
+
+typedef struct {
+  uint8_t type;
+  uint32_t left, right;
+  uint64_t bytes[4];
+} ReNode;
+
+enum { RE_MAX_DEPTH = 100 };    // of nested parentheses
+
+// Every byte of a pattern adds at most 3 nodes (an atom, a repetition
+// or '|' and the concatenation or empty alternative holding it).
+typedef struct {
+  const char *p;
+  const char *end;
+  ReNode *nodes;
+  uint32_t nNodes;
+  bool isBad;
+} ReParser;
+
+static uint32_t add_node(ReParser *parser, uint8_t type,
+                         uint32_t left, uint32_t right) {
+  ReNode *node = &parser->nodes[parser->nNodes];
+  *node = (ReNode) { .type = type, .left = left, .right = right };
+  return parser->nNodes++;
+}
+
+static bool is_at(const ReParser *parser, char c) {
+  return parser->p < parser->end && *parser->p == c;
+}
+
+// If c names a class escape (\d, \w, \s or their negations \D, \W,
+// \S) add its bytes to set and return true, else return false.
+static bool add_class_escape(uint64_t set[4], char c) {
+  uint64_t class[4] = { 0 };
+  switch (char_fold(c)) {
+  case 'd':
+    add_range(class, '0', '9');
+    break;
+  case 'w':
+    add_range(class, '0', '9');
+    add_range(class, 'a', 'z');
+    add_range(class, 'A', 'Z');
+    add_byte(class, '_');
+    break;
+  case 's':
+    for (const char *s = " \t\r\f\v"; *s != '\0'; s++) add_byte(class, *s);
+    break;
+  default:
+    return false;
+  }
+  bool isUpper = char_is_alpha(c) && char_fold(c) != (unsigned char)c;
+  uint64_t invert = isUpper ? UINT64_MAX : 0;
+  for (int i = 0; i < 4; i++) set[i] |= class[i] ^ invert;
+  return true;
+}
+
+// Parse the set of a bracket expression after its '[' into set: an
+// optional '^' negating it, then bytes (']' only first), ranges c-d
+// and escapes up to the closing ']'.
+static void parse_class(ReParser *parser, uint64_t set[4]) {
+  bool isNegated = is_at(parser, '^');
+  if (isNegated) parser->p++;
+  bool isFirst = true;
+  while (parser->p < parser->end && (isFirst || *parser->p != ']')) {
+    isFirst = false;
+    unsigned char lo = *parser->p++;
+    if (lo == '\\') {
+      if (parser->p == parser->end) break;
+      lo = *parser->p++;
+      if (add_class_escape(set, lo)) continue;
+    }
+    if (parser->end - parser->p >= 2 && parser->p[0] == '-' &&
+        parser->p[1] != ']') {
+      unsigned char hi = parser->p[1];
+      parser->p += 2;
+      if (hi == '\\' && parser->p < parser->end) hi = *parser->p++;
+      if (hi < lo) parser->isBad = true;
+      else add_range(set, lo, hi);
+    }
+    else {
+      add_byte(set, lo);
+    }
+  }
+  if (!is_at(parser, ']')) {
+    parser->isBad = true;
+    return;
+  }
+  parser->p++;
+  if (isNegated) {
+    for (int i = 0; i < 4; i++) set[i] = ~set[i];
+  }
+}
+
+static uint32_t parse_alt(ReParser *parser, unsigned depth);
+
+static uint32_t parse_atom(ReParser *parser, unsigned depth) {
+  char c = *parser->p++;
+  uint32_t node = add_node(parser, RE_BYTES, 0, 0);
+  uint64_t *bytes = parser->nodes[node].bytes;
+  switch (c) {
+  case '(': {
+    if (depth == RE_MAX_DEPTH) {
+      parser->isBad = true;
+      return node;
+    }
+    uint32_t inner = parse_alt(parser, depth + 1);
+    if (!is_at(parser, ')')) parser->isBad = true;
+    else parser->p++;
+    return inner;
+  }
+  case '[':
+    parse_class(parser, bytes);
+    break;
+  case '.':
+    memset(bytes, 0xff, 4 * sizeof(bytes[0]));
+    break;
+  case '\\':
+    if (parser->p == parser->end) {
+      parser->isBad = true;
+      break;
+    }
+    c = *parser->p++;
+    if (!add_class_escape(bytes, c)) add_byte(bytes, (unsigned char)c);
+    break;
+  case '^':
+    parser->nodes[node].type = RE_BOL;
+    break;
+  case '$':
+    parser->nodes[node].type = RE_EOL;
+    break;
+  case '*': case '+': case '?': case '{':
+    parser->isBad = true;
+    break;
+  default:
+    add_byte(bytes, (unsigned char)c);
+    break;
+  }
+  return node;
+}
+
+static uint32_t parse_repeat(ReParser *parser, unsigned depth) {
+  uint32_t node = parse_atom(parser, depth);
+  while (parser->p < parser->end) {
+    char c = *parser->p;
+    uint8_t type =
+      c == '*' ? RE_STAR : c == '+' ? RE_PLUS : c == '?' ? RE_QUEST : RE_EMPTY;
+    if (type == RE_EMPTY) break;
+    parser->p++;
+    node = add_node(parser, type, node, 0);
+  }
+  return node;
+}
+
+static uint32_t parse_cat(ReParser *parser, unsigned depth) {
+  uint32_t node = add_node(parser, RE_EMPTY, 0, 0);
+  bool isEmpty = true;
+  while (!parser->isBad && parser->p < parser->end &&
+         *parser->p != '|' && *parser->p != ')') {
+    uint32_t next = parse_repeat(parser, depth);
+    node = isEmpty ? next : add_node(parser, RE_CAT, node, next);
+    isEmpty = false;
+  }
+  return node;
+}
+
+static uint32_t parse_alt(ReParser *parser, unsigned depth) {
+  uint32_t node = parse_cat(parser, depth);
+  while (!parser->isBad && is_at(parser, '|')) {
+    parser->p++;
+    node = add_node(parser, RE_ALT, node, parse_cat(parser, depth));
+  }
+  return node;
+}
+
+// The tree is then compiled to a Thompson NFA, whose state 0 accepts.
+enum {
+  NFA_MATCH,
+  NFA_BYTES,            // consumes a byte of bytes, going to out
+  NFA_SPLIT,            // goes to both out and out1 without consuming
+  NFA_BOL,              // goes to out at the start of a line
+  NFA_EOL,              // goes to out at the end of a line
+};
+
+typedef struct {
+  uint8_t type;
+  uint32_t out, out1;
+  uint64_t bytes[4];
+} NfaState;
+
+typedef struct {
+  NfaState *states;
+  uint32_t nStates;
+  uint32_t start;
+} Regex;
+
+static uint32_t add_nfa_state(Regex *re, uint8_t type,
+                              uint32_t out, uint32_t out1) {
+  re->states[re->nStates] = (NfaState) { .type = type, .out = out, .out1 = out1 };
+  return re->nStates++;
+}
+
+// Return the start of the states for node, which continue to next.
+static uint32_t compile_node(Regex *re, const ReNode nodes[], uint32_t node,
+                             uint32_t next) {
+  const ReNode *n = &nodes[node];
+  uint32_t s;
+  switch (n->type) {
+  case RE_BYTES:
+    s = add_nfa_state(re, NFA_BYTES, next, 0);
+    memcpy(re->states[s].bytes, n->bytes, sizeof(n->bytes));
+    return s;
+  case RE_EMPTY:
+    return next;
+  case RE_BOL:
+    return add_nfa_state(re, NFA_BOL, next, 0);
+  case RE_EOL:
+    return add_nfa_state(re, NFA_EOL, next, 0);
+  case RE_CAT:
+    return compile_node(re, nodes, n->left,
+                        compile_node(re, nodes, n->right, next));
+  case RE_ALT: {
+    uint32_t left = compile_node(re, nodes, n->left, next);
+    uint32_t right = compile_node(re, nodes, n->right, next);
+    return add_nfa_state(re, NFA_SPLIT, left, right);
+  }
+  case RE_STAR:
+    s = add_nfa_state(re, NFA_SPLIT, 0, next);
+    re->states[s].out = compile_node(re, nodes, n->left, s);
+    return s;
+  case RE_PLUS:
+    s = add_nfa_state(re, NFA_SPLIT, 0, next);
+    re->states[s].out = compile_node(re, nodes, n->left, s);
+    return re->states[s].out;
+  default: //RE_QUEST
+    return add_nfa_state(re, NFA_SPLIT,
+                         compile_node(re, nodes, n->left, next), next);
+  }
+}
+
+static void free_regex(Regex *re) {
+  if (re == NULL) return;
+  free(re->states);
+  free(re);
+}
+
+// Return text[len] compiled, or NULL (with *err NO_ERR if it is
+// malformed).
+static Regex *compile_regex(const char *text, size_t len, ErrNum *err) {
+  *err = NO_ERR;
+  size_t maxNodes = 3 * len + 1;
+  ReParser parser = {
+    .p = text, .end = text + len, .nodes = malloc(maxNodes * sizeof(ReNode)),
+  };
+  Regex *re = calloc(1, sizeof(Regex));
+  if (re != NULL) re->states = malloc((maxNodes + 1) * sizeof(NfaState));
+  if (parser.nodes == NULL || re == NULL || re->states == NULL) {
+    free(parser.nodes);
+    free_regex(re);
+    *err = MEM_ERR;
+    return NULL;
+  }
+  uint32_t root = parse_alt(&parser, 0);
+  if (parser.isBad || parser.p != parser.end) {
+    free(parser.nodes);
+    free_regex(re);
+    return NULL;
+  }
+  add_nfa_state(re, NFA_MATCH, 0, 0);
+  re->start = compile_node(re, parser.nodes, root, 0);
+  free(parser.nodes);
+  return re;
+}
+
+/***************************** Lazy DFA ********************************/
+
+// Each DFA state is a set of NFA states (only those consuming bytes or
+// waiting for the end of a line, and NFA_MATCH, as the others are
+// followed when the set is built), kept sorted in sets[] and found by
+// hashing.  Transitions are computed the first time they are taken.
+// After every byte the states reached from the start without crossing
+// a ^ are added, so a match may begin anywhere.  When the DFA is full
+// it is flushed and rebuilt from the state in hand, so it uses bounded
+// space whatever the regex and text.
+enum {
+  DFA_MAX_STATES = 256,
+  DFA_TABLE_SIZE = 2 * DFA_MAX_STATES,          // a power of 2
+  DFA_MAX_SET_WORDS = 1 << 20,
+};
+
+typedef struct {
+  uint32_t setOffset;
+  uint32_t setLen;
+  bool isMatch;
+  bool isMatchAtEnd;    // if the line ends here
+  int32_t next[256];    // -1 if not yet computed
+} DfaState;
+
+typedef struct {
+  const Regex *re;
+  DfaState *states;
+  uint32_t nStates;
+  uint32_t *sets;
+  size_t setsLen;
+  size_t setsSize;
+  int32_t *table;       // state index or -1
+  uint64_t *marks;      // NFA states in the set being built
+  uint32_t *stack;
+  uint32_t *work;       // the set being built
+  uint32_t *lineSet;    // NFA states at the start of a line
+  uint32_t lineLen;
+  uint32_t *restartSet; // NFA states added after each byte
+  uint32_t restartLen;
+  int32_t start;        // DFA state for lineSet
+} Dfa;
+
+// Where in a line the NFA states are being followed, which decides
+// whether NFA_BOL and NFA_EOL states are passed through.
+typedef enum { AT_LINE_START, IN_LINE, AT_LINE_END } LinePos;
+
+static inline bool is_marked(const Dfa *dfa, uint32_t s) {
+  return (dfa->marks[s >> 6] >> (s & 63)) & 1;
+}
+
+static inline void mark(Dfa *dfa, uint32_t s) {
+  dfa->marks[s >> 6] |= (uint64_t)1 << (s & 63);
+}
+
+// Mark s and every state reachable from it without consuming a byte
+// at pos.
+static void mark_closure(Dfa *dfa, uint32_t s, LinePos pos) {
+  if (is_marked(dfa, s)) return;
+  mark(dfa, s);
+  size_t n = 0;
+  dfa->stack[n++] = s;
+  while (n > 0) {
+    const NfaState *state = &dfa->re->states[dfa->stack[--n]];
+    uint32_t outs[] = { state->out, state->out1 };
+    int nOuts = state->type == NFA_SPLIT ? 2
+      : (state->type == NFA_BOL && pos == AT_LINE_START) ||
+        (state->type == NFA_EOL && pos == AT_LINE_END) ? 1 : 0;
+    for (int i = 0; i < nOuts; i++) {
+      if (is_marked(dfa, outs[i])) continue;
+      mark(dfa, outs[i]);
+      dfa->stack[n++] = outs[i];
+    }
+  }
+}
+
+// Move the marked states which belong in a set to set[] in order (if
+// set is not NULL), clearing the marks, and return their #.
+static uint32_t take_marked(Dfa *dfa, uint32_t set[]) {
+  uint32_t n = 0;
+  uint32_t nWords = (dfa->re->nStates + 63) / 64;
+  for (uint32_t w = 0; w < nWords; w++) {
+    for (uint64_t bits = set == NULL ? 0 : dfa->marks[w]; bits != 0;
+         bits &= bits - 1) {
+      uint32_t s = w * 64 + __builtin_ctzll(bits);
+      uint8_t type = dfa->re->states[s].type;
+      if (type != NFA_SPLIT && type != NFA_BOL) set[n++] = s;
+    }
+    dfa->marks[w] = 0;
+  }
+  return n;
+}
+
+// Return true if the NFA states set[n] reach NFA_MATCH when the line
+// ends.
+static bool is_match_at_end(Dfa *dfa, const uint32_t set[], uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) {
+    if (dfa->re->states[set[i]].type == NFA_EOL) {
+      mark_closure(dfa, set[i], AT_LINE_END);
+    }
+  }
+  bool isMatch = is_marked(dfa, 0);
+  take_marked(dfa, NULL);
+  return isMatch;
+}
+
+static size_t set_hash(const uint32_t set[], uint32_t n) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (uint32_t i = 0; i < n; i++) hash = (hash ^ set[i]) * 1099511628211ULL;
+  return hash ^ (hash >> 32);
+}
+
+// Return the state for set[n], adding it if needed, or -1 if the DFA
+// is full.
+static int32_t find_state(Dfa *dfa, const uint32_t set[], uint32_t n) {
+  size_t i = set_hash(set, n) & (DFA_TABLE_SIZE - 1);
+  for (; dfa->table[i] >= 0; i = (i + 1) & (DFA_TABLE_SIZE - 1)) {
+    const DfaState *state = &dfa->states[dfa->table[i]];
+    if (state->setLen == n &&
+        memcmp(&dfa->sets[state->setOffset], set, n * sizeof(set[0])) == 0) {
+      return dfa->table[i];
+    }
+  }
+  if (dfa->nStates == DFA_MAX_STATES) return -1;
+  if (dfa->setsLen + n > dfa->setsSize) {
+    size_t size = 2 * dfa->setsSize;
+    if (size < dfa->setsLen + n) size = dfa->setsLen + n;
+    if (size > DFA_MAX_SET_WORDS) return -1;
+    uint32_t *sets = realloc(dfa->sets, size * sizeof(sets[0]));
+    if (sets == NULL) return -1;
+    dfa->sets = sets;
+    dfa->setsSize = size;
+  }
+  DfaState *state = &dfa->states[dfa->nStates];
+  state->setOffset = dfa->setsLen;
+  state->setLen = n;
+  state->isMatch = n > 0 && set[0] == 0;
+  state->isMatchAtEnd = state->isMatch || is_match_at_end(dfa, set, n);
+  memset(state->next, -1, sizeof(state->next));
+  memcpy(&dfa->sets[dfa->setsLen], set, n * sizeof(set[0]));
+  dfa->setsLen += n;
+  dfa->table[i] = dfa->nStates;
+  return dfa->nStates++;
+}
+
+// Empty dfa of all but its start state.  The sets allocated at first
+// always have room for that and one more set, so this never fails.
+static void flush_dfa(Dfa *dfa) {
+  dfa->nStates = 0;
+  dfa->setsLen = 0;
+  memset(dfa->table, -1, DFA_TABLE_SIZE * sizeof(dfa->table[0]));
+  dfa->start = find_state(dfa, dfa->lineSet, dfa->lineLen);
+}
+
+// Return the state reached from state from on byte c.
+static int32_t dfa_step(Dfa *dfa, int32_t from, uint8_t c) {
+  const DfaState *state = &dfa->states[from];
+  for (uint32_t i = 0; i < state->setLen; i++) {
+    const NfaState *s = &dfa->re->states[dfa->sets[state->setOffset + i]];
+    if (s->type == NFA_BYTES && has_byte(s->bytes, c)) {
+      mark_closure(dfa, s->out, IN_LINE);
+    }
+  }
+  for (uint32_t i = 0; i < dfa->restartLen; i++) {
+    mark(dfa, dfa->restartSet[i]);
+  }
+  uint32_t n = take_marked(dfa, dfa->work);
+  int32_t to = find_state(dfa, dfa->work, n);
+  if (to >= 0) {
+    dfa->states[from].next[c] = to;
+    return to;
+  }
+  flush_dfa(dfa);
+  return find_state(dfa, dfa->work, n);
+}
+
+// Return true if a line of text[len] matches dfa's regex.
+static bool dfa_search(Dfa *dfa, const uint8_t *text, size_t len) {
+  int32_t s = dfa->start;
+  if (dfa->states[s].isMatch) return true;
+  const uint8_t *end = text + len;
+  for (const uint8_t *p = text; p < end; p++) {
+    if (*p == '\n') {
+      if (dfa->states[s].isMatchAtEnd) return true;
+      s = dfa->start;
+      continue;
+    }
+    int32_t next = dfa->states[s].next[*p];
+    s = next >= 0 ? next : dfa_step(dfa, s, *p);
+    if (dfa->states[s].isMatch) return true;
+    if (dfa->states[s].setLen == 0) {
+      //dead until the next line
+      p = memchr(p, '\n', end - p);
+      if (p == NULL) return false;
+      p--;
+    }
+  }
+  //a final newline ends the last line rather than starting another
+  bool isLineEnd = len == 0 || text[len - 1] != '\n';
+  return isLineEnd && dfa->states[s].isMatchAtEnd;
+}
+
+static void free_dfa(Dfa *dfa) {
+  if (dfa == NULL) return;
+  free(dfa->states);
+  free(dfa->sets);
+  free(dfa->table);
+  free(dfa->marks);
+  free(dfa->stack);
+  free(dfa->work);
+  free(dfa->lineSet);
+  free(dfa->restartSet);
+  free(dfa);
+}
+
+static Dfa *new_dfa(const Regex *re) {
+  Dfa *dfa = calloc(1, sizeof(Dfa));
+  if (dfa == NULL) return NULL;
+  uint32_t n = re->nStates;
+  dfa->re = re;
+  dfa->states = malloc(DFA_MAX_STATES * sizeof(DfaState));
+  dfa->setsSize = 2 * n;
+  dfa->sets = malloc(dfa->setsSize * sizeof(dfa->sets[0]));
+  dfa->table = malloc(DFA_TABLE_SIZE * sizeof(dfa->table[0]));
+  dfa->marks = calloc((n + 63) / 64, sizeof(dfa->marks[0]));
+  dfa->stack = malloc(n * sizeof(dfa->stack[0]));
+  dfa->work = malloc(n * sizeof(dfa->work[0]));
+  dfa->lineSet = malloc(n * sizeof(dfa->lineSet[0]));
+  dfa->restartSet = malloc(n * sizeof(dfa->restartSet[0]));
+  if (dfa->states == NULL || dfa->sets == NULL || dfa->table == NULL ||
+      dfa->marks == NULL || dfa->stack == NULL || dfa->work == NULL ||
+      dfa->lineSet == NULL || dfa->restartSet == NULL) {
+    free_dfa(dfa);
+    return NULL;
+  }
+  mark_closure(dfa, re->start, AT_LINE_START);
+  dfa->lineLen = take_marked(dfa, dfa->lineSet);
+  mark_closure(dfa, re->start, IN_LINE);
+  dfa->restartLen = take_marked(dfa, dfa->restartSet);
+  flush_dfa(dfa);
+  return dfa;
+}
+
+/****************************** Patterns *******************************/
+
+struct BodyPattern {
+  char *literal;
+  size_t literalLen;
+  Regex *regex;                         // NULL for a literal
+  Dfa *dfas[GREP_MAX_THREADS];          // one per thread, made when needed
+};
+
+BodyPattern *compile_body_pattern(const char *text, size_t len, bool isRegex,
+                                  ErrNum *err) {
+  *err = NO_ERR;
+  if (isRegex && len > GREP_MAX_REGEX_LEN) return NULL;
+  BodyPattern *pattern = calloc(1, sizeof(BodyPattern));
+  char *literal = malloc(len + 1);
+  if (pattern == NULL || literal == NULL) {
+    free(pattern);
+    free(literal);
+    *err = MEM_ERR;
+    return NULL;
+  }
+  memcpy(literal, text, len);
+  literal[len] = '\0';
+  pattern->literal = literal;
+  pattern->literalLen = len;
+  if (isRegex && (pattern->regex = compile_regex(text, len, err)) == NULL) {
+    free_body_pattern(pattern);
+    return NULL;
+  }
+  return pattern;
+}
+
+void free_body_pattern(BodyPattern *pattern) {
+  if (pattern == NULL) return;
+  for (int i = 0; i < GREP_MAX_THREADS; i++) free_dfa(pattern->dfas[i]);
+  free_regex(pattern->regex);
+  free(pattern->literal);
+  free(pattern);
+}
+
+static bool body_matches(const BodyPattern *pattern, Dfa *dfa,
+                         const char *body, size_t len) {
+  if (pattern->regex == NULL) {
+    return has_substring(body, len, pattern->literal, pattern->literalLen);
+  }
+  return dfa_search(dfa, (const uint8_t *)body, len);
+}
+
+typedef struct {
+  const BodyPattern *pattern;
+  const char *const *bodies;
+  const size_t *lens;
+  size_t n;
+  bool *isMatch;
+  atomic_size_t nextBlock;
+} GrepJob;
+
+typedef struct {
+  GrepJob *job;
+  Dfa *dfa;
+} GrepWorker;
+
+// Scan blocks of job's bodies until none are left.
+static void *grep_blocks(void *arg) {
+  GrepWorker *worker = arg;
+  GrepJob *job = worker->job;
+  for (;;) {
+    size_t lo = atomic_fetch_add(&job->nextBlock, 1) * GREP_BLOCK_BODIES;
+    if (lo >= job->n) break;
+    size_t hi = lo + GREP_BLOCK_BODIES < job->n ? lo + GREP_BLOCK_BODIES : job->n;
+    for (size_t i = lo; i < hi; i++) {
+      job->isMatch[i] =
+        body_matches(job->pattern, worker->dfa, job->bodies[i], job->lens[i]);
+    }
+  }
+  return NULL;
+}
+
+static size_t grep_threads(void) {
+  const char *env = getenv("CHAT_GREP_THREADS");
+  long n = (env != NULL && *env != '\0')
+    ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1) n = 1;
+  return n < GREP_MAX_THREADS ? n : GREP_MAX_THREADS;
+}
+
+// The calling thread scans blocks along with the others; if a thread
+// cannot be started (or given a DFA) the rest do its share.
+void grep_bodies(BodyPattern *pattern, const char *const bodies[],
+                 const size_t lens[], size_t n, bool isMatch[], ErrNum *err) {
+  *err = NO_ERR;
+  size_t bytes = 0;
+  for (size_t i = 0; i < n && bytes < GREP_PARALLEL_MIN_BYTES; i++) {
+    bytes += lens[i];
+  }
+  size_t nBlocks = (n + GREP_BLOCK_BODIES - 1) / GREP_BLOCK_BODIES;
+  size_t nThreads = bytes < GREP_PARALLEL_MIN_BYTES ? 1 : grep_threads();
+  if (nThreads > nBlocks) nThreads = nBlocks;
+  if (nThreads == 0) return;
+  if (pattern->regex != NULL) {
+    size_t i = 0;
+    while (i < nThreads &&
+           (pattern->dfas[i] != NULL ||
+            (pattern->dfas[i] = new_dfa(pattern->regex)) != NULL)) {
+      i++;
+    }
+    if (i == 0) {
+      *err = MEM_ERR;
+      return;
+    }
+    nThreads = i;
+  }
+  GrepJob job = {
+    .pattern = pattern, .bodies = bodies, .lens = lens, .n = n,
+    .isMatch = isMatch,
+  };
+  atomic_init(&job.nextBlock, 0);
+  GrepWorker workers[GREP_MAX_THREADS];
+  pthread_t threads[GREP_MAX_THREADS];
+  size_t nStarted = 1;
+  for (size_t i = 0; i < nThreads; i++) {
+    workers[i] = (GrepWorker) { .job = &job, .dfa = pattern->dfas[i] };
+  }
+  while (nStarted < nThreads &&
+         pthread_create(&threads[nStarted], NULL, grep_blocks,
+                        &workers[nStarted]) == 0) {
+    nStarted++;
+  }
+  grep_blocks(&workers[0]);
+  for (size_t i = 1; i < nStarted; i++) pthread_join(threads[i], NULL);
+}
+
+#ifdef TEST_GREP
+
+#include <assert.h>
+#include <stdio.h>
+
+static bool grep_one(const char *pattern, bool isRegex, const char *body) {
+  ErrNum err;
+  BodyPattern *p = compile_body_pattern(pattern, strlen(pattern), isRegex, &err);
+  assert(p != NULL);
+  const char *bodies[] = { body };
+  size_t lens[] = { strlen(body) };
+  bool isMatch;
+  grep_bodies(p, bodies, lens, 1, &isMatch, &err);
+  assert(err == NO_ERR);
+  free_body_pattern(p);
+  return isMatch;
+}
+
+static bool is_malformed(const char *pattern) {
+  ErrNum err;
+  BodyPattern *p = compile_body_pattern(pattern, strlen(pattern), true, &err);
+  free_body_pattern(p);
+  return p == NULL && err == NO_ERR;
+}
+
+// Check literal search against a naive search over random texts from
+// a small alphabet, then some regular expressions, then a large
+// parallel scan against the same bodies scanned one at a time.
+int
+main(int argc, const char *argv[])
+{
+  srand(argc > 1 ? atoi(argv[1]) : 1);
+  char text[200], needle[8];
+  for (int trial = 0; trial < 100000; trial++) {
+    size_t len = rand() % sizeof(text);
+    size_t n = 1 + rand() % (sizeof(needle) - 1);
+    for (size_t i = 0; i < len; i++) text[i] = 'a' + rand() % 3;
+    for (size_t i = 0; i < n; i++) needle[i] = 'a' + rand() % 3;
+    bool isFound = false;
+    for (size_t i = 0; i + n <= len && !isFound; i++) {
+      isFound = memcmp(text + i, needle, n) == 0;
+    }
+    assert(has_substring(text, len, needle, n) == isFound);
+  }
+
+  assert(grep_one("a.c", true, "xxabcxx"));
+  assert(!grep_one("a.c", true, "xxa\ncxx"));
+  assert(grep_one("^(ab|cd)+$", true, "x\nabcdab\ny"));
+  assert(!grep_one("^(ab|cd)+$", true, "x\nabcdabc\ny"));
+  assert(grep_one("[^a-c]\\d+", true, "abc123"));
+  assert(!grep_one("[^a-c]\\d+", true, "abc"));
+  assert(grep_one("colou?r", true, "the color red"));
+  assert(grep_one("\\$5", true, "costs $5"));
+  assert(grep_one("x$", true, "ab\nx\nc"));
+  assert(grep_one("", true, ""));
+  assert(!grep_one("^$", true, "a\n") && grep_one("^$", true, "a\n\nb"));
+  assert(grep_one("[]x]", true, "a]b"));
+  assert(grep_one("(a*)*b", true, "aaab"));
+  assert(!grep_one("(a|b)*c", false, "abc"));
+  assert(is_malformed("a(b") && is_malformed("a)") && is_malformed("*a"));
+  assert(is_malformed("[ab") && is_malformed("(a|") && is_malformed("a{2}"));
+  assert(grep_one("x|^b", true, "bc") && !grep_one("x|^b", true, "ab"));
+  assert(!grep_one("a|b$", true, "bc"));
+  assert(grep_one("(^|c)a$", true, "xca") && grep_one("^$", true, "\n\n"));
+  assert(is_malformed("[z-a]") && is_malformed("a\\"));
+
+  enum { N = 20000 };
+  static char *bodies[N];
+  static size_t lens[N];
+  static bool isMatch[N];
+  ErrNum err;
+  BodyPattern *p = compile_body_pattern("(ab|ba)c+[^a]", 13, true, &err);
+  for (size_t i = 0; i < N; i++) {
+    lens[i] = rand() % 100;
+    bodies[i] = malloc(lens[i]);
+    for (size_t j = 0; j < lens[i]; j++) bodies[i][j] = "abcd\n"[rand() % 5];
+  }
+  grep_bodies(p, (const char *const *)bodies, lens, N, isMatch, &err);
+  assert(err == NO_ERR);
+  for (size_t i = 0; i < N; i++) {
+    bool isOne;
+    grep_bodies(p, (const char *const *)&bodies[i], &lens[i], 1, &isOne, &err);
+    assert(isOne == isMatch[i]);
+    free(bodies[i]);
+  }
+  free_body_pattern(p);
+  printf("ok\n");
+  return 0;
+}
+
+#endif //#ifdef TEST_GREP
@@ -0,0 +1,62 @@
+#ifndef GREP_H_
+#define GREP_H_
+
+#include "errnum.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Patterns for searching message bodies.
+ *
+ *  A pattern is either a literal substring, searched for with SSE2
+ *  (comparing its first and last bytes against 16 positions at a
+ *  time and only then the rest), or a regular expression.  Regular
+ *  expressions are compiled to a Thompson NFA which is run as a DFA
+ *  built lazily, one state per set of NFA states reached, so each
+ *  byte of a body costs one table lookup once the states it needs
+ *  exist.
+ *
+ *  Both match within a line: a body matches if any of its lines
+ *  does.  The regular expression syntax is that of POSIX EREs without
+ *  bounds or backreferences:
+ *
+ *    c  \c  .  [set]  [^set]  \d \w \s \D \W \S  ^  $  (re)  re|re
+ *    re*  re+  re?
+ *
+ *  where ^ and $ match at the start and end of a line.
+ *
+ *  Large sets of bodies are scanned in parallel by up to
+ *  GREP_MAX_THREADS threads (environment variable CHAT_GREP_THREADS
+ *  overrides the default of one per CPU), each taking blocks of
+ *  GREP_BLOCK_BODIES bodies in turn.
+ */
+
+enum {
+  GREP_MAX_THREADS = 8,
+  GREP_BLOCK_BODIES = 256,
+  GREP_PARALLEL_MIN_BYTES = 256 * 1024,  // scan fewer bytes in one thread
+  GREP_MAX_REGEX_LEN = 1024,
+};
+
+typedef struct BodyPattern BodyPattern;
+
+/** Return the pattern text[len]: a regular expression if isRegex,
+ *  else a literal.  Returns NULL with *err set to MEM_ERR on failure,
+ *  or with *err set to NO_ERR if a regular expression is malformed or
+ *  longer than GREP_MAX_REGEX_LEN.
+ */
+BodyPattern *compile_body_pattern(const char *text, size_t len, bool isRegex,
+                                  ErrNum *err);
+
+/** Free pattern. */
+void free_body_pattern(BodyPattern *pattern);
+
+/** Set isMatch[i] to whether pattern occurs in bodies[i] (of lens[i]
+ *  bytes) for each i < n, using several threads if the bodies are
+ *  large enough.  Sets *err to MEM_ERR if no thread could be set up.
+ *  A pattern must not be used by two calls at once.
+ */
+void grep_bodies(BodyPattern *pattern, const char *const bodies[],
+                 const size_t lens[], size_t n, bool isMatch[], ErrNum *err);
+
+#endif //#ifndef GREP_H_
@@ -0,0 +1,479 @@
+#include "index.h"
+
+#include "dict.h"
+#include "epoch.h"
+#include "errnum.h"
+#include "postings.h"
+#include "roaring.h"
+#include "storemem.h"
+#include "word.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Items indexed by their ids
+typedef struct {
+  StoreRef items;       // StoreRef[itemsSize]
+  size_t nItems;
+  size_t itemsSize;
+} IdTable;
+
+// The dictionaries are created on first use.
+typedef struct {
+  StoreRef users;       // Dict: user name -> User
+  StoreRef rooms;       // Dict: room name -> Room
+  StoreRef topics;      // Dict: topic name -> Topic
+  IdTable usersById, roomsById, topicsById;
+} Indexes;
+
+static Indexes localIndexes;
+static Indexes *indexes = &localIndexes;
+
+static void free_room_topic(void *value);
+
+// Create the dictionary at *dict if it is not yet there.
+static void init_dict(StoreRef *dict, ErrNum *err) {
+  if (*err == NO_ERR && *dict == 0) *dict = store_ref(new_dict(err));
+}
+
+static void init_dicts(ErrNum *err) {
+  *err = NO_ERR;
+  init_dict(&indexes->users, err);
+  init_dict(&indexes->rooms, err);
+  init_dict(&indexes->topics, err);
+}
+
+static inline void *id_table_item(const IdTable *table, size_t id) {
+  return store_at(((StoreRef *)store_at(table->items))[id]);
+}
+
+// Reserve space for the next item of table and return its id.
+static size_t next_id(IdTable *table, ErrNum *err) {
+  enum { INIT_ID_TABLE_SIZE = 16 };
+  if (table->nItems == table->itemsSize) {
+    size_t newSize =
+      table->itemsSize == 0 ? INIT_ID_TABLE_SIZE : 2 * table->itemsSize;
+    StoreRef items = store_realloc(table->items,
+                                   table->itemsSize * sizeof(StoreRef),
+                                   newSize * sizeof(StoreRef), err);
+    if (*err != NO_ERR) return 0;
+    table->items = items;
+    table->itemsSize = newSize;
+  }
+  return table->nItems;
+}
+
+// Add item as the next (reserved) item of table.
+static void add_id_item(IdTable *table, const void *item) {
+  ((StoreRef *)store_at(table->items))[table->nItems++] = store_ref(item);
+}
+
+// Allocate n bytes followed by a copy of name's text, which is at
+// offset nameOffset.
+static void *alloc_named(size_t n, size_t nameOffset, const Word *name,
+                         ErrNum *err) {
+  char *p = store_ptr(store_alloc(n + name->len + 1, err));
+  if (*err != NO_ERR) return NULL;
+  memcpy(p + nameOffset, name->text, name->len);
+  p[nameOffset + name->len] = '\0';
+  return p;
+}
+
+User *intern_user(const Word *name, ErrNum *err) {
+  init_dicts(err);
+  if (*err != NO_ERR) return NULL;
+  Dict *users = store_at(indexes->users);
+  User *user = dict_get_hashed(users, name->text, name->len, name->hash);
+  if (user != NULL) return user;
+  size_t id = next_id(&indexes->usersById, err);
+  if (*err != NO_ERR) return NULL;
+  user = alloc_named(sizeof(User), offsetof(User, name), name, err);
+  if (*err != NO_ERR) return NULL;
+  dict_put_hashed(users, user->name, name->len, name->hash, user, err);
+  if (*err != NO_ERR) {
+    store_free(store_ref(user), sizeof(User) + name->len + 1);
+    return NULL;
+  }
+  user->id = id;
+  add_id_item(&indexes->usersById, user);
+  return user;
+}
+
+Room *intern_room(const Word *name, ErrNum *err) {
+  init_dicts(err);
+  if (*err != NO_ERR) return NULL;
+  Dict *rooms = store_at(indexes->rooms);
+  Room *room = dict_get_hashed(rooms, name->text, name->len, name->hash);
+  if (room != NULL) return room;
+  size_t id = next_id(&indexes->roomsById, err);
+  if (*err != NO_ERR) return NULL;
+  room = alloc_named(sizeof(Room), offsetof(Room, name), name, err);
+  if (*err != NO_ERR) return NULL;
+  init_postings(&room->msgs);
+  room->ttl = room->nDead = room->nExpired = 0;
+  room->topics = store_ref(new_dict(err));
+  if (*err == NO_ERR) {
+    dict_put_hashed(rooms, room->name, name->len, name->hash, room, err);
+  }
+  if (*err != NO_ERR) {
+    free_dict(store_ptr(room->topics), NULL);
+    store_free(store_ref(room), sizeof(Room) + name->len + 1);
+    return NULL;
+  }
+  room->id = id;
+  add_id_item(&indexes->roomsById, room);
+  return room;
+}
+
+Topic *intern_topic(const Word *name, ErrNum *err) {
+  init_dicts(err);
+  if (*err != NO_ERR) return NULL;
+  Dict *topics = store_at(indexes->topics);
+  Topic *topic = dict_get_hashed(topics, name->text, name->len, name->hash);
+  if (topic != NULL) return topic;
+  size_t id = next_id(&indexes->topicsById, err);
+  if (*err != NO_ERR) return NULL;
+  topic = alloc_named(sizeof(Topic), offsetof(Topic, name), name, err);
+  if (*err != NO_ERR) return NULL;
+  topic->len = name->len;
+  topic->hash = name->hash;
+  dict_put_hashed(topics, topic->name, topic->len, topic->hash, topic, err);
+  if (*err != NO_ERR) {
+    store_free(store_ref(topic), sizeof(Topic) + name->len + 1);
+    return NULL;
+  }
+  topic->id = id;
+  topic->nMsgs = 0;
+  add_id_item(&indexes->topicsById, topic);
+  return topic;
+}
+
+size_t n_users(void) {
+  return indexes->usersById.nItems;
+}
+
+size_t n_rooms(void) {
+  return indexes->roomsById.nItems;
+}
+
+size_t n_topics(void) {
+  return indexes->topicsById.nItems;
+}
+
+const User *user_by_id(size_t id) {
+  return id_table_item(&indexes->usersById, id);
+}
+
+Room *room_by_id(size_t id) {
+  return id_table_item(&indexes->roomsById, id);
+}
+
+const Topic *topic_by_id(size_t id) {
+  return id_table_item(&indexes->topicsById, id);
+}
+
+// Return the RoomTopic for topic within room, creating it if necessary.
+static RoomTopic *intern_room_topic(Room *room, const Topic *topic,
+                                    ErrNum *err) {
+  Dict *roomTopics = store_at(room->topics);
+  RoomTopic *roomTopic =
+    dict_get_hashed(roomTopics, topic->name, topic->len, topic->hash);
+  if (roomTopic != NULL) return roomTopic;
+  roomTopic = store_ptr(store_alloc(sizeof(RoomTopic), err));
+  if (*err != NO_ERR) return NULL;
+  roomTopic->topic = store_ref(topic);
+  init_postings(&roomTopic->postings);
+  roomTopic->bitmap = 0;
+  dict_put_hashed(roomTopics, topic->name, topic->len, topic->hash,
+                  roomTopic, err);
+  if (*err != NO_ERR) {
+    store_free(store_ref(roomTopic), sizeof(RoomTopic));
+    return NULL;
+  }
+  return roomTopic;
+}
+
+// Build the bitmap for roomTopic from its postings by merging them
+// with the room's postings to recover local indices.
+static void build_room_topic_bitmap(const Room *room, RoomTopic *roomTopic,
+                                    ErrNum *err) {
+  size_t n = postings_size(&roomTopic->postings);
+  size_t *locals = malloc(n * sizeof(size_t));
+  StoreRef bitmapRef = locals == NULL ? 0 : store_alloc(sizeof(Roaring), err);
+  if (locals == NULL || *err != NO_ERR) {
+    free(locals);
+    *err = MEM_ERR;
+    return;
+  }
+  Roaring *bitmap = store_at(bitmapRef);
+  init_roaring(bitmap);
+  PostingsIter roomIter, topicIter;
+  postings_iter_init(&roomIter, &room->msgs);
+  postings_iter_init(&topicIter, &roomTopic->postings);
+  size_t local = postings_size(&room->msgs);
+  size_t roomSeq, topicSeq;
+  for (size_t i = n; i > 0; i--) {
+    postings_iter_prev(&topicIter, &topicSeq);
+    do {
+      postings_iter_prev(&roomIter, &roomSeq);
+      local--;
+    } while (roomSeq > topicSeq);
+    locals[i - 1] = local;
+  }
+  for (size_t i = 0; i < n && *err == NO_ERR; i++) {
+    roaring_add(bitmap, locals[i], err);
+  }
+  free(locals);
+  if (*err != NO_ERR) {
+    free_roaring(bitmap);
+    store_free(bitmapRef, sizeof(Roaring));
+    return;
+  }
+  roomTopic->bitmap = bitmapRef;
+}
+
+void index_chat_msg(size_t seq, Room *room, Topic *const msgTopics[],
+                    size_t nTopics, ErrNum *err) {
+  *err = NO_ERR;
+  size_t local = postings_size(&room->msgs);
+  postings_append(&room->msgs, seq, err);
+  if (*err != NO_ERR) return;
+  for (size_t i = 0; i < nTopics; i++) {
+    Topic *topic = msgTopics[i];
+    RoomTopic *roomTopic = intern_room_topic(room, topic, err);
+    if (*err != NO_ERR) return;
+    size_t n = postings_size(&roomTopic->postings);
+    postings_append(&roomTopic->postings, seq, err);
+    if (*err != NO_ERR) return;
+    // duplicate topics within a message are only counted once
+    if (postings_size(&roomTopic->postings) == n) continue;
+    topic->nMsgs++;
+    if (roomTopic->bitmap != 0) {
+      roaring_add(store_at(roomTopic->bitmap), local, err);
+    }
+    else if (n + 1 >= ROOM_TOPIC_DENSE_MIN &&
+             (n + 1) * ROOM_TOPIC_DENSE_DIVISOR >= local + 1) {
+      build_room_topic_bitmap(room, roomTopic, err);
+    }
+    if (*err != NO_ERR) return;
+  }
+}
+
+void unindex_chat_msg(size_t roomId, const size_t topicIds[], size_t nTopics) {
+  Room *room = room_by_id(roomId);
+  room->nDead++;
+  for (size_t i = 0; i < nTopics; i++) {
+    // duplicate topics within a message were only counted once
+    bool isDup = false;
+    for (size_t j = 0; j < i && !isDup; j++) isDup = topicIds[j] == topicIds[i];
+    if (isDup) continue;
+    Topic *topic = id_table_item(&indexes->topicsById, topicIds[i]);
+    topic->nMsgs--;
+  }
+}
+
+// Set *live to the entries of postings for which isDead() is false.
+// *live is initialized even on failure, so it must always be freed.
+static void filter_postings(const Postings *postings,
+                            bool (*isDead)(size_t seq), Postings *live,
+                            ErrNum *err) {
+  *err = NO_ERR;
+  init_postings(live);
+  PostingsIter iter;
+  postings_iter_init(&iter, postings);
+  size_t n = postings_size(postings);
+  for (size_t pos = 0; pos < n && *err == NO_ERR; pos++) {
+    size_t seq;
+    postings_iter_at(&iter, pos, &seq);
+    if (!isDead(seq)) postings_append(live, seq, err);
+  }
+}
+
+// The old postings, bitmaps and emptied topics of a compacted room,
+// retired until no pinned reader can be using them
+typedef struct {
+  Retired retired;
+  size_t nTopics;
+  Postings *postings;   // [nTopics] of the room's topics, then the room's
+  StoreRef *bitmaps;    // [nTopics], 0 for topics without one
+  RoomTopic **emptied;  // [nEmptied] topics left without messages
+  size_t nEmptied;
+} RetiredRoomIndex;
+
+// Allocate a RetiredRoomIndex with room for nTopics topics, but
+// holding nothing yet.
+static RetiredRoomIndex *new_retired_room_index(size_t nTopics, ErrNum *err) {
+  RetiredRoomIndex *old = malloc(sizeof(RetiredRoomIndex));
+  Postings *postings = malloc((nTopics + 1) * sizeof(Postings));
+  StoreRef *bitmaps = malloc((nTopics + 1) * sizeof(StoreRef));
+  RoomTopic **emptied = malloc((nTopics + 1) * sizeof(RoomTopic *));
+  if (old == NULL || postings == NULL || bitmaps == NULL || emptied == NULL) {
+    free(old);
+    free(postings);
+    free(bitmaps);
+    free(emptied);
+    *err = MEM_ERR;
+    return NULL;
+  }
+  *old = (RetiredRoomIndex) {
+    .nTopics = 0, .postings = postings, .bitmaps = bitmaps,
+    .emptied = emptied, .nEmptied = 0,
+  };
+  init_postings(&old->postings[0]);
+  return old;
+}
+
+// Free old along with the postings, bitmaps and topics it holds.
+static void free_retired_room_index(Retired *retired) {
+  RetiredRoomIndex *old = (RetiredRoomIndex *)retired;
+  for (size_t i = 0; i < old->nTopics; i++) {
+    free_postings(&old->postings[i]);
+    if (old->bitmaps[i] != 0) {
+      free_roaring(store_at(old->bitmaps[i]));
+      store_free(old->bitmaps[i], sizeof(Roaring));
+    }
+  }
+  free_postings(&old->postings[old->nTopics]);
+  for (size_t i = 0; i < old->nEmptied; i++) free_room_topic(old->emptied[i]);
+  free(old->postings);
+  free(old->bitmaps);
+  free(old->emptied);
+  free(old);
+}
+
+// All the new postings are built before any old ones are replaced, so
+// that running out of memory leaves the room as it was.  Local indices
+// change when dead messages are dropped, so bitmaps are rebuilt from
+// scratch; failing to rebuild one only loses that optimization.  The
+// old postings and bitmaps and any emptied topics are retired (see
+// epoch.h) rather than freed.
+void compact_room_index(Room *room, bool (*isDead)(size_t seq), ErrNum *err) {
+  *err = NO_ERR;
+  Dict *topics = store_at(room->topics);
+  size_t nTopics = dict_size(topics);
+  RoomTopic **roomTopics = malloc((nTopics + 1) * sizeof(RoomTopic *));
+  Postings *live = malloc((nTopics + 1) * sizeof(Postings));
+  RetiredRoomIndex *old = new_retired_room_index(nTopics, err);
+  if (roomTopics == NULL || live == NULL || old == NULL) {
+    free(roomTopics);
+    free(live);
+    if (old != NULL) free_retired_room_index(&old->retired);
+    *err = MEM_ERR;
+    return;
+  }
+  dict_values(topics, (void **)roomTopics);
+  filter_postings(&room->msgs, isDead, &live[nTopics], err);
+  size_t nFiltered = 0;
+  for (; *err == NO_ERR && nFiltered < nTopics; nFiltered++) {
+    filter_postings(&roomTopics[nFiltered]->postings, isDead,
+                    &live[nFiltered], err);
+  }
+  if (*err != NO_ERR) {
+    free_postings(&live[nTopics]);
+    for (size_t i = 0; i < nFiltered; i++) free_postings(&live[i]);
+    free(roomTopics);
+    free(live);
+    free_retired_room_index(&old->retired);
+    return;
+  }
+
+  old->nTopics = nTopics;
+  old->postings[nTopics] = room->msgs;
+  room->msgs = live[nTopics];
+  room->nDead = room->nExpired = 0;
+  size_t roomSize = postings_size(&room->msgs);
+  for (size_t i = 0; i < nTopics; i++) {
+    RoomTopic *roomTopic = roomTopics[i];
+    old->postings[i] = roomTopic->postings;
+    roomTopic->postings = live[i];
+    old->bitmaps[i] = roomTopic->bitmap;
+    roomTopic->bitmap = 0;
+    size_t n = postings_size(&roomTopic->postings);
+    if (n == 0) {
+      const Topic *topic = store_at(roomTopic->topic);
+      dict_remove_hashed(topics, topic->name, topic->len, topic->hash);
+      old->emptied[old->nEmptied++] = roomTopic;
+    }
+    else if (n >= ROOM_TOPIC_DENSE_MIN &&
+             n * ROOM_TOPIC_DENSE_DIVISOR >= roomSize) {
+      ErrNum bitmapErr;
+      build_room_topic_bitmap(room, roomTopic, &bitmapErr);
+    }
+  }
+  retire(&old->retired, free_retired_room_index);
+  free(roomTopics);
+  free(live);
+}
+
+Room *find_room(const Word *name) {
+  return indexes->rooms == 0 ? NULL
+    : dict_get_hashed(store_at(indexes->rooms), name->text, name->len,
+                      name->hash);
+}
+
+Topic *find_topic(const Word *name) {
+  return indexes->topics == 0 ? NULL
+    : dict_get_hashed(store_at(indexes->topics), name->text, name->len,
+                      name->hash);
+}
+
+// The per-room dictionaries are keyed by the Topic's own name, so the
+// lookup matches on pointer identity without comparing bytes.
+const RoomTopic *find_room_topic(const Room *room, const Topic *topic) {
+  return dict_get_hashed(store_at(room->topics), topic->name, topic->len,
+                         topic->hash);
+}
+
+StoreRef share_indexes(ErrNum *err) {
+  StoreRef ref = store_alloc(sizeof(Indexes), err);
+  if (*err != NO_ERR) return 0;
+  indexes = store_at(ref);
+  *indexes = localIndexes;
+  return ref;
+}
+
+void attach_indexes(StoreRef ref) {
+  indexes = store_at(ref);
+}
+
+static void free_room_topic(void *value) {
+  RoomTopic *roomTopic = value;
+  free_postings(&roomTopic->postings);
+  if (roomTopic->bitmap != 0) {
+    free_roaring(store_at(roomTopic->bitmap));
+    store_free(roomTopic->bitmap, sizeof(Roaring));
+  }
+  store_free(store_ref(roomTopic), sizeof(RoomTopic));
+}
+
+static void free_room(void *value) {
+  Room *room = value;
+  free_dict(store_ptr(room->topics), free_room_topic);
+  free_postings(&room->msgs);
+  store_free(store_ref(room), sizeof(Room) + strlen(room->name) + 1);
+}
+
+static void free_topic(void *value) {
+  Topic *topic = value;
+  store_free(store_ref(topic), sizeof(Topic) + topic->len + 1);
+}
+
+static void free_user(void *value) {
+  User *user = value;
+  store_free(store_ref(user), sizeof(User) + strlen(user->name) + 1);
+}
+
+static void free_id_table(IdTable *table) {
+  store_free(table->items, table->itemsSize * sizeof(StoreRef));
+  *table = (IdTable) { 0 };
+}
+
+void free_indexes(void) {
+  free_dict(store_ptr(indexes->users), free_user);
+  free_dict(store_ptr(indexes->rooms), free_room);
+  free_dict(store_ptr(indexes->topics), free_topic);
+  indexes->users = indexes->rooms = indexes->topics = 0;
+  free_id_table(&indexes->usersById);
+  free_id_table(&indexes->roomsById);
+  free_id_table(&indexes->topicsById);
+}
@@ -0,0 +1,135 @@
+#ifndef INDEX_H_
+#define INDEX_H_
+
+#include "dict.h"
+#include "errnum.h"
+#include "postings.h"
+#include "roaring.h"
+#include "storemem.h"
+#include "word.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Interned names and room and topic indexes over the chat
+ *  messages.  Every message is identified by its sequence number (its
+ *  position in the order in which messages were added).  Users, rooms
+ *  and topics are each numbered densely from 0 in the order in which
+ *  they were first seen; message records refer to them by these ids.
+ *  Everything here is in store memory (see storemem.h), the names
+ *  inline in the structures they name.
+ */
+
+/** A user who has added some message. */
+typedef struct {
+  size_t id;
+  char name[];
+} User;
+
+/** A topic which has been specified in some added message. */
+typedef struct {
+  size_t len;           // length of name
+  uint64_t hash;        // word_hash() of name
+  size_t id;
+  size_t nMsgs;         // # of messages (in any room) with this topic
+  char name[];
+} Topic;
+
+/** The messages within a room having a particular topic.  Once a
+ *  topic becomes dense within its room (see ROOM_TOPIC_DENSE_*), its
+ *  messages are also kept in a bitmap over their local indices
+ *  (positions within the room).
+ */
+typedef struct {
+  StoreRef topic;       // the Topic
+  Postings postings;    // sequence numbers of messages
+  StoreRef bitmap;      // Roaring of local indices of messages; 0
+                        // until dense
+} RoomTopic;
+
+/** Return roomTopic's bitmap, NULL if it has none. */
+static inline const Roaring *room_topic_bitmap(const RoomTopic *roomTopic) {
+  return store_ptr(roomTopic->bitmap);
+}
+
+enum {
+  ROOM_TOPIC_DENSE_MIN = 256,   // min # of messages for a bitmap
+  ROOM_TOPIC_DENSE_DIVISOR = 16, // min fraction of room for a bitmap
+};
+
+/** A room which has been specified in some added message.  msgs is
+ *  the room's own append-only list of its messages, indexed by local
+ *  position (see postings_iter_at()) and walked newest-first, so a
+ *  query never visits other rooms' messages: an unfiltered query for
+ *  N messages decodes just N records (EXPLAIN's "records"), as dead
+ *  ones are skipped on their tombstones.  Deleted messages stay in its
+ *  postings until compact_room_index().
+ */
+typedef struct {
+  size_t id;
+  Postings msgs;        // all messages in this room
+  StoreRef topics;      // Dict: topic name -> RoomTopic
+  size_t ttl;           // seconds messages are kept; 0 for ever
+  size_t nDead;         // # of deleted messages in msgs
+  size_t nExpired;      // # of oldest msgs already checked for expiry
+  char name[];
+} Room;
+
+/** Return the User, Room or Topic named by name, creating it if
+ *  necessary.  Sets *err to MEM_ERR on failure.
+ */
+User *intern_user(const Word *name, ErrNum *err);
+Room *intern_room(const Word *name, ErrNum *err);
+Topic *intern_topic(const Word *name, ErrNum *err);
+
+/** Return the User, Room or Topic with the given id. */
+const User *user_by_id(size_t id);
+Room *room_by_id(size_t id);
+const Topic *topic_by_id(size_t id);
+
+/** Add message seq in room with topics[nTopics] to the room and topic
+ *  indexes.  Sets *err to MEM_ERR on failure.
+ */
+void index_chat_msg(size_t seq, Room *room, Topic *const topics[],
+                    size_t nTopics, ErrNum *err);
+
+/** Note that message seq (in room roomId with topicIds[nTopics]) has
+ *  been deleted.  Its index entries are only dropped by the next
+ *  compact_room_index() of its room.
+ */
+void unindex_chat_msg(size_t roomId, const size_t topicIds[], size_t nTopics);
+
+/** Rebuild room's postings and bitmaps without the messages for which
+ *  isDead() is true, dropping room topics left with no messages.  On
+ *  failure sets *err to MEM_ERR and leaves room unchanged.
+ */
+void compact_room_index(Room *room, bool (*isDead)(size_t seq), ErrNum *err);
+
+/** Return room named by word, NULL if no message was added to it. */
+Room *find_room(const Word *name);
+
+/** Return topic named by word, NULL if no message specified it. */
+Topic *find_topic(const Word *name);
+
+/** Return messages in room having topic; NULL if none. */
+const RoomTopic *find_room_topic(const Room *room, const Topic *topic);
+
+/** Return # of distinct users, rooms and topics. */
+size_t n_users(void);
+size_t n_rooms(void);
+size_t n_topics(void);
+
+/** Move the (empty) indexes into store memory and return the
+ *  reference to them, by which another process mapping the same store
+ *  memory can use them with attach_indexes().  Sets *err to MEM_ERR on
+ *  failure.
+ */
+StoreRef share_indexes(ErrNum *err);
+
+/** Use the indexes shared at ref for reading only. */
+void attach_indexes(StoreRef ref);
+
+/** Free all memory used by the indexes. */
+void free_indexes(void);
+
+#endif //#ifndef INDEX_H_
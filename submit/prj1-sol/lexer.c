@@ -0,0 +1,92 @@
+#include "lexer.h"
+
+#include "chartab.h"
+#include "word.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// The terminating NUL delimits a word like whitespace so that the
+// scan loop needs one test.
+enum { CHAR_DELIM = CHAR_SPACE | CHAR_END };
+
+// The kind of a word is determined by its first byte, except that a
+// word starting with a digit is only a COUNT if all its bytes are.
+static const uint8_t firstKind[256] = {
+  ['@'] = WORD_USER,
+  ['#'] = WORD_TOPIC,
+  ['a' ... 'z'] = WORD_ROOM,
+  ['A' ... 'Z'] = WORD_ROOM,
+  ['0' ... '9'] = WORD_COUNT,
+};
+
+void init_lexer(Lexer *lexer, char *line) {
+  lexer->cursor = line;
+}
+
+// Return p advanced past any whitespace.
+static unsigned char *skip_space(unsigned char *p) {
+  while (char_is_space(*p)) p++;
+  return p;
+}
+
+bool lex_keyword(Lexer *lexer, const char *keyword) {
+  unsigned char *p = skip_space((unsigned char *)lexer->cursor);
+  for (; *keyword != '\0'; keyword++, p++) {
+    if (char_fold(*p) != (unsigned char)*keyword) return false;
+  }
+  if (!(charClass[*p] & CHAR_DELIM)) return false;
+  lexer->cursor = (char *)p;
+  return true;
+}
+
+int lex_command(Lexer *lexer) {
+  unsigned char *p = skip_space((unsigned char *)lexer->cursor);
+  int c = *p;
+  lexer->cursor = (char *)(c == '\0' ? p : p + 1);
+  return c;
+}
+
+bool lex_word(Lexer *lexer, Word *word) {
+  unsigned char *p = skip_space((unsigned char *)lexer->cursor);
+  if (*p == '\0') {
+    lexer->cursor = (char *)p;
+    return false;
+  }
+  unsigned char *start = p;
+  WordKind kind = firstKind[*p];
+  bool isNumber = true;
+  size_t count = 0;
+  uint64_t h = WORD_HASH_BASIS;
+  for (; !(charClass[*p] & CHAR_DELIM); p++) {
+    unsigned char c = char_fold(*p);
+    *p = c;
+    h = word_hash_step(h, c);
+    if (char_is_digit(c)) {
+      size_t d = c - '0';
+      count = (count > (SIZE_MAX - d)/10) ? SIZE_MAX : 10*count + d;
+    }
+    else {
+      isNumber = false;
+    }
+  }
+  if (kind == WORD_COUNT && !isNumber) kind = WORD_BAD_COUNT;
+  word->text = (char *)start;
+  word->len = p - start;
+  word->hash = h;
+  word->kind = kind;
+  word->count = count;
+  lexer->cursor = (char *)(*p == '\0' ? p : p + 1);
+  *p = '\0';
+  return true;
+}
+
+char *lex_rest(Lexer *lexer, size_t *len) {
+  char *rest = lexer->cursor;
+  size_t n = strlen(rest);
+  if (n > 0 && rest[n - 1] == '\n') rest[--n] = '\0';
+  lexer->cursor = rest + n;
+  *len = n;
+  return rest;
+}
@@ -0,0 +1,43 @@
+#ifndef LEXER_H_
+#define LEXER_H_
+
+#include "word.h"
+
+#include <stdbool.h>
+
+/** Single-pass lexer for a command line.  Words are delimited by any
+ *  whitespace (as for isspace() in the "C" locale).  Each word is
+ *  lower-cased, hashed and classified as it is scanned and is then
+ *  NUL-terminated in place; no other bytes of the line are moved or
+ *  copied, so the words stay valid as long as the line.
+ */
+typedef struct {
+  char *cursor;         // next byte to scan
+} Lexer;
+
+/** Start lexing the NUL-terminated line. */
+void init_lexer(Lexer *lexer, char *line);
+
+/** If the next word of the line is keyword (which must be lower-case)
+ *  in any case, consume it and return true; otherwise return false
+ *  leaving the line untouched.
+ */
+bool lex_keyword(Lexer *lexer, const char *keyword);
+
+/** Consume and return the next non-whitespace character of the line,
+ *  which identifies the command; returns '\0' at the end of the line.
+ */
+int lex_command(Lexer *lexer);
+
+/** Set *word to the next word of the line and return true; return
+ *  false when the line is exhausted.
+ */
+bool lex_word(Lexer *lexer, Word *word);
+
+/** Consume and return the rest of the line (after the whitespace byte
+ *  ending the last word) exactly as is, less any trailing newline,
+ *  setting *len to its length.
+ */
+char *lex_rest(Lexer *lexer, size_t *len);
+
+#endif //#ifndef LEXER_H_
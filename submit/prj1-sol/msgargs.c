@@ -1,11 +1,11 @@
 #include "msgargs.h"
 
+#include "chartab.h"
 #include "errnum.h"
 
 #include <errors.h>
 
 #include <assert.h>
-#include <ctype.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -26,8 +26,7 @@ get_args(char *line, XMsgArgs *msgArgs, ErrNum *err)
   bool lastIsSpace = true;
   size_t nArgs = 0;
   for (char *p = line; *p != '\0'; p++) {
-    char c = *p;
-    if (isspace(c)) {
+    if (char_is_space(*p)) {
       if (!lastIsSpace) *p = '\0';
       lastIsSpace = true;
     }
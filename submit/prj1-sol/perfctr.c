@@ -0,0 +1,151 @@
+#include "perfctr.h"
+
+#include "errnum.h"
+
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+  PERF_CYCLES,
+  PERF_INSTRS,
+  PERF_LLC_MISSES,
+  PERF_BRANCH_MISSES,
+  N_PERF_EVENTS
+};
+
+static const uint64_t eventConfigs[N_PERF_EVENTS] = {
+  [PERF_CYCLES] = PERF_COUNT_HW_CPU_CYCLES,
+  [PERF_INSTRS] = PERF_COUNT_HW_INSTRUCTIONS,
+  [PERF_LLC_MISSES] = PERF_COUNT_HW_CACHE_MISSES,
+  [PERF_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+static const char *cmdNames[N_PERF_CMDS] = {
+  [PERF_CMD_ADD] = "ADD",
+  [PERF_CMD_QUERY] = "QUERY",
+  [PERF_CMD_OTHER] = "OTHER",
+};
+
+// Layout of a read() of a group opened with PERF_FORMAT_GROUP
+typedef struct {
+  uint64_t nr;
+  uint64_t values[N_PERF_EVENTS];
+} GroupRead;
+
+static bool isEnabled = false;
+static pthread_mutex_t totalsLock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t totals[N_PERF_CMDS][N_PERF_EVENTS];     // of closed groups
+static size_t nCmds[N_PERF_CMDS];
+
+// The calling thread's group, counted into totals when it is closed
+static _Thread_local bool isOpen = false;
+static _Thread_local int fds[N_PERF_EVENTS];    // fds[0] is the leader
+static _Thread_local GroupRead start;
+static _Thread_local uint64_t threadTotals[N_PERF_CMDS][N_PERF_EVENTS];
+static _Thread_local size_t threadCmds[N_PERF_CMDS];
+
+static int open_event(uint64_t config, int groupFd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.read_format = PERF_FORMAT_GROUP;
+  attr.disabled = groupFd == -1;        //leader starts the group
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+// Open a group on the calling thread, returning false on failure
+static bool open_group(void) {
+  for (int i = 0; i < N_PERF_EVENTS; i++) {
+    fds[i] = open_event(eventConfigs[i], i == 0 ? -1 : fds[0]);
+    if (fds[i] < 0) {
+      for (int j = 0; j < i; j++) close(fds[j]);
+      return false;
+    }
+  }
+  ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  memset(threadTotals, 0, sizeof(threadTotals));
+  memset(threadCmds, 0, sizeof(threadCmds));
+  isOpen = true;
+  return true;
+}
+
+void init_perf_counters(ErrNum *err) {
+  *err = NO_ERR;
+  const char *env = getenv("CHAT_PERF");
+  if (env == NULL || *env == '\0') return;
+  if (!open_group()) {
+    *err = IO_ERR;
+    return;
+  }
+  memset(totals, 0, sizeof(totals));
+  memset(nCmds, 0, sizeof(nCmds));
+  isEnabled = true;
+}
+
+void open_thread_perf_counters(void) {
+  if (isEnabled && !isOpen) open_group();
+}
+
+void close_thread_perf_counters(void) {
+  if (!isOpen) return;
+  pthread_mutex_lock(&totalsLock);
+  for (int c = 0; c < N_PERF_CMDS; c++) {
+    for (int i = 0; i < N_PERF_EVENTS; i++) {
+      totals[c][i] += threadTotals[c][i];
+    }
+    nCmds[c] += threadCmds[c];
+  }
+  pthread_mutex_unlock(&totalsLock);
+  for (int i = 0; i < N_PERF_EVENTS; i++) close(fds[i]);
+  isOpen = false;
+}
+
+static bool read_group(GroupRead *group) {
+  return read(fds[0], group, sizeof(GroupRead)) == sizeof(GroupRead);
+}
+
+void perf_begin(void) {
+  if (!isOpen) return;
+  if (!read_group(&start)) start.nr = 0;
+}
+
+void perf_end(PerfCmd cmd) {
+  if (!isOpen || cmd == PERF_CMD_NONE || start.nr == 0) return;
+  GroupRead end;
+  if (!read_group(&end)) return;
+  for (int i = 0; i < N_PERF_EVENTS; i++) {
+    threadTotals[cmd][i] += end.values[i] - start.values[i];
+  }
+  threadCmds[cmd]++;
+}
+
+void close_perf_counters(FILE *out) {
+  if (!isEnabled) return;
+  close_thread_perf_counters();
+  fprintf(out, "%-6s %10s %12s %12s %6s %12s %12s\n", "cmd", "count",
+          "cycles/cmd", "instrs/cmd", "IPC", "LLC-miss/cmd", "br-miss/cmd");
+  for (int c = PERF_CMD_NONE + 1; c < N_PERF_CMDS; c++) {
+    if (nCmds[c] == 0) continue;
+    const uint64_t *t = totals[c];
+    double n = nCmds[c];
+    fprintf(out, "%-6s %10zu %12.0f %12.0f %6.2f %12.2f %12.2f\n",
+            cmdNames[c], nCmds[c], t[PERF_CYCLES]/n, t[PERF_INSTRS]/n,
+            t[PERF_CYCLES] == 0 ? 0.0 : (double)t[PERF_INSTRS]/t[PERF_CYCLES],
+            t[PERF_LLC_MISSES]/n, t[PERF_BRANCH_MISSES]/n);
+  }
+  isEnabled = false;
+}
@@ -0,0 +1,63 @@
+#ifndef PERFCTR_H_
+#define PERFCTR_H_
+
+#include "errnum.h"
+
+#include <stdio.h>
+
+/** Opt-in hardware performance counters per command type.
+ *
+ *  Enabled by setting environment variable CHAT_PERF (to anything
+ *  non-empty).  A group of perf_event_open(2) counters for cycles,
+ *  instructions, LLC misses and branch misses is then opened on the
+ *  calling (serving) thread, counting user-space only.  The deltas
+ *  between perf_begin() and perf_end() are accumulated per command
+ *  type and reported by close_perf_counters().  When not enabled all
+ *  the functions are cheap no-ops.
+ *
+ *  A group only counts the thread which opened it, so other threads
+ *  running commands (as server connections do, see server.h) open
+ *  their own with open_thread_perf_counters(); their counts are added
+ *  to the totals when they close them.
+ */
+
+typedef enum {
+  PERF_CMD_NONE,        // no command in progress
+  PERF_CMD_ADD,
+  PERF_CMD_QUERY,
+  PERF_CMD_OTHER,       // bad or ignored commands
+  N_PERF_CMDS
+} PerfCmd;
+
+/** Open the counters if enabled by the environment.  Sets *err to
+ *  IO_ERR if they cannot be opened (as when the kernel does not allow
+ *  or support them); the counters are then left disabled.
+ */
+void init_perf_counters(ErrNum *err);
+
+/** Open counters on the calling thread, if enabled and not already
+ *  open there.  A thread whose counters cannot be opened is not
+ *  counted.
+ */
+void open_thread_perf_counters(void);
+
+/** Add the counts of the calling thread's counters to the totals and
+ *  close them; a no-op if it has none open.
+ */
+void close_thread_perf_counters(void);
+
+/** Start counting a command on the calling thread. */
+void perf_begin(void);
+
+/** Attribute the counts since perf_begin() to cmd; a no-op for
+ *  PERF_CMD_NONE.
+ */
+void perf_end(PerfCmd cmd);
+
+/** Write per-command-type totals (of the calling thread and of every
+ *  thread which has closed its counters), IPC and miss rates to out
+ *  and close the counters.
+ */
+void close_perf_counters(FILE *out);
+
+#endif //#ifndef PERFCTR_H_
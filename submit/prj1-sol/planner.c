@@ -0,0 +1,138 @@
+#include "planner.h"
+
+#include "filter.h"
+#include "index.h"
+#include "postings.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+
+// Relative costs used by the planner.  Examining a message means
+// dereferencing it and comparing its topics, which is usually a cache
+// miss; stepping through a posting list is a sequential read.
+enum {
+  POSTING_COST = 1,
+  RECORD_COST = 4,
+  BITMAP_WORD_COST = 1,
+};
+
+// must be in same order as PlanKind enum
+static const char *planNames[] = {
+  "EMPTY",
+  "ROOM_SCAN",
+  "TOPIC_INTERSECT",
+  "BITMAP_AND",
+  "TOPIC_FILTER",
+  "MERGE",
+};
+
+const char *plan_kind_to_string(PlanKind kind) {
+  assert(kind < sizeof(planNames)/sizeof(planNames[0]));
+  return planNames[kind];
+}
+
+// Cost model: assuming topics occur independently, a message in the
+// room matches with probability sel, the product over the clauses of
+// card/roomCard (1 - card/roomCard for a negated clause), where card
+// is the clause's size capped at roomCard.
+//
+//   ROOM_SCAN examines about count/sel messages (capped at the room
+//   size), each costing RECORD_COST plus one check per query topic.
+//
+//   TOPIC_INTERSECT (for a plain AND of topics) is driven by the
+//   rarest posting list: for the fraction count/matches of it (capped
+//   at all of it) each entry costs a galloping search of
+//   log2(1 + card/minCard) steps in each other list.  Each result is
+//   then fetched.
+//
+//   TOPIC_FILTER is the same for any other filter, driven by the
+//   smallest clause (all of whose lists are merged) or by the room's
+//   own list if every clause is negated; the lists of the other
+//   clauses, negated or not, are each searched.
+//
+//   BITMAP_AND (only for a plain AND where every topic has a bitmap)
+//   ANDs 64 local indices per word for the same fraction of the room,
+//   but always at least one whole container, and each result is then
+//   fetched.
+void plan_query(QueryPlan *plan, const Room *room,
+                const RoomTopic *roomTopics[], const FilterClause clauses[],
+                size_t nClauses, size_t count) {
+  size_t nTopics =
+    nClauses == 0 ? 0 : clauses[nClauses - 1].first + clauses[nClauses - 1].n;
+  plan->count = count;
+  plan->nTopics = nTopics;
+  plan->roomCard = room == NULL ? 0 : postings_size(&room->msgs);
+  plan->minTopicCard = plan->sumTopicCard = 0;
+  plan->scanCost = plan->intersectCost = plan->bitmapCost = 0;
+
+  bool isConjunction = is_conjunction(clauses, nClauses);
+  bool isEmpty = plan->roomCard == 0 || count == 0;
+  bool hasBitmaps = nTopics > 0 && isConjunction;
+  double sel = 1.0;
+  size_t driver = nClauses;     // smallest clause not negated, if any
+  for (size_t c = 0; c < nClauses; c++) {
+    size_t clauseCard = 0;
+    size_t end = clauses[c].first + clauses[c].n;
+    for (size_t i = clauses[c].first; i < end; i++) {
+      size_t card =
+        roomTopics[i] == NULL ? 0 : postings_size(&roomTopics[i]->postings);
+      hasBitmaps = hasBitmaps && card > 0 &&
+        room_topic_bitmap(roomTopics[i]) != NULL;
+      clauseCard += card;
+    }
+    plan->sumTopicCard += clauseCard;
+    size_t card = clauseCard < plan->roomCard ? clauseCard : plan->roomCard;
+    if (clauses[c].isNegated) {
+      if (plan->roomCard > 0) sel *= 1.0 - (double)card / plan->roomCard;
+      continue;
+    }
+    if (driver == nClauses || clauseCard < plan->minTopicCard) {
+      driver = c;
+      plan->minTopicCard = clauseCard;
+    }
+    if (card == 0) isEmpty = true;
+    else sel *= (double)card / plan->roomCard;
+  }
+  if (isEmpty) {
+    plan->kind = PLAN_EMPTY;
+    return;
+  }
+
+  double matches = sel * plan->roomCard;
+  double scanned = count / sel;
+  if (scanned > plan->roomCard) scanned = plan->roomCard;
+  plan->scanCost = scanned * (RECORD_COST + nTopics);
+  plan->kind = PLAN_ROOM_SCAN;
+  if (nTopics == 0) return;
+
+  double fraction = count / matches;
+  if (fraction > 1.0) fraction = 1.0;
+  double fetched = count < matches ? count : matches;
+  size_t driverCard = driver == nClauses ? plan->roomCard : plan->minTopicCard;
+  double probes = 1.0;
+  for (size_t c = 0; c < nClauses; c++) {
+    if (c == driver) continue;
+    size_t end = clauses[c].first + clauses[c].n;
+    for (size_t i = clauses[c].first; i < end; i++) {
+      if (roomTopics[i] == NULL) continue;
+      size_t card = postings_size(&roomTopics[i]->postings);
+      probes += log2(1.0 + (double)card / driverCard);
+    }
+  }
+  plan->intersectCost = fraction * driverCard * probes * POSTING_COST +
+    fetched * RECORD_COST;
+  if (plan->intersectCost < plan->scanCost) {
+    plan->kind = isConjunction ? PLAN_TOPIC_INTERSECT : PLAN_TOPIC_FILTER;
+  }
+  if (!hasBitmaps) return;
+
+  double bits = fraction * plan->roomCard;
+  double minBits = plan->roomCard < 65536 ? plan->roomCard : 65536;
+  if (bits < minBits) bits = minBits;
+  plan->bitmapCost =
+    bits / 64 * nTopics * BITMAP_WORD_COST + fetched * RECORD_COST;
+  double best = plan->kind == PLAN_ROOM_SCAN
+    ? plan->scanCost : plan->intersectCost;
+  if (plan->bitmapCost < best) plan->kind = PLAN_BITMAP_AND;
+}
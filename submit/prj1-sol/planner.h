@@ -0,0 +1,48 @@
+#ifndef PLANNER_H_
+#define PLANNER_H_
+
+#include "filter.h"
+#include "index.h"
+#include "postings.h"
+
+#include <stddef.h>
+
+/** Strategies for evaluating a QUERY. */
+typedef enum {
+  PLAN_EMPTY,           // room or some topic has no messages: no results
+  PLAN_ROOM_SCAN,       // walk room newest-first, checking topics per msg
+  PLAN_TOPIC_INTERSECT, // intersect the room's topic posting lists
+  PLAN_BITMAP_AND,      // AND the room's topic bitmaps
+  PLAN_TOPIC_FILTER,    // union, intersect and subtract topic posting lists
+  PLAN_MERGE,           // merge per-room plans of a multi-room query
+} PlanKind;
+
+/** The plan chosen for a QUERY along with the cardinalities and
+ *  estimated costs which led to that choice.
+ */
+typedef struct {
+  PlanKind kind;
+  size_t count;         // COUNT requested by query
+  size_t nTopics;       // # of topics in query
+  size_t roomCard;      // # of messages in room
+  size_t minTopicCard;  // size of smallest clause (0 if all negated)
+  size_t sumTopicCard;  // total size of room-topic posting lists
+  double scanCost;      // estimated cost of PLAN_ROOM_SCAN
+  double intersectCost; // of PLAN_TOPIC_INTERSECT or PLAN_TOPIC_FILTER
+  double bitmapCost;    // estimated cost of PLAN_BITMAP_AND
+} QueryPlan;
+
+/** Choose the cheapest plan for retrieving the last count messages in
+ *  room (NULL if unknown) matching the topic filter clauses[nClauses]
+ *  (see filter.h), where roomTopics[i] gives the room's messages for
+ *  the clauses' i'th topic (NULL if the room has no such messages).
+ *  The size of a clause is the total size of its topics' lists.
+ */
+void plan_query(QueryPlan *plan, const Room *room,
+                const RoomTopic *roomTopics[], const FilterClause clauses[],
+                size_t nClauses, size_t count);
+
+/** Return a static string naming kind. */
+const char *plan_kind_to_string(PlanKind kind);
+
+#endif //#ifndef PLANNER_H_
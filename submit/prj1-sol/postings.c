@@ -0,0 +1,537 @@
+#include "postings.h"
+
+#include "errnum.h"
+#include "storemem.h"
+#include "varint.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void init_postings(Postings *postings) {
+  memset(postings, 0, sizeof(Postings));
+}
+
+static inline PostingsBlock *postings_blocks(const Postings *postings) {
+  return store_at(postings->blocks);
+}
+
+static inline uint8_t *postings_data(const Postings *postings) {
+  return store_at(postings->data);
+}
+
+static inline size_t *postings_tail(const Postings *postings) {
+  return store_at(postings->tail);
+}
+
+// Return # of bits needed to represent v.
+static unsigned bit_width(uint32_t v) {
+  return v == 0 ? 0 : 32 - __builtin_clz(v);
+}
+
+// Make room for n more bytes in postings->data[].
+static void ensure_data_space(Postings *postings, size_t n, ErrNum *err) {
+  enum { INIT_DATA_SIZE = 64 };
+  if (postings->dataLen + n <= postings->dataSize) return;
+  size_t newSize = postings->dataSize == 0 ? INIT_DATA_SIZE : postings->dataSize;
+  while (newSize < postings->dataLen + n) newSize *= 2;
+  StoreRef data =
+    store_realloc(postings->data, postings->dataSize, newSize, err);
+  if (*err != NO_ERR) return;
+  postings->data = data; postings->dataSize = newSize;
+}
+
+// Bit-pack the 128 gaps[] at width bits per gap into words[] (4*width
+// words).  Gap i goes into lane i%4 at bit offset (i/4)*width of that
+// lane, where word w of lane j is words[4*w + j].
+static void pack_gaps(const uint32_t gaps[], unsigned width, uint32_t words[]) {
+  memset(words, 0, 4 * width * sizeof(uint32_t));
+  for (size_t i = 0; i < POSTINGS_BLOCK_SIZE; i++) {
+    size_t lane = i & 3;
+    size_t bitPos = (i >> 2) * width;
+    size_t w = bitPos >> 5, off = bitPos & 31;
+    words[4*w + lane] |= gaps[i] << off;
+    if (off + width > 32) words[4*(w + 1) + lane] |= gaps[i] >> (32 - off);
+  }
+}
+
+// Compress the full tail of postings into a new block.
+static void compress_tail(Postings *postings, ErrNum *err) {
+  enum { INIT_BLOCKS_SIZE = 2 };
+  assert(postings->nTail == POSTINGS_BLOCK_SIZE);
+  if (postings->nBlocks == postings->blocksSize) {
+    size_t newSize =
+      postings->blocksSize == 0 ? INIT_BLOCKS_SIZE : 2 * postings->blocksSize;
+    StoreRef blocks = store_realloc(postings->blocks,
+                                    postings->blocksSize*sizeof(PostingsBlock),
+                                    newSize*sizeof(PostingsBlock), err);
+    if (*err != NO_ERR) return;
+    postings->blocks = blocks; postings->blocksSize = newSize;
+  }
+  const size_t *tail = postings_tail(postings);
+  PostingsBlock *block = &postings_blocks(postings)[postings->nBlocks];
+  block->firstSeq = tail[0];
+  block->lastSeq = tail[POSTINGS_BLOCK_SIZE - 1];
+  block->offset = postings->dataLen;
+  if (block->lastSeq - block->firstSeq <= UINT32_MAX) {
+    // gaps are stored less 1 since entries are strictly increasing
+    uint32_t gaps[POSTINGS_BLOCK_SIZE];
+    uint32_t all = gaps[0] = 0;
+    for (size_t i = 1; i < POSTINGS_BLOCK_SIZE; i++) {
+      gaps[i] = tail[i] - tail[i - 1] - 1;
+      all |= gaps[i];
+    }
+    unsigned width = bit_width(all);
+    size_t nBytes = 4 * width * sizeof(uint32_t);
+    ensure_data_space(postings, nBytes, err);
+    if (*err != NO_ERR) return;
+    uint32_t words[4 * 32];
+    pack_gaps(gaps, width, words);
+    if (nBytes > 0) {
+      memcpy(postings_data(postings) + postings->dataLen, words, nBytes);
+    }
+    postings->dataLen += nBytes;
+    block->width = width;
+  }
+  else {
+    ensure_data_space(postings, (POSTINGS_BLOCK_SIZE - 1)*MAX_VARINT_LEN, err);
+    if (*err != NO_ERR) return;
+    uint8_t *data = postings_data(postings);
+    uint8_t *p = data + postings->dataLen;
+    for (size_t i = 1; i < POSTINGS_BLOCK_SIZE; i++) {
+      p = put_varint(p, tail[i] - tail[i - 1] - 1);
+    }
+    postings->dataLen = p - data;
+    block->width = POSTINGS_VARINT_WIDTH;
+  }
+  postings->nBlocks++;
+  postings->nTail = 0;
+}
+
+void postings_append(Postings *postings, size_t seq, ErrNum *err) {
+  enum { INIT_TAIL_SIZE = 4 };
+  *err = NO_ERR;
+  size_t nTail = postings->nTail;
+  if (nTail > 0) {
+    size_t last = postings_tail(postings)[nTail - 1];
+    if (last == seq) return;
+    assert(last < seq);
+  }
+  else if (postings->nBlocks > 0) {
+    size_t last = postings_blocks(postings)[postings->nBlocks - 1].lastSeq;
+    if (last == seq) return;
+    assert(last < seq);
+  }
+  if (nTail == postings->tailSize) {
+    size_t newSize =
+      postings->tailSize == 0 ? INIT_TAIL_SIZE : 2 * postings->tailSize;
+    StoreRef tail = store_realloc(postings->tail,
+                                  postings->tailSize*sizeof(size_t),
+                                  newSize*sizeof(size_t), err);
+    if (*err != NO_ERR) return;
+    postings->tail = tail; postings->tailSize = newSize;
+  }
+  postings_tail(postings)[postings->nTail++] = seq;
+  if (postings->nTail == POSTINGS_BLOCK_SIZE) compress_tail(postings, err);
+}
+
+size_t postings_size(const Postings *postings) {
+  return postings->nBlocks * POSTINGS_BLOCK_SIZE + postings->nTail;
+}
+
+size_t postings_bytes(const Postings *postings) {
+  return postings->blocksSize*sizeof(PostingsBlock) + postings->dataSize +
+    postings->tailSize*sizeof(size_t);
+}
+
+void free_postings(Postings *postings) {
+  store_free(postings->blocks, postings->blocksSize*sizeof(PostingsBlock));
+  store_free(postings->data, postings->dataSize);
+  store_free(postings->tail, postings->tailSize*sizeof(size_t));
+  init_postings(postings);
+}
+
+// Unpack a bit-packed block into out[]: the inverse of pack_gaps()
+// followed by a prefix sum.  With SSE2 each step extracts the gaps of
+// 4 consecutive entries (one per lane) and scans them in-register.
+static void unpack_block(const PostingsBlock *block, const uint8_t *data,
+                         size_t out[]) {
+  unsigned width = block->width;
+  uint32_t rel[POSTINGS_BLOCK_SIZE] __attribute__((aligned(16)));
+  if (width == 0) {
+    for (size_t i = 0; i < POSTINGS_BLOCK_SIZE; i++) rel[i] = i;
+  }
+  else {
+#ifdef __SSE2__
+    const __m128i *words = (const __m128i *)data;
+    __m128i mask = _mm_set1_epi32(width == 32 ? UINT32_MAX : (1u << width) - 1);
+    __m128i carry = _mm_setzero_si128();
+    __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i four = _mm_set1_epi32(4);
+    for (size_t m = 0; m < POSTINGS_BLOCK_SIZE/4; m++) {
+      size_t bitPos = m * width;
+      size_t w = bitPos >> 5, off = bitPos & 31;
+      __m128i v = _mm_srl_epi32(_mm_loadu_si128(&words[w]),
+                                _mm_cvtsi32_si128(off));
+      if (off + width > 32) {
+        v = _mm_or_si128(v, _mm_sll_epi32(_mm_loadu_si128(&words[w + 1]),
+                                          _mm_cvtsi32_si128(32 - off)));
+      }
+      v = _mm_and_si128(v, mask);
+      v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+      v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+      v = _mm_add_epi32(v, carry);
+      carry = _mm_shuffle_epi32(v, 0xff);
+      _mm_store_si128((__m128i *)&rel[4*m], _mm_add_epi32(v, index));
+      index = _mm_add_epi32(index, four);
+    }
+#else
+    uint32_t mask = width == 32 ? UINT32_MAX : (1u << width) - 1;
+    uint32_t sum = 0;
+    for (size_t i = 0; i < POSTINGS_BLOCK_SIZE; i++) {
+      size_t lane = i & 3;
+      size_t bitPos = (i >> 2) * width;
+      size_t w = bitPos >> 5, off = bitPos & 31;
+      uint32_t lo, hi;
+      memcpy(&lo, data + 4*(4*w + lane), sizeof(uint32_t));
+      uint32_t gap = lo >> off;
+      if (off + width > 32) {
+        memcpy(&hi, data + 4*(4*(w + 1) + lane), sizeof(uint32_t));
+        gap |= hi << (32 - off);
+      }
+      sum += gap & mask;
+      rel[i] = sum + i;
+    }
+#endif
+  }
+  for (size_t i = 0; i < POSTINGS_BLOCK_SIZE; i++) {
+    out[i] = block->firstSeq + rel[i];
+  }
+}
+
+// Decode block number b of postings into out[].
+static void decode_block(const Postings *postings, size_t b, size_t out[]) {
+  const PostingsBlock *block = &postings_blocks(postings)[b];
+  const uint8_t *data = postings_data(postings) + block->offset;
+  if (block->width != POSTINGS_VARINT_WIDTH) {
+    unpack_block(block, data, out);
+    return;
+  }
+  out[0] = block->firstSeq;
+  for (size_t i = 1; i < POSTINGS_BLOCK_SIZE; i++) {
+    out[i] = out[i - 1] + get_varint(&data) + 1;
+  }
+}
+
+// Make block b current in iter with all its entries unreturned.
+static void iter_load_block(PostingsIter *iter, size_t b) {
+  decode_block(iter->postings, b, iter->buf);
+  iter->block = b;
+  iter->isTail = false;
+  iter->next = POSTINGS_BLOCK_SIZE;
+}
+
+// The tail is copied rather than read in place since later appends
+// overwrite it once compress_tail() has emptied it; the copy is the
+// start of block nBlocks, so iteration carries on from it unchanged.
+void postings_iter_init(PostingsIter *iter, const Postings *postings) {
+  iter->postings = postings;
+  iter->block = postings->nBlocks;
+  iter->isTail = true;
+  iter->next = postings->nTail;
+  iter->nVisited = 0;
+  if (postings->nTail > 0) {
+    memcpy(iter->buf, postings_tail(postings),
+           postings->nTail * sizeof(size_t));
+  }
+}
+
+bool postings_iter_prev(PostingsIter *iter, size_t *seq) {
+  if (iter->next == 0) {
+    if (iter->block == 0) return false;
+    iter_load_block(iter, iter->block - 1);
+  }
+  *seq = iter->buf[--iter->next];
+  iter->nVisited++;
+  return true;
+}
+
+void postings_iter_at(PostingsIter *iter, size_t pos, size_t *seq) {
+  const Postings *postings = iter->postings;
+  assert(pos < postings_size(postings));
+  size_t b = pos / POSTINGS_BLOCK_SIZE;
+  if (b == postings->nBlocks) {
+    *seq = postings_tail(postings)[pos % POSTINGS_BLOCK_SIZE];
+    return;
+  }
+  if (iter->block != b || iter->isTail) iter_load_block(iter, b);
+  *seq = iter->buf[pos % POSTINGS_BLOCK_SIZE];
+}
+
+// Galloping (exponential) search over keys ascending in [0, hi) with
+// key(0) <= target: probe hi-1, hi-2, hi-4, ... until a key <= target
+// brackets the answer, then binary search the bracket.  Returns the
+// largest i with key(i) <= target in O(log distance) probes, which is
+// cheap when the answer is close to hi, as it is for dense lists.
+#define GALLOP_LAST_LE(key, hi0, target, result) do {                   \
+    size_t hi_ = (hi0), lo_ = hi_ - 1, step_ = 1;                       \
+    while ((key(lo_)) > (target)) {                                     \
+      hi_ = lo_;                                                        \
+      lo_ = step_ < lo_ ? lo_ - step_ : 0;                              \
+      step_ *= 2;                                                       \
+    }                                                                   \
+    lo_++;                                                              \
+    while (lo_ < hi_) {                                                 \
+      size_t mid_ = lo_ + (hi_ - lo_)/2;                                \
+      if ((key(mid_)) <= (target)) lo_ = mid_ + 1; else hi_ = mid_;     \
+    }                                                                   \
+    (result) = lo_ - 1;                                                 \
+  } while (0)
+
+// Consume entries of the current block above target; return true if
+// an entry <= target remains (it is then consumed into *seq).
+static bool iter_seek_in_block(PostingsIter *iter, size_t target, size_t *seq) {
+  if (iter->next == 0 || iter->buf[0] > target) {
+    iter->next = 0;
+    return false;
+  }
+#define ENTRY_KEY(i) iter->buf[i]
+  GALLOP_LAST_LE(ENTRY_KEY, iter->next, target, iter->next);
+#undef ENTRY_KEY
+  *seq = iter->buf[iter->next];
+  iter->nVisited++;
+  return true;
+}
+
+bool postings_iter_seek(PostingsIter *iter, size_t target, size_t *seq) {
+  if (iter_seek_in_block(iter, target, seq)) return true;
+  // gallop back over skip headers of earlier blocks for the last one
+  // starting at or below target; blocks passed over are not decoded
+  const PostingsBlock *blocks = postings_blocks(iter->postings);
+  if (iter->block == 0 || blocks[0].firstSeq > target) {
+    iter->block = 0;
+    return false;
+  }
+  size_t b;
+#define BLOCK_KEY(i) blocks[i].firstSeq
+  GALLOP_LAST_LE(BLOCK_KEY, iter->block, target, b);
+#undef BLOCK_KEY
+  iter_load_block(iter, b);
+  return iter_seek_in_block(iter, target, seq);
+}
+
+// Adaptive intersection: the rarest list proposes a candidate and
+// the lists are visited round-robin, each galloping down to the
+// current candidate.  A list landing below the candidate makes its
+// entry the new candidate, so long runs of the large lists are
+// skipped rather than merged.  Done when all lists agree.  Callers
+// stop asking once they have COUNT results, so only the newest part
+// of each list is ever touched.
+bool postings_intersect_prev(PostingsIter iters[], size_t nIters, size_t *seq) {
+  assert(nIters > 0);
+  size_t candidate;
+  if (!postings_iter_prev(&iters[0], &candidate)) return false;
+  size_t nAgree = 1;
+  for (size_t i = 1 % nIters; nAgree < nIters; i = (i + 1) % nIters) {
+    size_t s;
+    if (!postings_iter_seek(&iters[i], candidate, &s)) return false;
+    if (s == candidate) {
+      nAgree++;
+    }
+    else {
+      candidate = s; nAgree = 1;
+    }
+  }
+  *seq = candidate;
+  return true;
+}
+
+void postings_union_init(PostingsUnion *u, PostingsIter iters[], size_t nIters,
+                         size_t heads[]) {
+  u->iters = iters;
+  u->nIters = nIters;
+  u->heads = heads;
+  for (size_t i = 0; i < nIters; i++) {
+    size_t seq;
+    heads[i] = postings_iter_prev(&iters[i], &seq) ? seq + 1 : 0;
+  }
+}
+
+// Return 1 + the newest entry of u, 0 if none, without consuming it.
+static size_t union_newest(const PostingsUnion *u) {
+  size_t newest = 0;
+  for (size_t i = 0; i < u->nIters; i++) {
+    if (u->heads[i] > newest) newest = u->heads[i];
+  }
+  return newest;
+}
+
+// Skip the entries of u above target; return 1 + the newest remaining
+// entry, 0 if none, without consuming it.
+static size_t union_seek(PostingsUnion *u, size_t target) {
+  for (size_t i = 0; i < u->nIters; i++) {
+    size_t seq;
+    if (u->heads[i] != 0 && u->heads[i] - 1 > target) {
+      u->heads[i] =
+        postings_iter_seek(&u->iters[i], target, &seq) ? seq + 1 : 0;
+    }
+  }
+  return union_newest(u);
+}
+
+// Consume entry seq, the newest of u, from every list having it.
+static void union_consume(PostingsUnion *u, size_t seq) {
+  for (size_t i = 0; i < u->nIters; i++) {
+    size_t s;
+    if (u->heads[i] == seq + 1) {
+      u->heads[i] = postings_iter_prev(&u->iters[i], &s) ? s + 1 : 0;
+    }
+  }
+}
+
+// Like postings_intersect_prev() over unions, where a union's newest
+// entry is the newest entry of any of its lists.  A candidate common
+// to incl[] is then looked for in excl[], whose lists are skipped
+// down to it but not consumed, since later candidates are older.
+bool postings_filter_prev(PostingsUnion incl[], size_t nIncl,
+                          PostingsUnion excl[], size_t nExcl, size_t *seq) {
+  assert(nIncl > 0);
+  for (;;) {
+    size_t head = union_newest(&incl[0]);
+    if (head == 0) return false;
+    size_t candidate = head - 1;
+    size_t nAgree = 1;
+    for (size_t i = 1 % nIncl; nAgree < nIncl; i = (i + 1) % nIncl) {
+      head = union_seek(&incl[i], candidate);
+      if (head == 0) return false;
+      if (head - 1 == candidate) {
+        nAgree++;
+      }
+      else {
+        candidate = head - 1; nAgree = 1;
+      }
+    }
+    bool isExcluded = false;
+    for (size_t i = 0; i < nExcl && !isExcluded; i++) {
+      isExcluded = union_seek(&excl[i], candidate) == candidate + 1;
+    }
+    for (size_t i = 0; i < nIncl; i++) union_consume(&incl[i], candidate);
+    if (!isExcluded) {
+      *seq = candidate;
+      return true;
+    }
+  }
+}
+
+
+#ifdef TEST_POSTINGS
+
+#include <stdio.h>
+
+// Check iteration and seeking against a plain array for lists with
+// a mix of dense runs, small gaps and gaps too large to bit-pack.
+int
+main(int argc, const char *argv[])
+{
+  enum { N = 5000 };
+  srand(argc > 1 ? atoi(argv[1]) : 1);
+  static size_t seqs[N];
+  for (int trial = 0; trial < 20; trial++) {
+    Postings postings;
+    init_postings(&postings);
+    size_t seq = rand() % 10;
+    ErrNum err;
+    for (size_t i = 0; i < N; i++) {
+      seqs[i] = seq;
+      postings_append(&postings, seq, &err);
+      postings_append(&postings, seq, &err);    //duplicate is a no-op
+      assert(err == NO_ERR);
+      int r = rand() % 100;
+      seq += (r < 40) ? 1 : (r < 98) ? 1 + rand() % (1 << (trial % 24))
+        : ((size_t)1 << 33) + rand();
+    }
+    assert(postings_size(&postings) == N);
+    PostingsIter iter;
+    postings_iter_init(&iter, &postings);
+    size_t s;
+    for (size_t i = N; i > 0; i--) {
+      assert(postings_iter_prev(&iter, &s) && s == seqs[i - 1]);
+    }
+    assert(!postings_iter_prev(&iter, &s));
+    postings_iter_init(&iter, &postings);
+    size_t i = N;
+    while (i > 0) {
+      size_t target = seqs[i - 1] - rand() % 3;
+      while (i > 0 && seqs[i - 1] > target) i--;
+      bool found = postings_iter_seek(&iter, target, &s);
+      assert(found == (i > 0));
+      if (found) assert(s == seqs[--i]);
+      if (i > 0 && rand() % 8 == 0) {
+        //keep iter in step with a skip over consumed entries
+        size_t skip = 1 + rand() % (i < 400 ? i : 400);
+        size_t t = seqs[i - skip];
+        while (i > 0 && seqs[i - 1] > t) i--;
+        assert(postings_iter_seek(&iter, t, &s) && s == seqs[--i]);
+      }
+    }
+    free_postings(&postings);
+  }
+
+  //intersect a rare, a medium and a dense list against brute force
+  Postings lists[4];
+  size_t mods[4] = { 97, 5, 2, 3 };
+  static bool isIn[4][50*N];
+  ErrNum err;
+  for (int k = 0; k < 4; k++) {
+    init_postings(&lists[k]);
+    for (size_t s = 0; s < 50*N; s++) {
+      isIn[k][s] = rand() % mods[k] == 0;
+      if (isIn[k][s]) postings_append(&lists[k], s, &err);
+    }
+  }
+  PostingsIter iters[3], check[3];
+  for (int k = 0; k < 3; k++) {
+    postings_iter_init(&iters[k], &lists[k]);
+    postings_iter_init(&check[k], &lists[k]);
+  }
+  size_t s, nCommon = 0;
+  size_t e0, e1, e2;
+  bool ok1 = postings_iter_prev(&check[1], &e1);
+  bool ok2 = postings_iter_prev(&check[2], &e2);
+  while (postings_iter_prev(&check[0], &e0)) {
+    while (ok1 && e1 > e0) ok1 = postings_iter_prev(&check[1], &e1);
+    while (ok2 && e2 > e0) ok2 = postings_iter_prev(&check[2], &e2);
+    if (ok1 && ok2 && e1 == e0 && e2 == e0) {
+      assert(postings_intersect_prev(iters, 3, &s) && s == e0);
+      nCommon++;
+    }
+  }
+  assert(!postings_intersect_prev(iters, 3, &s));
+
+  //filter (0|1) & 2 & !3 against brute force
+  PostingsIter fIters[4];
+  size_t heads[4];
+  for (int k = 0; k < 4; k++) postings_iter_init(&fIters[k], &lists[k]);
+  PostingsUnion incl[2], excl[1];
+  postings_union_init(&incl[0], &fIters[0], 2, &heads[0]);
+  postings_union_init(&incl[1], &fIters[2], 1, &heads[2]);
+  postings_union_init(&excl[0], &fIters[3], 1, &heads[3]);
+  size_t nFiltered = 0;
+  for (size_t i = 50*N; i > 0; i--) {
+    size_t e = i - 1;
+    if ((isIn[0][e] || isIn[1][e]) && isIn[2][e] && !isIn[3][e]) {
+      assert(postings_filter_prev(incl, 2, excl, 1, &s) && s == e);
+      nFiltered++;
+    }
+  }
+  assert(!postings_filter_prev(incl, 2, excl, 1, &s));
+  for (int k = 0; k < 4; k++) free_postings(&lists[k]);
+  printf("postings ok (%zu common, %zu filtered)\n", nCommon, nFiltered);
+}
+
+#endif //#ifdef TEST_POSTINGS
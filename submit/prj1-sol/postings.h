@@ -0,0 +1,137 @@
+#ifndef POSTINGS_H_
+#define POSTINGS_H_
+
+#include "errnum.h"
+#include "storemem.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** A posting list: a strictly increasing sequence of message
+ *  sequence numbers.  Appends must be in increasing order; iteration
+ *  is newest-first (decreasing).
+ *
+ *  Entries are stored in blocks of POSTINGS_BLOCK_SIZE.  Within a
+ *  block the gaps between successive entries are bit-packed at the
+ *  smallest width which fits them (in the 4-lane interleaved layout
+ *  used by SIMD-BP128) so that a block can be unpacked 4 entries at a
+ *  time; a block whose entries span more than 32 bits falls back to
+ *  varint-encoded gaps.  Each block has a skip header giving its
+ *  first and last entries so that seeking can pass over a block
+ *  without decoding it.  The newest entries which do not yet fill a
+ *  block are kept uncompressed.  A list's arrays are in store memory
+ *  (see storemem.h).
+ */
+
+enum { POSTINGS_BLOCK_SIZE = 128 };
+
+/** Skip header for a compressed block. */
+typedef struct {
+  size_t firstSeq;      // smallest entry in block
+  size_t lastSeq;       // largest entry in block
+  size_t offset;        // offset of encoded gaps in Postings data[]
+  uint8_t width;        // bits per gap or POSTINGS_VARINT_WIDTH
+} PostingsBlock;
+
+enum { POSTINGS_VARINT_WIDTH = 0xff };
+
+typedef struct {
+  StoreRef blocks;      // PostingsBlock[blocksSize]
+  size_t nBlocks;
+  size_t blocksSize;
+  StoreRef data;        // encoded gaps for all blocks
+  size_t dataLen;
+  size_t dataSize;
+  StoreRef tail;        // uncompressed entries after last block
+  size_t nTail;
+  size_t tailSize;
+} Postings;
+
+/** Newest-first cursor over a Postings.  It starts with a copy of the
+ *  list's tail, so entries appended while it is in use (even those
+ *  compressing that tail into a block) do not disturb it; it returns
+ *  only the entries the list had when it was initialized.
+ */
+typedef struct {
+  const Postings *postings;
+  size_t block;         // block decoded into buf[], nBlocks for tail
+  bool isTail;          // buf[] holds the tail as it was at init
+  size_t next;          // # of entries of current block not yet returned
+  size_t nVisited;      // # of entries returned by prev and seek
+  size_t buf[POSTINGS_BLOCK_SIZE];
+} PostingsIter;
+
+/** Newest-first cursor over the union of several posting lists: an
+ *  entry is in it if it is in any of the lists.
+ */
+typedef struct {
+  PostingsIter *iters;  // iters[nIters], one per list
+  size_t nIters;
+  size_t *heads;        // heads[i]: 1 + next entry of iters[i], 0 at end
+} PostingsUnion;
+
+/** Initialize postings to an empty list. */
+void init_postings(Postings *postings);
+
+/** Append seq to postings; seq must be greater than the last entry.
+ *  Appending a seq equal to the last entry is a no-op (so a message
+ *  with duplicate topics is only posted once).  Sets *err to MEM_ERR
+ *  on failure.
+ */
+void postings_append(Postings *postings, size_t seq, ErrNum *err);
+
+/** Return # of entries in postings. */
+size_t postings_size(const Postings *postings);
+
+/** Return # of bytes of memory used by postings. */
+size_t postings_bytes(const Postings *postings);
+
+/** Free memory used by postings (but not postings itself). */
+void free_postings(Postings *postings);
+
+/** Position iter just after the newest entry of postings. */
+void postings_iter_init(PostingsIter *iter, const Postings *postings);
+
+/** Set *seq to the next older entry and return true; return false
+ *  when iter is exhausted.
+ */
+bool postings_iter_prev(PostingsIter *iter, size_t *seq);
+
+/** Set *seq to the newest entry not yet returned by iter which is
+ *  <= target and return true; return false if there is no such
+ *  entry.  Entries skipped over are consumed; blocks lying entirely
+ *  above target are skipped without being decoded.
+ */
+bool postings_iter_seek(PostingsIter *iter, size_t target, size_t *seq);
+
+/** Set *seq to the entry at position pos (0 for the oldest) of iter's
+ *  postings.  Uses iter only as a cache of the last decoded block, so
+ *  lookups of nearby positions are cheap; it must not be mixed with
+ *  postings_iter_prev() or postings_iter_seek().
+ */
+void postings_iter_at(PostingsIter *iter, size_t pos, size_t *seq);
+
+/** Set *seq to the next older sequence number common to all nIters
+ *  cursors in iters[] and return true; return false when any cursor
+ *  is exhausted.  For speed, iters[] should be ordered by increasing
+ *  list size.
+ */
+bool postings_intersect_prev(PostingsIter iters[], size_t nIters, size_t *seq);
+
+/** Initialize u over the nIters cursors iters[] (each just
+ *  initialized), using heads[nIters] as scratch space which must
+ *  outlive u.
+ */
+void postings_union_init(PostingsUnion *u, PostingsIter iters[], size_t nIters,
+                         size_t heads[]);
+
+/** Set *seq to the next older sequence number which is in each of the
+ *  unions incl[nIncl] (nIncl > 0) but in none of excl[nExcl] and
+ *  return true; return false when there is none.  For speed, incl[]
+ *  should be ordered by increasing size.
+ */
+bool postings_filter_prev(PostingsUnion incl[], size_t nIncl,
+                          PostingsUnion excl[], size_t nExcl, size_t *seq);
+
+#endif //#ifndef POSTINGS_H_
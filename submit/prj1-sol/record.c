@@ -0,0 +1,56 @@
+#include "record.h"
+
+#include "arena.h"
+#include "errnum.h"
+#include "varint.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+size_t encode_record(Arena *arena, size_t userId, size_t roomId,
+                     size_t time, const size_t topicIds[], size_t nTopics,
+                     size_t bodyId, const char *body, size_t bodyLen,
+                     ErrNum *err) {
+  bool isInline = bodyId == RECORD_INLINE_BODY;
+  size_t bodyRef = isInline ? bodyLen << 1 : bodyId << 1 | 1;
+  if (!isInline) bodyLen = 0;
+  size_t n = varint_len(userId) + varint_len(roomId) + varint_len(time) +
+    varint_len(nTopics) + varint_len(bodyRef) + bodyLen;
+  for (size_t i = 0; i < nTopics; i++) n += varint_len(topicIds[i]);
+  size_t offset = arena_alloc(arena, n, err);
+  if (*err != NO_ERR) return 0;
+  uint8_t *p = arena_at(arena, offset);
+  p = put_varint(p, userId);
+  p = put_varint(p, roomId);
+  p = put_varint(p, time);
+  p = put_varint(p, nTopics);
+  for (size_t i = 0; i < nTopics; i++) p = put_varint(p, topicIds[i]);
+  p = put_varint(p, bodyRef);
+  memcpy(p, body, bodyLen);
+  return offset;
+}
+
+void decode_record(const uint8_t *p, ChatRecord *record) {
+  const uint8_t *start = p;
+  record->userId = get_varint(&p);
+  record->roomId = get_varint(&p);
+  record->time = get_varint(&p);
+  record->nTopics = get_varint(&p);
+  record->topicIds = p;
+  for (size_t i = 0; i < record->nTopics; i++) {
+    while (*p++ & 0x80) ;
+  }
+  size_t bodyRef = get_varint(&p);
+  record->isSharedBody = bodyRef & 1;
+  if (record->isSharedBody) {
+    record->bodyId = bodyRef >> 1;
+    record->body = NULL;
+    record->bodyLen = 0;
+    record->len = p - start;
+  }
+  else {
+    record->bodyLen = bodyRef >> 1;
+    record->body = (const char *)p;
+    record->len = p + record->bodyLen - start;
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef RECORD_H_
+#define RECORD_H_
+
+#include "arena.h"
+#include "errnum.h"
+#include "varint.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Compact encoding of a chat message in an Arena.  The user, room
+ *  and topics are referred to by their interned ids (see index.h) and
+ *  everything but the body is a varint:
+ *
+ *    userId roomId time nTopics topicId[nTopics] bodyRef [body[bodyLen]]
+ *
+ *  where time is when the message was added (in seconds since the
+ *  store was started; it only matters for TTL expiry), and bodyRef is
+ *  bodyLen << 1 for a body stored inline right after it, or
+ *  bodyId << 1 | 1 for a body shared with other messages (see
+ *  bodies.h).  For a typical message (small ids, a few topics, a
+ *  short body) the header is under 10 bytes.  An inline body is not
+ *  NUL-terminated.
+ */
+
+/** bodyId for encode_record() meaning the body is stored inline. */
+#define RECORD_INLINE_BODY SIZE_MAX
+
+/** A decoded view of a record; its pointers point into the arena. */
+typedef struct {
+  size_t userId;
+  size_t roomId;
+  size_t time;
+  size_t nTopics;
+  const uint8_t *topicIds;      // varints; read with record_next_topic()
+  bool isSharedBody;
+  size_t bodyId;                // if isSharedBody
+  const char *body;             // if !isSharedBody
+  size_t bodyLen;               // if !isSharedBody
+  size_t len;                   // # of bytes in the encoded record
+} ChatRecord;
+
+/** Append the record for the specified message to arena and return
+ *  its offset.  The body is body[bodyLen] if bodyId is
+ *  RECORD_INLINE_BODY, else the shared body bodyId.  Sets *err to
+ *  MEM_ERR on failure.
+ */
+size_t encode_record(Arena *arena, size_t userId, size_t roomId,
+                     size_t time, const size_t topicIds[], size_t nTopics,
+                     size_t bodyId, const char *body, size_t bodyLen,
+                     ErrNum *err);
+
+/** Decode the record at p into *record; a shared body is only
+ *  identified, not resolved.
+ */
+void decode_record(const uint8_t *p, ChatRecord *record);
+
+/** Return the topic id at *cursor (initially record->topicIds) and
+ *  advance *cursor to the next one.
+ */
+static inline size_t record_next_topic(const uint8_t **cursor) {
+  return get_varint(cursor);
+}
+
+#endif //#ifndef RECORD_H_
@@ -0,0 +1,339 @@
+#include "roaring.h"
+
+#include "errnum.h"
+#include "storemem.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+void init_roaring(Roaring *roaring) {
+  memset(roaring, 0, sizeof(Roaring));
+}
+
+static inline RoaringContainer *roaring_containers(const Roaring *roaring) {
+  return store_at(roaring->containers);
+}
+
+size_t roaring_card(const Roaring *roaring) {
+  return roaring->card;
+}
+
+// Return # of bytes of data used by a container of type with n elements.
+static size_t container_data_bytes(uint8_t type, size_t n) {
+  switch (type) {
+  case ROARING_ARRAY: return n * sizeof(uint16_t);
+  case ROARING_BITMAP: return ROARING_BITMAP_WORDS * sizeof(uint64_t);
+  default: return 2 * n * sizeof(uint16_t);
+  }
+}
+
+size_t roaring_bytes(const Roaring *roaring) {
+  size_t n = roaring->containersSize * sizeof(RoaringContainer);
+  const RoaringContainer *containers = roaring_containers(roaring);
+  for (size_t i = 0; i < roaring->nContainers; i++) {
+    const RoaringContainer *c = &containers[i];
+    n += container_data_bytes(c->type, c->size);
+  }
+  return n;
+}
+
+void free_roaring(Roaring *roaring) {
+  const RoaringContainer *containers = roaring_containers(roaring);
+  for (size_t i = 0; i < roaring->nContainers; i++) {
+    const RoaringContainer *c = &containers[i];
+    store_free(c->data, container_data_bytes(c->type, c->size));
+  }
+  store_free(roaring->containers,
+             roaring->containersSize * sizeof(RoaringContainer));
+  init_roaring(roaring);
+}
+
+// Convert array container c to a bitmap container.
+static void array_to_bitmap(RoaringContainer *c, ErrNum *err) {
+  size_t nBytes = container_data_bytes(ROARING_BITMAP, 0);
+  StoreRef ref = store_alloc(nBytes, err);
+  if (*err != NO_ERR) return;
+  uint64_t *words = store_at(ref);
+  memset(words, 0, nBytes);
+  const uint16_t *array = store_at(c->data);
+  for (size_t i = 0; i < c->n; i++) {
+    words[array[i] >> 6] |= (uint64_t)1 << (array[i] & 63);
+  }
+  store_free(c->data, container_data_bytes(ROARING_ARRAY, c->size));
+  c->data = ref;
+  c->type = ROARING_BITMAP;
+  c->n = c->size = 0;
+}
+
+// Return # of runs of consecutive low parts in container c.
+static size_t count_runs(const RoaringContainer *c) {
+  size_t nRuns = 0;
+  if (c->type == ROARING_ARRAY) {
+    const uint16_t *array = store_at(c->data);
+    for (size_t i = 0; i < c->n; i++) {
+      if (i == 0 || array[i] != array[i - 1] + 1) nRuns++;
+    }
+  }
+  else {
+    const uint64_t *words = store_at(c->data);
+    uint64_t carry = 0;
+    for (size_t w = 0; w < ROARING_BITMAP_WORDS; w++) {
+      // a run starts at each set bit whose lower neighbour is clear
+      nRuns += __builtin_popcountll(words[w] & ~((words[w] << 1) | carry));
+      carry = words[w] >> 63;
+    }
+  }
+  return nRuns;
+}
+
+// Append low to the runs[r], each stored as (start, length - 1).
+static void append_to_runs(uint16_t runs[], size_t *r, uint16_t low) {
+  if (*r > 0 && runs[2*(*r - 1)] + runs[2*(*r - 1) + 1] + 1 == low) {
+    runs[2*(*r - 1) + 1]++;
+  }
+  else {
+    runs[2*(*r)] = low; runs[2*(*r) + 1] = 0; (*r)++;
+  }
+}
+
+// Convert container c to runs if that is its smallest representation.
+static void optimize_container(RoaringContainer *c, ErrNum *err) {
+  size_t nRuns = count_runs(c);
+  size_t runBytes = container_data_bytes(ROARING_RUN, nRuns);
+  if (runBytes >= container_data_bytes(c->type, c->n)) return;
+  StoreRef ref = store_alloc(runBytes, err);
+  if (*err != NO_ERR) return;
+  uint16_t *runs = store_at(ref);
+  size_t r = 0;
+  if (c->type == ROARING_ARRAY) {
+    const uint16_t *array = store_at(c->data);
+    for (size_t i = 0; i < c->n; i++) append_to_runs(runs, &r, array[i]);
+  }
+  else {
+    const uint64_t *words = store_at(c->data);
+    for (size_t w = 0; w < ROARING_BITMAP_WORDS; w++) {
+      for (uint64_t word = words[w]; word != 0; word &= word - 1) {
+        append_to_runs(runs, &r, (w << 6) | __builtin_ctzll(word));
+      }
+    }
+  }
+  assert(r == nRuns);
+  store_free(c->data, container_data_bytes(c->type, c->size));
+  c->data = ref;
+  c->type = ROARING_RUN;
+  c->n = c->size = nRuns;
+}
+
+// Start a new (array) container for key.
+static RoaringContainer *add_container(Roaring *roaring, size_t key,
+                                       ErrNum *err) {
+  enum { INIT_CONTAINERS_SIZE = 2 };
+  if (roaring->nContainers == roaring->containersSize) {
+    size_t newSize = roaring->containersSize == 0
+      ? INIT_CONTAINERS_SIZE : 2 * roaring->containersSize;
+    StoreRef containers =
+      store_realloc(roaring->containers,
+                    roaring->containersSize*sizeof(RoaringContainer),
+                    newSize*sizeof(RoaringContainer), err);
+    if (*err != NO_ERR) return NULL;
+    roaring->containers = containers; roaring->containersSize = newSize;
+  }
+  RoaringContainer *c = &roaring_containers(roaring)[roaring->nContainers++];
+  memset(c, 0, sizeof(RoaringContainer));
+  c->key = key;
+  c->type = ROARING_ARRAY;
+  return c;
+}
+
+void roaring_add(Roaring *roaring, size_t index, ErrNum *err) {
+  enum { INIT_ARRAY_SIZE = 4 };
+  *err = NO_ERR;
+  size_t key = index >> 16;
+  uint16_t low = index & 0xffff;
+  RoaringContainer *c = roaring->nContainers == 0
+    ? NULL : &roaring_containers(roaring)[roaring->nContainers - 1];
+  if (c == NULL || c->key != key) {
+    assert(c == NULL || c->key < key);
+    if (c != NULL) {
+      optimize_container(c, err);
+      if (*err != NO_ERR) return;
+    }
+    c = add_container(roaring, key, err);
+    if (*err != NO_ERR) return;
+  }
+  if (c->type == ROARING_ARRAY && c->n == ROARING_MAX_ARRAY) {
+    array_to_bitmap(c, err);
+    if (*err != NO_ERR) return;
+  }
+  if (c->type == ROARING_ARRAY) {
+    assert(c->n == 0 || ((uint16_t *)store_at(c->data))[c->n - 1] < low);
+    if (c->n == c->size) {
+      size_t newSize = c->size == 0 ? INIT_ARRAY_SIZE : 2 * c->size;
+      StoreRef array = store_realloc(c->data, c->size*sizeof(uint16_t),
+                                     newSize*sizeof(uint16_t), err);
+      if (*err != NO_ERR) return;
+      c->data = array; c->size = newSize;
+    }
+    ((uint16_t *)store_at(c->data))[c->n++] = low;
+  }
+  else {
+    assert(c->type == ROARING_BITMAP);
+    ((uint64_t *)store_at(c->data))[low >> 6] |= (uint64_t)1 << (low & 63);
+  }
+  c->card++;
+  roaring->card++;
+}
+
+// Set the bits of lows [start, end] in words[].
+static void set_range(uint64_t words[], size_t start, size_t end) {
+  size_t w0 = start >> 6, w1 = end >> 6;
+  uint64_t first = ~(uint64_t)0 << (start & 63);
+  uint64_t last = ~(uint64_t)0 >> (63 - (end & 63));
+  if (w0 == w1) {
+    words[w0] |= first & last;
+    return;
+  }
+  words[w0] |= first;
+  for (size_t w = w0 + 1; w < w1; w++) words[w] = ~(uint64_t)0;
+  words[w1] |= last;
+}
+
+// Expand container c into the bitmap words[].
+static void container_to_words(const RoaringContainer *c, uint64_t words[]) {
+  if (c->type == ROARING_BITMAP) {
+    memcpy(words, store_at(c->data), ROARING_BITMAP_WORDS * sizeof(uint64_t));
+    return;
+  }
+  memset(words, 0, ROARING_BITMAP_WORDS * sizeof(uint64_t));
+  const uint16_t *data = store_at(c->data);
+  if (c->type == ROARING_ARRAY) {
+    for (size_t i = 0; i < c->n; i++) {
+      words[data[i] >> 6] |= (uint64_t)1 << (data[i] & 63);
+    }
+  }
+  else {
+    for (size_t r = 0; r < c->n; r++) {
+      set_range(words, data[2*r], data[2*r] + data[2*r + 1]);
+    }
+  }
+}
+
+// AND container c into the bitmap words[].
+static void and_container(const RoaringContainer *c, uint64_t words[]) {
+  if (c->type == ROARING_BITMAP) {
+    const uint64_t *cWords = store_at(c->data);
+    for (size_t w = 0; w < ROARING_BITMAP_WORDS; w++) words[w] &= cWords[w];
+    return;
+  }
+  uint64_t cWords[ROARING_BITMAP_WORDS];
+  container_to_words(c, cWords);
+  for (size_t w = 0; w < ROARING_BITMAP_WORDS; w++) words[w] &= cWords[w];
+}
+
+void roaring_and_iter_init(RoaringAndIter *iter, const Roaring *roarings[],
+                           size_t nRoarings, size_t next[]) {
+  assert(nRoarings > 0);
+  iter->roarings = roarings;
+  iter->nRoarings = nRoarings;
+  iter->next = next;
+  for (size_t i = 0; i < nRoarings; i++) next[i] = roarings[i]->nContainers;
+  iter->word = 0;
+  iter->nWords = 0;
+}
+
+// Find the next lower key present in all roarings and AND their
+// containers for it into iter->words[].  Returns false if none.
+static bool and_next_container(RoaringAndIter *iter) {
+  const Roaring **roarings = iter->roarings;
+  size_t *next = iter->next;
+  if (next[0] == 0) return false;
+  size_t key = roaring_containers(roarings[0])[--next[0]].key;
+  size_t nAgree = 1;
+  for (size_t i = 1 % iter->nRoarings; nAgree < iter->nRoarings;
+       i = (i + 1) % iter->nRoarings) {
+    const RoaringContainer *cs = roaring_containers(roarings[i]);
+    while (next[i] > 0 && cs[next[i] - 1].key > key) next[i]--;
+    if (next[i] == 0) return false;
+    size_t k = cs[--next[i]].key;
+    if (k == key) {
+      nAgree++;
+    }
+    else {
+      key = k; nAgree = 1;
+    }
+  }
+  iter->key = key;
+  container_to_words(&roaring_containers(roarings[0])[next[0]], iter->words);
+  for (size_t i = 1; i < iter->nRoarings; i++) {
+    and_container(&roaring_containers(roarings[i])[next[i]], iter->words);
+  }
+  iter->word = ROARING_BITMAP_WORDS;
+  iter->nWords += iter->nRoarings * ROARING_BITMAP_WORDS;
+  return true;
+}
+
+bool roaring_and_iter_prev(RoaringAndIter *iter, size_t *index) {
+  for (;;) {
+    while (iter->word > 0 && iter->words[iter->word - 1] == 0) iter->word--;
+    if (iter->word > 0) break;
+    if (!and_next_container(iter)) return false;
+  }
+  uint64_t *w = &iter->words[iter->word - 1];
+  unsigned bit = 63 - __builtin_clzll(*w);
+  *w &= ~((uint64_t)1 << bit);
+  *index = (iter->key << 16) | ((iter->word - 1) << 6) | bit;
+  return true;
+}
+
+
+#ifdef TEST_ROARING
+
+#include <stdio.h>
+
+// Check intersections of sparse, dense and clustered bitmaps against
+// a brute-force intersection of plain boolean arrays.
+int
+main(int argc, const char *argv[])
+{
+  enum { N = 400000, K = 3 };
+  srand(argc > 1 ? atoi(argv[1]) : 1);
+  static bool isSet[K][N];
+  Roaring roarings[K];
+  ErrNum err;
+  for (int k = 0; k < K; k++) {
+    init_roaring(&roarings[k]);
+    for (size_t i = 0; i < N; i++) {
+      size_t region = i >> 16;
+      bool bit = (region % 3 == 0) ? rand() % 50 == 0    //sparse
+        : (region % 3 == 1) ? rand() % 5 < 3              //dense
+        : (i / 1000) % 2 == k % 2 || k == 2;              //clustered
+      isSet[k][i] = bit;
+      if (bit) roaring_add(&roarings[k], i, &err);
+      assert(err == NO_ERR);
+    }
+  }
+  const Roaring *rs[K] = { &roarings[0], &roarings[1], &roarings[2] };
+  for (size_t n = 1; n <= K; n++) {
+    size_t next[K];
+    RoaringAndIter iter;
+    roaring_and_iter_init(&iter, rs, n, next);
+    size_t index;
+    for (size_t i = N; i > 0; i--) {
+      bool all = true;
+      for (size_t k = 0; k < n; k++) all = all && isSet[k][i - 1];
+      if (all) assert(roaring_and_iter_prev(&iter, &index) && index == i - 1);
+    }
+    assert(!roaring_and_iter_prev(&iter, &index));
+  }
+  size_t nRuns = 0;
+  for (size_t c = 0; c < roarings[2].nContainers; c++) {
+    nRuns += roaring_containers(&roarings[2])[c].type == ROARING_RUN;
+  }
+  printf("roaring ok (%zu bytes, %zu run containers)\n",
+         roaring_bytes(&roarings[2]), nRuns);
+  for (int k = 0; k < K; k++) free_roaring(&roarings[k]);
+}
+
+#endif //#ifdef TEST_ROARING
@@ -0,0 +1,92 @@
+#ifndef ROARING_H_
+#define ROARING_H_
+
+#include "errnum.h"
+#include "storemem.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** A roaring-style compressed bitmap over indices.  Indices are
+ *  split into a high key (index >> 16) and a 16-bit low part; each key
+ *  present has a container holding its low parts as either
+ *
+ *    a sorted array of uint16_t (when sparse),
+ *    a 65536-bit bitmap (when dense), or
+ *    a sorted array of runs (when clustered).
+ *
+ *  Indices must be added in increasing order.  The container for the
+ *  newest key stays an array or bitmap while it is filled; it is
+ *  converted to runs when a later key is started if that is smaller.
+ *  The containers and their data are in store memory (see
+ *  storemem.h).
+ */
+
+enum {
+  ROARING_ARRAY,
+  ROARING_BITMAP,
+  ROARING_RUN,
+};
+
+enum {
+  ROARING_MAX_ARRAY = 4096,          // array containers never exceed this
+  ROARING_BITMAP_WORDS = 65536/64,
+};
+
+typedef struct {
+  size_t key;           // index >> 16 for all indices in container
+  uint8_t type;         // ROARING_ARRAY, ROARING_BITMAP or ROARING_RUN
+  uint32_t card;        // # of indices in container
+  uint32_t n;           // # of array elements or # of runs
+  uint32_t size;        // allocated # of array elements or runs
+  StoreRef data;        // uint16_t[n], uint64_t[1024] or uint16_t[2*n]
+} RoaringContainer;
+
+typedef struct {
+  StoreRef containers;  // RoaringContainer[containersSize]
+  size_t nContainers;
+  size_t containersSize;
+  size_t card;          // total # of indices
+} Roaring;
+
+/** Newest-first cursor over the intersection of several Roarings. */
+typedef struct {
+  const Roaring **roarings;
+  size_t nRoarings;
+  size_t *next;         // next[i]: # of containers of roarings[i] unvisited
+  size_t key;           // key of the container ANDed into words[]
+  size_t word;          // # of words[] not yet fully scanned
+  size_t nWords;        // # of container words ANDed so far
+  uint64_t words[ROARING_BITMAP_WORDS];
+} RoaringAndIter;
+
+/** Initialize roaring to an empty bitmap. */
+void init_roaring(Roaring *roaring);
+
+/** Add index to roaring; index must be greater than all indices
+ *  already added.  Sets *err to MEM_ERR on failure.
+ */
+void roaring_add(Roaring *roaring, size_t index, ErrNum *err);
+
+/** Return # of indices in roaring. */
+size_t roaring_card(const Roaring *roaring);
+
+/** Return # of bytes of memory used by roaring. */
+size_t roaring_bytes(const Roaring *roaring);
+
+/** Free memory used by roaring (but not roaring itself). */
+void free_roaring(Roaring *roaring);
+
+/** Initialize iter over the intersection of roarings[nRoarings];
+ *  next[nRoarings] is scratch space which must outlive iter.
+ */
+void roaring_and_iter_init(RoaringAndIter *iter, const Roaring *roarings[],
+                           size_t nRoarings, size_t next[]);
+
+/** Set *index to the next lower index present in all of iter's
+ *  roarings and return true; return false when there is none.
+ */
+bool roaring_and_iter_prev(RoaringAndIter *iter, size_t *index);
+
+#endif //#ifndef ROARING_H_
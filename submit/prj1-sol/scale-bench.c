@@ -0,0 +1,172 @@
+// Scaling benchmark: grow the store through each power of 10 from
+// 1e3 messages up to a maximum, measuring at each size.
+//
+// usage: scale-bench [-n MAX_MSGS] [-q N_QUERIES]
+//
+// MAX_MSGS defaults to 1e8, which needs tens of GB of memory.  At
+// each size the benchmark reports the ADD throughput for the
+// messages added since the previous size, the median and p99
+// latencies of N_QUERIES (default 200) queries of each of these
+// kinds:
+//
+//   hot:   the newest 10 messages of a room getting half the traffic
+//   cold:  the newest 10 messages of a room getting 1 in 10000
+//   rare:  the newest 10 messages of the hot room with a topic on
+//          1 in 10000 of its messages
+//
+// and the heap bytes per message.  ADDs are fed to chat_io() in
+// batches; queries are fed one at a time.
+
+#include "chat.h"
+#include "chat-io.h"
+#include "errnum.h"
+
+#include <errors.h>
+
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+enum {
+  N_ROOMS = 1000,       // rooms other than hot and cold
+  N_TOPICS = 50,
+  N_USERS = 1000,
+  RARE_PERIOD = 10000,  // 1 in RARE_PERIOD messages is cold or rare
+  BATCH_SIZE = 10000,   // ADDs per call to chat_io()
+  MAX_ADD_LEN = 128,
+};
+
+typedef enum { QUERY_HOT, QUERY_COLD, QUERY_RARE, N_QUERY_KINDS } QueryKind;
+
+static const char *queryCmds[N_QUERY_KINDS] = {
+  [QUERY_HOT] = "? hot 10\n.\n",
+  [QUERY_COLD] = "? cold 10\n.\n",
+  [QUERY_RARE] = "? hot 10 #rare\n.\n",
+};
+
+static const char *queryNames[N_QUERY_KINDS] = {
+  [QUERY_HOT] = "hot", [QUERY_COLD] = "cold", [QUERY_RARE] = "rare",
+};
+
+static FILE *devNull;
+static uint64_t rngState = 88172645463325252ULL;
+
+static uint64_t next_random(void) {
+  rngState ^= rngState << 13; rngState ^= rngState >> 7; rngState ^= rngState << 17;
+  return rngState;
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run_commands(char *cmds, size_t len) {
+  FILE *in = fmemopen(cmds, len, "r");
+  if (in == NULL) fatal("cannot open command stream:");
+  chat_io("", in, devNull, devNull);
+  fclose(in);
+}
+
+// Append the ADD command for message seq to buf[*len].
+static void add_command(char *buf, size_t *len, size_t seq) {
+  char *p = buf + *len;
+  int n;
+  if (seq % RARE_PERIOD == RARE_PERIOD/2) {
+    n = sprintf(p, "+ @u%u cold #t%u", (unsigned)(next_random() % N_USERS),
+                (unsigned)(next_random() % N_TOPICS));
+  }
+  else if (seq % 2 == 0) {
+    n = sprintf(p, "+ @u%u hot #t%u%s", (unsigned)(next_random() % N_USERS),
+                (unsigned)(next_random() % N_TOPICS),
+                seq % RARE_PERIOD == 0 ? " #rare" : "");
+  }
+  else {
+    n = sprintf(p, "+ @u%u r%u #t%u", (unsigned)(next_random() % N_USERS),
+                (unsigned)(next_random() % N_ROOMS),
+                (unsigned)(next_random() % N_TOPICS));
+  }
+  n += sprintf(p + n, "\nmessage %zu\n.\n", seq);
+  *len += n;
+}
+
+// Large blocks are mmap()ed by malloc and not counted in uordblks.
+static size_t heap_in_use(void) {
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+static int compare_doubles(const void *p1, const void *p2) {
+  double d1 = *(const double *)p1, d2 = *(const double *)p2;
+  return (d1 > d2) - (d1 < d2);
+}
+
+int
+main(int argc, char *argv[])
+{
+  double maxMsgs = 1e8;
+  size_t nQueries = 200;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:q:")) != -1) {
+    switch (opt) {
+    case 'n': maxMsgs = atof(optarg); break;
+    case 'q': nQueries = atol(optarg); break;
+    default: fatal("usage: %s [-n MAX_MSGS] [-q N_QUERIES]", argv[0]);
+    }
+  }
+  devNull = fopen("/dev/null", "w");
+  char *batch = malloc(BATCH_SIZE * MAX_ADD_LEN);
+  double *latencies = malloc(nQueries * sizeof(double));
+  if (devNull == NULL || batch == NULL || latencies == NULL) {
+    fatal("%s", errnum_to_string(MEM_ERR));
+  }
+
+  printf("%12s %12s", "messages", "adds/s");
+  for (int k = 0; k < N_QUERY_KINDS; k++) {
+    printf(" %8s-p50 %8s-p99", queryNames[k], queryNames[k]);
+  }
+  printf(" %10s\n", "bytes/msg");
+
+  size_t heap0 = heap_in_use();
+  size_t nMsgs = 0;
+  for (double size = 1e3; size <= maxMsgs; size *= 10) {
+    size_t target = (size_t)size;
+    size_t nAdded = target - nMsgs;
+    double addNs = 0;
+    while (nMsgs < target) {
+      size_t len = 0;
+      size_t end = nMsgs + BATCH_SIZE < target ? nMsgs + BATCH_SIZE : target;
+      for (; nMsgs < end; nMsgs++) add_command(batch, &len, nMsgs);
+      double t0 = now_ns();
+      run_commands(batch, len);
+      addNs += now_ns() - t0;
+    }
+    printf("%12zu %12.0f", target, nAdded / (addNs / 1e9));
+    for (int k = 0; k < N_QUERY_KINDS; k++) {
+      char cmd[32];
+      size_t len = strlen(queryCmds[k]);
+      for (size_t i = 0; i < nQueries; i++) {
+        memcpy(cmd, queryCmds[k], len);      //fmemopen() needs it writable
+        double t0 = now_ns();
+        run_commands(cmd, len);
+        latencies[i] = now_ns() - t0;
+      }
+      qsort(latencies, nQueries, sizeof(double), compare_doubles);
+      printf(" %9.1fus %9.1fus", latencies[nQueries/2] / 1e3,
+             latencies[(size_t)(0.99 * (nQueries - 1))] / 1e3);
+    }
+    printf(" %10.1f\n", (double)(heap_in_use() - heap0) / nMsgs);
+    fflush(stdout);
+  }
+
+  free_chats();
+  free(batch);
+  free(latencies);
+  fclose(devNull);
+  return 0;
+}
@@ -0,0 +1,187 @@
+#include "server.h"
+
+#include "chat-io.h"
+#include "errnum.h"
+#include "perfctr.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+enum { LISTEN_BACKLOG = 128 };
+
+typedef struct Connection {
+  int fd;
+  pthread_t thread;
+  bool isDone;                  // protected by connLock
+  struct Connection *next;
+} Connection;
+
+// The list of connections is only changed by the accepting thread;
+// each connection's thread only sets its isDone.
+static pthread_mutex_t connLock = PTHREAD_MUTEX_INITIALIZER;
+static Connection *connections;
+
+// Write end of the pipe on which SIGINT and SIGTERM wake the
+// accepting thread
+static int stopFd = -1;
+
+static void on_stop(int sig) {
+  char c = 0;
+  ssize_t n = write(stopFd, &c, 1);
+  (void)n;
+}
+
+// Run chat_io() over conn, with its own perf counters (if enabled)
+// whose counts are added to the totals when it ends.  It reads and
+// writes through FILEs on copies of conn->fd, so conn->fd stays open
+// (for serve_chat() to shut down) until conn is reaped; the client
+// sees the connection end when it is shut down here.
+static void *serve_connection(void *arg) {
+  Connection *conn = arg;
+  int inFd = dup(conn->fd);
+  int outFd = dup(conn->fd);
+  FILE *in = inFd < 0 ? NULL : fdopen(inFd, "r");
+  FILE *out = outFd < 0 ? NULL : fdopen(outFd, "w");
+  if (in != NULL && out != NULL) {
+    open_thread_perf_counters();
+    chat_io(SERVER_PROMPT, in, out, out);
+    close_thread_perf_counters();
+  }
+  if (in != NULL) fclose(in);
+  else if (inFd >= 0) close(inFd);
+  if (out != NULL) fclose(out);
+  else if (outFd >= 0) close(outFd);
+  shutdown(conn->fd, SHUT_RDWR);
+  pthread_mutex_lock(&connLock);
+  conn->isDone = true;
+  pthread_mutex_unlock(&connLock);
+  return NULL;
+}
+
+// Join and free the connections which are done, or all of them (once
+// shut down, so their commands end at EOF) if isAll.
+static void reap_connections(bool isAll) {
+  Connection *reaped = NULL;
+  pthread_mutex_lock(&connLock);
+  for (Connection **p = &connections; *p != NULL; ) {
+    Connection *conn = *p;
+    if (!isAll && !conn->isDone) {
+      p = &conn->next;
+      continue;
+    }
+    if (isAll) shutdown(conn->fd, SHUT_RDWR);
+    *p = conn->next;
+    conn->next = reaped;
+    reaped = conn;
+  }
+  pthread_mutex_unlock(&connLock);
+  while (reaped != NULL) {
+    Connection *conn = reaped;
+    reaped = conn->next;
+    pthread_join(conn->thread, NULL);
+    close(conn->fd);
+    free(conn);
+  }
+}
+
+// Return a socket listening on port, or -1.
+static int open_listener(const char *port) {
+  struct addrinfo hints = {
+    .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE,
+  };
+  struct addrinfo *addrs;
+  if (getaddrinfo(NULL, port, &hints, &addrs) != 0) return -1;
+  int fd = -1;
+  for (struct addrinfo *a = addrs; a != NULL && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd < 0) continue;
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, a->ai_addr, a->ai_addrlen) != 0 ||
+        listen(fd, LISTEN_BACKLOG) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addrs);
+  return fd;
+}
+
+// Start a thread serving the accepted socket fd, returning false if
+// it cannot be started.  Responses are flushed a command at a time,
+// so Nagle's algorithm would only delay them.
+static bool add_connection(int fd, ErrNum *err) {
+  int on = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  Connection *conn = calloc(1, sizeof(Connection));
+  if (conn == NULL) {
+    *err = MEM_ERR;
+    return false;
+  }
+  conn->fd = fd;
+  if (pthread_create(&conn->thread, NULL, serve_connection, conn) != 0) {
+    free(conn);
+    return false;
+  }
+  pthread_mutex_lock(&connLock);
+  conn->next = connections;
+  connections = conn;
+  pthread_mutex_unlock(&connLock);
+  return true;
+}
+
+void serve_chat(const char *port, ErrNum *err) {
+  *err = NO_ERR;
+  int listenFd = open_listener(port);
+  int pipeFds[2];
+  if (listenFd < 0 || pipe(pipeFds) != 0) {
+    if (listenFd >= 0) close(listenFd);
+    *err = IO_ERR;
+    return;
+  }
+  stopFd = pipeFds[1];
+  struct sigaction stop = { .sa_handler = on_stop };
+  struct sigaction ignore = { .sa_handler = SIG_IGN };
+  struct sigaction oldInt, oldTerm, oldPipe;
+  sigemptyset(&stop.sa_mask);
+  sigemptyset(&ignore.sa_mask);
+  sigaction(SIGINT, &stop, &oldInt);
+  sigaction(SIGTERM, &stop, &oldTerm);
+  sigaction(SIGPIPE, &ignore, &oldPipe);  //a write to a closed socket fails
+
+  struct pollfd fds[] = {
+    { .fd = listenFd, .events = POLLIN },
+    { .fd = pipeFds[0], .events = POLLIN },
+  };
+  while (*err == NO_ERR) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno != EINTR) *err = IO_ERR;
+      continue;
+    }
+    if (fds[1].revents != 0) break;
+    if (fds[0].revents == 0) continue;
+    int fd = accept(listenFd, NULL, NULL);
+    if (fd < 0) continue;       //e.g. the client already gave up
+    reap_connections(false);
+    if (!add_connection(fd, err)) close(fd);
+  }
+  reap_connections(true);
+
+  sigaction(SIGINT, &oldInt, NULL);
+  sigaction(SIGTERM, &oldTerm, NULL);
+  sigaction(SIGPIPE, &oldPipe, NULL);
+  close(listenFd);
+  close(pipeFds[0]);
+  close(pipeFds[1]);
+  stopFd = -1;
+}
@@ -0,0 +1,36 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include "errnum.h"
+
+/** Serving chat_io() (see chat-io.h) over TCP.
+ *
+ *  When environment variable CHAT_LISTEN gives a port, chat listens
+ *  on it (on all interfaces) instead of reading stdin, and runs each
+ *  connection's commands in its own thread with both its responses
+ *  and errors written to the connection.  Connections share the
+ *  store, which each only locks while running a command.  With
+ *  CHAT_PERF (see perfctr.h) each connection counts its commands on
+ *  its own counters, and the totals of all of them are reported at
+ *  exit.
+ *
+ *  Each response (including the empty response to a successful ADD)
+ *  is followed by SERVER_PROMPT, a line holding just '.', the prompt
+ *  for the next command, which is also sent when a connection opens.  As a
+ *  message line starting with '.' ends the message, no line of a
+ *  response can be mistaken for it, so clients may send commands
+ *  without waiting and match each prompt to the oldest command
+ *  outstanding.  Every line read as a command gets its prompt: so
+ *  does the '.' line optionally ending a QUERY, and so does each line
+ *  after a malformed ADD's command line.
+ */
+
+#define SERVER_PROMPT ".\n"
+
+/** Serve connections on port until SIGINT or SIGTERM, then close
+ *  them all (waiting for their commands to finish) and return.  Sets
+ *  *err to IO_ERR if port cannot be listened on, or MEM_ERR.
+ */
+void serve_chat(const char *port, ErrNum *err);
+
+#endif //#ifndef SERVER_H_
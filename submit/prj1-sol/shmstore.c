@@ -0,0 +1,206 @@
+#define _GNU_SOURCE             // mremap(), writer-preferring rwlocks
+
+#include "shmstore.h"
+
+#include "chat.h"
+#include "errnum.h"
+#include "storemem.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Layout of the object
+//
+// A header fills the first page and is followed by store memory.  The
+// header starts with what a reader checks before mapping the object;
+// the lock is the only part of the object readers write, so they map
+// the first page writable and the rest read-only.
+
+#define SHM_MAGIC 0x32304d4853544843ULL   // "CHTSHM02"
+
+typedef struct {
+  _Atomic uint64_t magic;       // stored last by the writer
+  uint64_t size;                // bytes reserved for the object
+  uint64_t pageSize;            // bytes of the header
+  StoreRef chats;               // see share_chats()
+  pthread_rwlock_t lock;
+  StoreRegion region;
+} ShmHeader;
+
+static ShmHeader *header = NULL;
+static size_t mapSize;          // header->size, once mapped
+static bool isWriter = false;
+
+// Writer only
+static char *shmName = NULL;
+static int shmFd = -1;
+
+// Return the bytes to reserve for the object
+static size_t reserved_size(size_t pageSize) {
+  const char *mb = getenv("CHAT_SHM_MB");
+  size_t size = (mb == NULL ? SHM_DEFAULT_MB : atol(mb)) * ((size_t)1 << 20);
+  return size < 2 * pageSize ? 2 * pageSize : size;
+}
+
+// Initialize the lock which readers and the writer share; the writer
+// is preferred so that a stream of queries cannot starve it
+static bool init_lock(pthread_rwlock_t *lock) {
+  pthread_rwlockattr_t attr;
+  if (pthread_rwlockattr_init(&attr) != 0) return false;
+  bool ok =
+    pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) == 0 &&
+    pthread_rwlockattr_setkind_np(
+      &attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP) == 0 &&
+    pthread_rwlock_init(lock, &attr) == 0;
+  pthread_rwlockattr_destroy(&attr);
+  return ok;
+}
+
+// Create the object name, replacing any existing one (whose readers
+// keep it until they detach), and move the empty store into it
+static void create_store(const char *name, ErrNum *err) {
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  size_t size = reserved_size(pageSize);
+  shm_unlink(name);
+  shmFd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (shmFd < 0) {
+    *err = IO_ERR;
+    return;
+  }
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shmFd, 0);
+  if (p == MAP_FAILED) {
+    close(shmFd);
+    shm_unlink(name);
+    *err = IO_ERR;
+    return;
+  }
+  header = p;
+  mapSize = size;
+  isWriter = true;
+  shmName = strdup(name);
+  if (shmName == NULL) *err = MEM_ERR;
+  if (*err == NO_ERR) {
+    init_store_region(p, size, shmFd, offsetof(ShmHeader, region), pageSize,
+                      err);
+  }
+  if (*err == NO_ERR) {
+    header->size = size;
+    header->pageSize = pageSize;
+    if (!init_lock(&header->lock)) *err = IO_ERR;
+  }
+  if (*err == NO_ERR) header->chats = share_chats(err);
+  if (*err != NO_ERR) {
+    close_shm_store();
+    *err = IO_ERR;
+    return;
+  }
+  atomic_store_explicit(&header->magic, SHM_MAGIC, memory_order_release);
+}
+
+// Map the object name, read-only but for its lock
+static void attach_store(const char *name, ErrNum *err) {
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) {
+    *err = IO_ERR;
+    return;
+  }
+  uint64_t start[3];            // magic, size and pageSize
+  if (pread(fd, start, sizeof(start), 0) != sizeof(start) ||
+      start[0] != SHM_MAGIC || start[2] != (size_t)sysconf(_SC_PAGESIZE)) {
+    close(fd);
+    *err = IO_ERR;
+    return;
+  }
+  void *p = mmap(NULL, start[1], PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    *err = IO_ERR;
+    return;
+  }
+  if (mprotect(p, start[2], PROT_READ | PROT_WRITE) != 0) {
+    munmap(p, start[1]);
+    *err = IO_ERR;
+    return;
+  }
+  header = p;
+  mapSize = start[1];
+  attach_store_region(p);
+  attach_chats(header->chats);
+}
+
+void init_shm_store(ErrNum *err) {
+  *err = NO_ERR;
+  const char *name = getenv("CHAT_SHM");
+  const char *attach = getenv("CHAT_SHM_ATTACH");
+  if (name != NULL && *name != '\0') {
+    create_store(name, err);
+  }
+  else if (attach != NULL && *attach != '\0') {
+    attach_store(attach, err);
+  }
+}
+
+bool is_shm_writer(void) {
+  return isWriter;
+}
+
+bool is_shm_reader(void) {
+  return header != NULL && !isWriter;
+}
+
+void lock_shm_store(void) {
+  if (header == NULL) return;
+  if (isWriter) pthread_rwlock_wrlock(&header->lock);
+  else pthread_rwlock_rdlock(&header->lock);
+}
+
+void unlock_shm_store(void) {
+  if (header != NULL) pthread_rwlock_unlock(&header->lock);
+}
+
+// Only the committed part of the object can be in use, so only it is
+// copied; the rest of the mapping is left untouched.
+bool privatize_shm_store(void) {
+  size_t n = header->region.committed;
+  void *copy = mmap(NULL, n, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (copy == MAP_FAILED) return false;
+  memcpy(copy, header, n);
+  if (mremap(copy, n, n, MREMAP_MAYMOVE | MREMAP_FIXED, header) ==
+      MAP_FAILED) {
+    munmap(copy, n);
+    return false;
+  }
+  return true;
+}
+
+bool get_shm_stats(ShmStats *stats) {
+  if (header == NULL) return false;
+  stats->inUse = header->region.inUse;
+  stats->committed = header->region.committed;
+  stats->size = header->region.size;
+  stats->nFailed = header->region.nFailed;
+  return true;
+}
+
+void close_shm_store(void) {
+  if (header == NULL) return;
+  munmap(header, mapSize);
+  header = NULL;
+  close_store_region();
+  if (isWriter) {
+    close(shmFd);
+    if (shmName != NULL) shm_unlink(shmName);
+    free(shmName);
+    shmName = NULL;
+    shmFd = -1;
+    isWriter = false;
+  }
+}
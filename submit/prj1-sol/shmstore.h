@@ -0,0 +1,83 @@
+#ifndef SHMSTORE_H_
+#define SHMSTORE_H_
+
+#include "errnum.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** The store in POSIX shared memory, so that other processes can
+ *  query it while a single writer process adds messages.
+ *
+ *  The writer allocates all of the store's memory (the message arena,
+ *  offsets and tombstones, the dictionaries, posting lists and bitmaps
+ *  of the indexes, and the shared bodies; see storemem.h) from the
+ *  shared memory object, where everything refers to everything else
+ *  by its offset from the start of the object.  Readers map the object
+ *  anywhere and run the same queries, over the same indexes, as the
+ *  writer.  Deleting, expiring and compacting work as usual, and space
+ *  freed by them is reused.
+ *
+ *  Readers and the writer are serialized by a process-shared,
+ *  writer-preferring read-write lock in the object, which the writer
+ *  takes for writing and readers take for reading around every use of
+ *  the store (see sweeper.h).  A reader which dies holding it blocks
+ *  the writer, as a stuck thread of the writer would.
+ *
+ *  Environment variable CHAT_SHM names the object for a writer; its
+ *  address space is reserved up front (CHAT_SHM_MB megabytes, default
+ *  SHM_DEFAULT_MB) but only committed as it is used.  Once it is full
+ *  ADD reports MEM_ERR until space is freed, and STATS shows the
+ *  refused allocations to writer and readers alike; readers go on
+ *  seeing every change the writer does make.  CHAT_SHM_ATTACH names
+ *  the object for a reader, which can run every command which does
+ *  not change the store.
+ */
+
+enum { SHM_DEFAULT_MB = 1024 };
+
+/** Counters describing the shared memory object. */
+typedef struct {
+  size_t inUse;         // bytes of store memory allocated
+  size_t committed;     // bytes of the object committed
+  size_t size;          // bytes reserved for it
+  size_t nFailed;       // # of allocations refused once it was full
+} ShmStats;
+
+/** Create (for a writer) or attach to (for a reader) the shared memory
+ *  object if the environment asks for one.  A writer must do so before
+ *  anything is added to the store.  Sets *err to IO_ERR if it cannot
+ *  be created or mapped, or is not a store.
+ */
+void init_shm_store(ErrNum *err);
+
+/** Return true if this process is writing to or reading from a shared
+ *  memory object.
+ */
+bool is_shm_writer(void);
+bool is_shm_reader(void);
+
+/** Acquire and release the object's lock, for writing in the writer
+ *  and for reading in a reader; does nothing without an object.
+ */
+void lock_shm_store(void);
+void unlock_shm_store(void);
+
+/** Replace this process's mapping of the object by a private copy, so
+ *  that it keeps the store as it is now while the writer goes on
+ *  changing it.  For a forked child of the writer (see bgsave.h); the
+ *  lock must be held.  Returns false on failure.
+ */
+bool privatize_shm_store(void);
+
+/** Fill in *stats; returns false if there is no shared memory
+ *  object.  The lock must be held.
+ */
+bool get_shm_stats(ShmStats *stats);
+
+/** Unmap the object; a writer also removes its name, though readers
+ *  still attached can go on querying it.
+ */
+void close_shm_store(void);
+
+#endif //#ifndef SHMSTORE_H_
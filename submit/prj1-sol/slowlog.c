@@ -0,0 +1,161 @@
+#include "slowlog.h"
+
+#include "errnum.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum {
+  RING_SIZE = 256,      // must be a power of 2
+  MAX_LINE_LEN = 200,   // longer command lines are truncated
+  DRAIN_SLEEP_NS = 10 * 1000 * 1000,
+};
+
+typedef struct {
+  struct timespec when;
+  double durationNs;
+  size_t nExamined;
+  char line[MAX_LINE_LEN + 1];
+} SlowLogEntry;
+
+// A bounded multi-producer/single-consumer ring.  Entry n goes in
+// slot n % RING_SIZE, whose seq is n while the slot is free for it,
+// n + 1 once the entry is written, and n + RING_SIZE once the drain
+// thread has written it out (freeing the slot for entry
+// n + RING_SIZE).  A producer claims entry head by advancing head with
+// a CAS, so concurrent producers claim distinct slots; a producer
+// finding its slot still holding entry head - RING_SIZE knows the ring
+// is full.  The release/acquire pairs on seq order the entry contents
+// with respect to the slot handovers.
+typedef struct {
+  atomic_size_t seq;
+  SlowLogEntry entry;
+} SlowLogSlot;
+
+static SlowLogSlot ring[RING_SIZE];
+static atomic_size_t head;
+static size_t tail;             // drain thread only
+static atomic_bool isStopping;
+static atomic_size_t nDropped;
+
+static bool isEnabled = false;
+static double thresholdNs;
+static FILE *logFile;
+static pthread_t drainThread;
+
+static void write_entry(const SlowLogEntry *entry) {
+  fprintf(logFile, "%lld.%06ld %.1fus examined %zu: %s\n",
+          (long long)entry->when.tv_sec, entry->when.tv_nsec / 1000,
+          entry->durationNs / 1e3, entry->nExamined, entry->line);
+}
+
+// Write out entries as they appear until stopped, then drain the rest.
+static void *drain(void *arg) {
+  for (;;) {
+    bool stopping = atomic_load_explicit(&isStopping, memory_order_acquire);
+    size_t t = tail;
+    for (;; t++) {
+      SlowLogSlot *slot = &ring[t % RING_SIZE];
+      if (atomic_load_explicit(&slot->seq, memory_order_acquire) != t + 1) {
+        break;
+      }
+      write_entry(&slot->entry);
+      atomic_store_explicit(&slot->seq, t + RING_SIZE, memory_order_release);
+    }
+    if (t == tail) {
+      if (stopping) break;
+      struct timespec pause = { 0, DRAIN_SLEEP_NS };
+      nanosleep(&pause, NULL);
+      continue;
+    }
+    fflush(logFile);
+    tail = t;
+  }
+  return NULL;
+}
+
+void init_slow_log(ErrNum *err) {
+  *err = NO_ERR;
+  const char *path = getenv("CHAT_SLOW_LOG");
+  if (path == NULL || *path == '\0') return;
+  const char *us = getenv("CHAT_SLOW_US");
+  thresholdNs = 1e3 * (us == NULL ? SLOW_LOG_DEFAULT_US : atof(us));
+  logFile = fopen(path, "a");
+  if (logFile == NULL) {
+    *err = IO_ERR;
+    return;
+  }
+  for (size_t i = 0; i < RING_SIZE; i++) atomic_store(&ring[i].seq, i);
+  atomic_store(&head, 0);
+  tail = 0;
+  atomic_store(&isStopping, false);
+  atomic_store(&nDropped, 0);
+  if (pthread_create(&drainThread, NULL, drain, NULL) != 0) {
+    fclose(logFile);
+    *err = IO_ERR;
+    return;
+  }
+  isEnabled = true;
+}
+
+bool slow_log_wants(double durationNs) {
+  return isEnabled && durationNs >= thresholdNs;
+}
+
+void slow_log_command(const char *line, size_t lineLen, size_t nExamined,
+                      double durationNs) {
+  if (!isEnabled) return;
+  size_t h = atomic_load_explicit(&head, memory_order_relaxed);
+  SlowLogSlot *slot;
+  for (;;) {
+    slot = &ring[h % RING_SIZE];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if (seq == h) {
+      // on failure h is reloaded with the head claimed by another
+      if (atomic_compare_exchange_weak_explicit(&head, &h, h + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        break;
+      }
+    }
+    else if (seq < h) {         // still holding entry h - RING_SIZE
+      atomic_fetch_add(&nDropped, 1);
+      return;
+    }
+    else {                      // entry h was claimed already
+      h = atomic_load_explicit(&head, memory_order_relaxed);
+    }
+  }
+  SlowLogEntry *entry = &slot->entry;
+  clock_gettime(CLOCK_REALTIME, &entry->when);
+  entry->durationNs = durationNs;
+  entry->nExamined = nExamined;
+  // the line may end with its newline or with a NUL from the lexer
+  while (lineLen > 0 &&
+         (line[lineLen - 1] == '\n' || line[lineLen - 1] == '\0')) {
+    lineLen--;
+  }
+  if (lineLen > MAX_LINE_LEN) lineLen = MAX_LINE_LEN;
+  for (size_t i = 0; i < lineLen; i++) {
+    entry->line[i] = line[i] == '\0' ? ' ' : line[i];
+  }
+  entry->line[lineLen] = '\0';
+  atomic_store_explicit(&slot->seq, h + 1, memory_order_release);
+}
+
+void close_slow_log(void) {
+  if (!isEnabled) return;
+  atomic_store_explicit(&isStopping, true, memory_order_release);
+  pthread_join(drainThread, NULL);
+  size_t dropped = atomic_load(&nDropped);
+  if (dropped > 0) {
+    fprintf(logFile, "%zu slow commands dropped\n", dropped);
+  }
+  fclose(logFile);
+  isEnabled = false;
+}
@@ -0,0 +1,44 @@
+#ifndef SLOWLOG_H_
+#define SLOWLOG_H_
+
+#include "errnum.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Log of commands slower than a threshold.
+ *
+ *  The log is enabled by setting environment variable CHAT_SLOW_LOG to
+ *  the path of the log file (which is appended to); CHAT_SLOW_US gives
+ *  the threshold in microseconds (default SLOW_LOG_DEFAULT_US).
+ *
+ *  Entries are handed from the serving threads (see server.h) to a
+ *  background thread through a fixed-size multi-producer/single-
+ *  consumer ring, so logging never blocks, neither on the file nor on
+ *  other serving threads: if the ring is full the entry is dropped and
+ *  counted.  Each entry records the command line (but not a message
+ *  body), the # of candidates examined and the duration.
+ */
+
+enum { SLOW_LOG_DEFAULT_US = 10000 };
+
+/** Start the slow-command log if it is enabled by the environment.
+ *  Sets *err to IO_ERR if the log file cannot be opened or its
+ *  thread cannot be started.
+ */
+void init_slow_log(ErrNum *err);
+
+/** Return true if a command taking durationNs should be logged. */
+bool slow_log_wants(double durationNs);
+
+/** Log a command which took durationNs after examining nExamined
+ *  candidates.  line[lineLen] is the command line; NULs within it
+ *  (left by the lexer) are logged as spaces.  Never blocks.
+ */
+void slow_log_command(const char *line, size_t lineLen, size_t nExamined,
+                      double durationNs);
+
+/** Drain the log, stop its thread and close its file. */
+void close_slow_log(void);
+
+#endif //#ifndef SLOWLOG_H_
@@ -0,0 +1,165 @@
+#include "storemem.h"
+
+#include "errnum.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+
+// In a region, a block is carved from the end of what was ever
+// allocated unless a freed block of its size class is on that class's
+// list (linked through the first word of each block).  Size classes
+// keep the waste of rounding below 1/3 and make a freed block fit any
+// later request of its class, which suits structures that grow by
+// doubling.  Space is committed a granule at a time as the end
+// advances; committed space is never given back, but freed blocks are
+// reused.
+
+enum {
+  STORE_ALIGN = 16,
+  STORE_SMALL_MAX = 1024,       // largest of the multiples of 16
+  STORE_COMMIT_SIZE = 1 << 20,  // granule of committed space
+};
+
+#define STORE_MAX_BLOCK ((size_t)1 << 47)
+
+uint8_t *storeBase = NULL;
+
+static StoreRegion *region = NULL;
+static int regionFd = -1;
+
+// Return the size class of a block of n bytes
+static size_t size_class(size_t n) {
+  if (n <= STORE_SMALL_MAX) return n == 0 ? 0 : (n - 1) / STORE_ALIGN;
+  unsigned log2 = 64 - __builtin_clzll(n - 1);  // of the power of 2 >= n
+  size_t p = (size_t)1 << log2;
+  return STORE_SMALL_MAX / STORE_ALIGN + 2 * (log2 - 11) + (n > p / 4 * 3);
+}
+
+// Return the # of bytes of a block of size class c
+static size_t class_size(size_t c) {
+  if (c < STORE_SMALL_MAX / STORE_ALIGN) return (c + 1) * STORE_ALIGN;
+  size_t k = c - STORE_SMALL_MAX / STORE_ALIGN;
+  size_t p = (size_t)2048 << (k / 2);
+  return k % 2 == 0 ? p / 4 * 3 : p;
+}
+
+// Make the region's first end bytes usable, committing space to it if
+// necessary; returns false once the object is full.
+static bool commit_to(size_t end) {
+  if (end <= region->committed) return true;
+  if (end > region->size) return false;
+  size_t committed =
+    (end + STORE_COMMIT_SIZE - 1) / STORE_COMMIT_SIZE * STORE_COMMIT_SIZE;
+  if (committed > region->size) committed = region->size;
+  if (posix_fallocate(regionFd, region->committed,
+                      committed - region->committed) != 0) {
+    return false;
+  }
+  region->committed = committed;
+  return true;
+}
+
+static StoreRef region_alloc(size_t n, ErrNum *err) {
+  size_t c = n <= STORE_MAX_BLOCK ? size_class(n) : STORE_N_CLASSES;
+  size_t size = c < STORE_N_CLASSES ? class_size(c) : 0;
+  StoreRef ref = c < STORE_N_CLASSES ? region->freeLists[c] : 0;
+  if (ref != 0) {
+    memcpy(&region->freeLists[c], store_at(ref), sizeof(StoreRef));
+  }
+  else if (c < STORE_N_CLASSES && commit_to(region->len + size)) {
+    ref = region->len;
+    region->len += size;
+  }
+  else {
+    region->nFailed++;
+    *err = MEM_ERR;
+    return 0;
+  }
+  region->inUse += size;
+  return ref;
+}
+
+static void region_free(StoreRef ref, size_t n) {
+  size_t c = size_class(n);
+  memcpy(store_at(ref), &region->freeLists[c], sizeof(StoreRef));
+  region->freeLists[c] = ref;
+  region->inUse -= class_size(c);
+}
+
+// A block of the same class is resized in place, as is the last block
+// of the region when it grows.
+static StoreRef region_realloc(StoreRef ref, size_t oldN, size_t n,
+                               ErrNum *err) {
+  if (n > STORE_MAX_BLOCK) {
+    region->nFailed++;
+    *err = MEM_ERR;
+    return ref;
+  }
+  size_t oldC = size_class(oldN), c = size_class(n);
+  if (c == oldC) return ref;
+  size_t oldSize = class_size(oldC), size = class_size(c);
+  if (c > oldC && ref + oldSize == region->len && commit_to(ref + size)) {
+    region->len = ref + size;
+    region->inUse += size - oldSize;
+    return ref;
+  }
+  StoreRef moved = region_alloc(n, err);
+  if (*err != NO_ERR) return ref;
+  memcpy(store_at(moved), store_at(ref), oldN < n ? oldN : n);
+  region_free(ref, oldN);
+  return moved;
+}
+
+StoreRef store_alloc(size_t n, ErrNum *err) {
+  *err = NO_ERR;
+  if (region != NULL) return region_alloc(n, err);
+  void *p = malloc(n > 0 ? n : 1);
+  if (p == NULL) *err = MEM_ERR;
+  return store_ref(p);
+}
+
+StoreRef store_realloc(StoreRef ref, size_t oldN, size_t n, ErrNum *err) {
+  *err = NO_ERR;
+  if (ref == 0) return store_alloc(n, err);
+  if (region != NULL) return region_realloc(ref, oldN, n, err);
+  void *p = realloc(store_at(ref), n > 0 ? n : 1);
+  if (p == NULL) {
+    *err = MEM_ERR;
+    return ref;
+  }
+  return store_ref(p);
+}
+
+void store_free(StoreRef ref, size_t n) {
+  if (ref == 0) return;
+  if (region != NULL) region_free(ref, n);
+  else free(store_at(ref));
+}
+
+void init_store_region(uint8_t *base, size_t size, int fd,
+                       size_t regionOffset, size_t len, ErrNum *err) {
+  *err = NO_ERR;
+  len = (len + STORE_ALIGN - 1) / STORE_ALIGN * STORE_ALIGN;
+  size_t committed =
+    (len + STORE_COMMIT_SIZE - 1) / STORE_COMMIT_SIZE * STORE_COMMIT_SIZE;
+  if (committed > size) committed = size;
+  if (len > size || posix_fallocate(fd, 0, committed) != 0) {
+    *err = MEM_ERR;
+    return;
+  }
+  storeBase = base;
+  region = (StoreRegion *)(base + regionOffset);
+  regionFd = fd;
+  *region = (StoreRegion) { .size = size, .committed = committed, .len = len };
+}
+
+void attach_store_region(uint8_t *base) {
+  storeBase = base;
+}
+
+void close_store_region(void) {
+  storeBase = NULL;
+  region = NULL;
+  regionFd = -1;
+}
@@ -0,0 +1,96 @@
+#ifndef STOREMEM_H_
+#define STOREMEM_H_
+
+#include "errnum.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Memory of the store's structures (arenas, posting lists, bitmaps,
+ *  dictionaries and the name tables).  Each structure refers to the
+ *  memory it owns by a StoreRef: the offset of that memory from
+ *  storeBase.
+ *
+ *  Normally storeBase is NULL, so a reference is just the address of
+ *  memory from malloc().  When the store lives in a shared memory
+ *  object (see shmstore.h), storeBase is where the object is mapped
+ *  and memory is allocated from a StoreRegion at its start.  Either
+ *  way, reference 0 is never allocated and stands for none, and
+ *  references stay valid in any process mapping the object.
+ *
+ *  Memory is freed with the size it was allocated with, so that the
+ *  region needs no per-block headers.  The allocator is not
+ *  thread-safe: like every change to the store it must be serialized
+ *  by the store lock (see sweeper.h).
+ */
+
+typedef uint64_t StoreRef;
+
+/** Blocks are rounded up to one of these sizes: multiples of 16
+ *  bytes up to 1 KiB, then 3/4 of and a power of 2 alternately.
+ */
+enum { STORE_N_CLASSES = 64 + 2 * (48 - 11) };
+
+/** The allocator's state at the start of a shared memory object; all
+ *  offsets are from the start of the object.
+ */
+typedef struct {
+  uint64_t size;        // bytes reserved for the object
+  uint64_t committed;   // bytes committed to the object
+  uint64_t len;         // bytes ever allocated, from the start
+  uint64_t inUse;       // bytes of blocks allocated and not yet freed
+  uint64_t nFailed;     // # of allocations refused once full
+  StoreRef freeLists[STORE_N_CLASSES]; // freed blocks of each size
+} StoreRegion;
+
+extern uint8_t *storeBase;
+
+/** Return the memory referred to by ref. */
+static inline void *store_at(StoreRef ref) {
+  return (void *)((uintptr_t)storeBase + ref);
+}
+
+/** Like store_at(), but return NULL for reference 0. */
+static inline void *store_ptr(StoreRef ref) {
+  return ref == 0 ? NULL : store_at(ref);
+}
+
+/** Return the reference to p, which is NULL or in store memory. */
+static inline StoreRef store_ref(const void *p) {
+  return p == NULL ? 0 : (uintptr_t)p - (uintptr_t)storeBase;
+}
+
+/** Return a reference to n bytes of uninitialized memory.  Sets *err
+ *  to MEM_ERR on failure.
+ */
+StoreRef store_alloc(size_t n, ErrNum *err);
+
+/** Resize the oldN bytes at ref (0 for none) to n bytes, returning the
+ *  possibly moved reference.  Sets *err to MEM_ERR on failure,
+ *  leaving ref as it was.
+ */
+StoreRef store_realloc(StoreRef ref, size_t oldN, size_t n, ErrNum *err);
+
+/** Free the n bytes at ref; does nothing for reference 0. */
+void store_free(StoreRef ref, size_t n);
+
+/** Allocate store memory from the empty object of size bytes mapped
+ *  at base and open as fd, keeping the StoreRegion at offset
+ *  regionOffset and leaving its first len bytes for its owner.  Space
+ *  is committed to fd (with posix_fallocate()) as it is needed, so
+ *  that running out is an allocation failure rather than a SIGBUS.
+ *  Sets *err to MEM_ERR if not even len bytes can be committed.
+ */
+void init_store_region(uint8_t *base, size_t size, int fd,
+                       size_t regionOffset, size_t len, ErrNum *err);
+
+/** Read store memory from the object mapped at base, allocating
+ *  nothing.
+ */
+void attach_store_region(uint8_t *base);
+
+/** Go back to allocating store memory with malloc(). */
+void close_store_region(void);
+
+#endif //#ifndef STOREMEM_H_
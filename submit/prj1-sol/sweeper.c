@@ -0,0 +1,82 @@
+#include "sweeper.h"
+
+#include "chat.h"
+#include "errnum.h"
+#include "shmstore.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// The sweeper waits for wakeup on storeLock, so it only ever sweeps
+// while holding the lock; it is only signalled in order to stop.
+static pthread_mutex_t storeLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+static bool isStopping;         // protected by storeLock
+
+static bool isEnabled = false;
+static long intervalMs;
+static pthread_t sweepThread;
+
+// Sweep every intervalMs until stopped.  A failed sweep leaves the
+// store usable, so it is reported and retried at the next interval.
+static void *sweep(void *arg) {
+  pthread_mutex_lock(&storeLock);
+  while (!isStopping) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += intervalMs / 1000;
+    deadline.tv_nsec += intervalMs % 1000 * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    while (!isStopping &&
+           pthread_cond_timedwait(&wakeup, &storeLock, &deadline) == 0) ;
+    if (isStopping) break;
+    ErrNum err;
+    lock_shm_store();
+    sweep_chats(&err);
+    unlock_shm_store();
+    if (err != NO_ERR) {
+      fprintf(stderr, "sweep failed: %s\n", errnum_to_string(err));
+    }
+  }
+  pthread_mutex_unlock(&storeLock);
+  return NULL;
+}
+
+void init_sweeper(ErrNum *err) {
+  *err = NO_ERR;
+  const char *ms = getenv("CHAT_SWEEP_MS");
+  intervalMs = ms == NULL ? SWEEP_DEFAULT_MS : atol(ms);
+  if (intervalMs <= 0 || is_shm_reader()) return;
+  isStopping = false;
+  if (pthread_create(&sweepThread, NULL, sweep, NULL) != 0) {
+    *err = IO_ERR;
+    return;
+  }
+  isEnabled = true;
+}
+
+void lock_store(void) {
+  pthread_mutex_lock(&storeLock);
+  lock_shm_store();
+}
+
+void unlock_store(void) {
+  unlock_shm_store();
+  pthread_mutex_unlock(&storeLock);
+}
+
+void close_sweeper(void) {
+  if (!isEnabled) return;
+  pthread_mutex_lock(&storeLock);
+  isStopping = true;
+  pthread_cond_signal(&wakeup);
+  pthread_mutex_unlock(&storeLock);
+  pthread_join(sweepThread, NULL);
+  isEnabled = false;
+}
@@ -0,0 +1,37 @@
+#ifndef SWEEPER_H_
+#define SWEEPER_H_
+
+#include "errnum.h"
+
+/** Background sweeper which periodically calls sweep_chats() so that
+ *  expired messages are tombstoned and the space of dead messages is
+ *  reclaimed even while the serving thread is waiting for input.
+ *
+ *  The store itself is not thread-safe, so every access to it must be
+ *  made between lock_store() and unlock_store(); the sweeper holds the
+ *  same lock while it sweeps.  The lock is usable whether or not the
+ *  sweeper has been started.  With a shared memory store (see
+ *  shmstore.h) it also takes the store's lock across processes, and a
+ *  reader attached to the store never sweeps it.
+ *
+ *  Environment variable CHAT_SWEEP_MS gives the interval between
+ *  sweeps in milliseconds (default SWEEP_DEFAULT_MS); 0 disables the
+ *  sweeper.
+ */
+
+enum { SWEEP_DEFAULT_MS = 1000 };
+
+/** Start the sweeper unless it is disabled by the environment or this
+ *  process is a reader of a shared memory store.  Sets *err to IO_ERR
+ *  if its thread cannot be started.
+ */
+void init_sweeper(ErrNum *err);
+
+/** Acquire and release exclusive access to the store. */
+void lock_store(void);
+void unlock_store(void);
+
+/** Stop the sweeper's thread. */
+void close_sweeper(void);
+
+#endif //#ifndef SWEEPER_H_
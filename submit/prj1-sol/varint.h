@@ -0,0 +1,40 @@
+#ifndef VARINT_H_
+#define VARINT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** LEB128-style varints: 7 bits per byte, least significant first,
+ *  with the high bit set on all but the last byte.
+ */
+
+enum { MAX_VARINT_LEN = 10 };
+
+/** Return # of bytes in the encoding of v. */
+static inline size_t varint_len(size_t v) {
+  size_t n = 1;
+  for (; v >= 0x80; v >>= 7) n++;
+  return n;
+}
+
+/** Encode v at p and return a pointer just past it. */
+static inline uint8_t *put_varint(uint8_t *p, size_t v) {
+  for (; v >= 0x80; v >>= 7) *p++ = (v & 0x7f) | 0x80;
+  *p++ = v;
+  return p;
+}
+
+/** Return the varint at *p and advance *p past it. */
+static inline size_t get_varint(const uint8_t **p) {
+  size_t v = 0;
+  unsigned shift = 0;
+  uint8_t byte;
+  do {
+    byte = *(*p)++;
+    v |= (size_t)(byte & 0x7f) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  return v;
+}
+
+#endif //#ifndef VARINT_H_
@@ -0,0 +1,48 @@
+#ifndef WORD_H_
+#define WORD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Kinds of words as defined by the chat-io.h spec. */
+typedef enum {
+  WORD_OTHER,
+  WORD_USER,            // starts with '@'
+  WORD_TOPIC,           // starts with '#'
+  WORD_ROOM,            // starts with a letter
+  WORD_COUNT,           // a non-negative integer
+  WORD_BAD_COUNT,       // starts with a digit but is not an integer
+} WordKind;
+
+/** A word of a command line as produced by the lexer: a
+ *  NUL-terminated, lower-cased string along with its length, hash and
+ *  kind, all computed in a single pass over its bytes.  Since the
+ *  text is lower-cased, the hash is case-insensitive.
+ */
+typedef struct {
+  char *text;
+  size_t len;
+  uint64_t hash;
+  WordKind kind;
+  size_t count;         // value of a WORD_COUNT (saturates at SIZE_MAX)
+} Word;
+
+/** FNV-1a, fed one (already lower-cased) byte at a time.  This is the
+ *  hash used by Dict, so a Word's hash can be passed straight to the
+ *  dict_*_hashed() functions.
+ */
+#define WORD_HASH_BASIS 0xcbf29ce484222325ULL
+#define WORD_HASH_PRIME 0x100000001b3ULL
+
+static inline uint64_t word_hash_step(uint64_t h, unsigned char c) {
+  return (h ^ c) * WORD_HASH_PRIME;
+}
+
+/** Return the hash of the len bytes at s. */
+static inline uint64_t word_hash(const char *s, size_t len) {
+  uint64_t h = WORD_HASH_BASIS;
+  for (size_t i = 0; i < len; i++) h = word_hash_step(h, s[i]);
+  return h;
+}
+
+#endif //#ifndef WORD_H_